@@ -156,6 +156,21 @@ void UserCache::release(UserCache *entry)
         user_lock.release();
 }
 
+void UserCache::remove(const char *id)
+{
+    assert(id != NULL && *id != 0);
+
+    unsigned path = NamedObject::keyindex(id, USER_KEY_SIZE);
+
+    user_lock.modify();
+    UserCache *cp = request(id);
+    if(cp) {
+        cp->delist(&user_keys[path]);
+        cp->enlist(&user_freelist);
+    }
+    user_lock.commit();
+}
+
 void UserCache::add(const char *id, struct sockaddr *addr, time_t create, unsigned expire)
 {
     assert(id != NULL && *id != 0);
@@ -258,22 +258,12 @@ void control::reply(const char *msg)
     replytarget = NULL;
 }
 
-bool control::libexec(const char *fmt, ...)
+#ifndef _MSWINDOWS_
+// runs a command in a detached shell with input as its stdin, or /dev/null
+// if none, and output to the control fifo.  The intermediate child exits
+// at once, so it is reaped here and the shell is left to init.
+static bool spawn(const char *cmd, int input)
 {
-    assert(fmt != NULL);
-
-    va_list vargs;
-    char buf[256];
-
-    va_start(vargs, fmt);
-    if(fmt)
-        vsnprintf(buf, sizeof(buf), fmt, vargs);
-    va_end(vargs);
-
-    shell::debug(5, "executing %s", buf);
-
-#ifdef  _MSWINDOWS_
-#else
     int max = sizeof(fd_set) * 8;
     pid_t pid = fork();
 #ifdef  RLIMIT_NOFILE
@@ -282,6 +272,8 @@ bool control::libexec(const char *fmt, ...)
     if(!getrlimit(RLIMIT_NOFILE, &rlim))
         max = rlim.rlim_max;
 #endif
+    if(pid < 0)
+        return false;
     if(pid) {
         waitpid(pid, NULL, 0);
         return true;
@@ -292,7 +284,9 @@ bool control::libexec(const char *fmt, ...)
     ::signal(SIGCHLD, SIG_DFL);
     ::signal(SIGPIPE, SIG_DFL);
     int fd = open("/dev/null", O_RDWR);
-    dup2(fd, 0);
+    if(input < 0)
+        input = fd;
+    dup2(input, 0);
     dup2(fd, 2);
     dup2(fileno(fifo), 1);
     for(fd = 3; fd < max; ++fd)
@@ -300,10 +294,63 @@ bool control::libexec(const char *fmt, ...)
     pid = fork();
     if(pid > 0)
         ::exit(0);
-    ::execlp("/bin/sh", "sh", "-c", buf, NULL);
+    ::execlp("/bin/sh", "sh", "-c", cmd, NULL);
     ::exit(127);
+}
 #endif
+
+bool control::libexec(const char *fmt, ...)
+{
+    assert(fmt != NULL);
+
+    va_list vargs;
+    char buf[256];
+
+    va_start(vargs, fmt);
+    if(fmt)
+        vsnprintf(buf, sizeof(buf), fmt, vargs);
+    va_end(vargs);
+
+    shell::debug(5, "executing %s", buf);
+
+#ifdef  _MSWINDOWS_
     return true;
+#else
+    return spawn(buf, -1);
+#endif
+}
+
+fd_t control::pipexec(const char *fmt, ...)
+{
+    assert(fmt != NULL);
+
+    va_list vargs;
+    char buf[256];
+
+    va_start(vargs, fmt);
+    if(fmt)
+        vsnprintf(buf, sizeof(buf), fmt, vargs);
+    va_end(vargs);
+
+    shell::debug(5, "starting %s", buf);
+
+#ifdef  _MSWINDOWS_
+    return INVALID_HANDLE_VALUE;
+#else
+    int pfd[2];
+
+    if(pipe(pfd))
+        return INVALID_HANDLE_VALUE;
+
+    if(!spawn(buf, pfd[0])) {
+        ::close(pfd[0]);
+        ::close(pfd[1]);
+        return INVALID_HANDLE_VALUE;
+    }
+    ::close(pfd[0]);
+    fcntl(pfd[1], F_SETFD, FD_CLOEXEC);
+    return pfd[1];
+#endif
 }
 
 bool control::send(const char *fmt, ...)
@@ -27,9 +27,28 @@
 
 namespace sipwitch {
 
-modules::sipwitch::sipwitch() :
+#define HOOK_COUNT  10
+
+// plugins are only loaded at startup, so the lists are built once and are
+// then read without locking...
+static modules::sipwitch *none[1] = {NULL};
+static modules::sipwitch **table[HOOK_COUNT] = {
+    none, none, none, none, none, none, none, none, none, none};
+
+static unsigned slot(modules::hook_t hook)
+{
+    unsigned index = 0;
+
+    while(index < HOOK_COUNT && !(hook & (1 << index)))
+        ++index;
+
+    return index;
+}
+
+modules::sipwitch::sipwitch(unsigned hooks) :
 service::callback(MODULE_RUNLEVEL)
 {
+    hooked = hooks;
 }
 
 modules::generic::generic() :
@@ -78,14 +97,56 @@ char *modules::sipwitch::referRemote(MappedRegistry *rr, const char *target, cha
     return NULL;
 }
 
+void modules::dispatch(void)
+{
+    linked_pointer<sipwitch> cb;
+    unsigned index, count;
+
+    for(index = 0; index < HOOK_COUNT; ++index) {
+        count = 0;
+        cb = service::getModules();
+        while(is(cb)) {
+            if(cb->hooked & (1 << index))
+                ++count;
+            cb.next();
+        }
+
+        if(table[index] != none)
+            delete[] table[index];
+
+        if(!count) {
+            table[index] = none;
+            continue;
+        }
+
+        table[index] = new sipwitch *[count + 1];
+        count = 0;
+        cb = service::getModules();
+        while(is(cb)) {
+            if(cb->hooked & (1 << index))
+                table[index][count++] = *cb;
+            cb.next();
+        }
+        table[index][count] = NULL;
+    }
+}
+
+modules::sipwitch **modules::hooks(hook_t hook)
+{
+    unsigned index = slot(hook);
+
+    if(index >= HOOK_COUNT)
+        return none;
+
+    return table[index];
+}
+
 void modules::errlog(shell::loglevel_t level, const char *text)
 {
-    linked_pointer<service::callback> cb = service::getModules();
+    sipwitch **cb = hooks(HOOK_ERRLOG);
 
-    while(is(cb)) {
-        cb->errlog(level, text);
-        cb.next();
-    }
+    while(*cb)
+        static_cast<service::callback *>(*(cb++))->errlog(level, text);
 }
 
 void modules::cdrlog(FILE *fp, cdr *call)
@@ -99,12 +160,10 @@ void modules::cdrlog(FILE *fp, cdr *call)
             call->duration, call->ident, call->dialed, call->joined, call->display);
     }
 
-    linked_pointer<service::callback> cb = service::getModules();
+    sipwitch **cb = hooks(HOOK_CDRLOG);
 
-    while(is(cb)) {
-        cb->cdrlog(call);
-        cb.next();
-    }
+    while(*cb)
+        static_cast<service::callback *>(*(cb++))->cdrlog(call);
 
     if(!fp || call->type != cdr::STOP)
         return;
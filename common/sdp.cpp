@@ -0,0 +1,186 @@
+// Copyright (C) 2009-2014 David Sugar, Tycho Softworks.
+// Copyright (C) 2015 Cherokees of Idaho.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <sipwitch-config.h>
+#include <ucommon/ucommon.h>
+#include <ucommon/export.h>
+#include <sipwitch/sdp.h>
+
+namespace sipwitch {
+
+// source bodies come off the wire, so no ctype on arbitrary bytes...
+
+static inline bool blank(char ch)
+{
+    return ch == ' ' || ch == '\t';
+}
+
+static inline bool digit(char ch)
+{
+    return ch >= '0' && ch <= '9';
+}
+
+sdpfilter::sdpfilter()
+{
+    input = NULL;
+    output = NULL;
+    limit = used = 0;
+}
+
+sdpfilter::sdpfilter(const char *source, char *target, size_t size)
+{
+    set(source, target, size);
+}
+
+sdpfilter::~sdpfilter()
+{
+}
+
+void sdpfilter::set(const char *source, char *target, size_t size)
+{
+    input = source;
+    output = target;
+    limit = size;
+    used = 0;
+}
+
+bool sdpfilter::emit(const char *text, size_t size)
+{
+    // always leave room for the nul...
+    if(used + size >= limit)
+        return false;
+
+    memcpy(output + used, text, size);
+    used += size;
+    output[used] = 0;
+    return true;
+}
+
+bool sdpfilter::connect(unsigned family, const char *address, size_t size)
+{
+    return emit(address, size);
+}
+
+bool sdpfilter::media(unsigned port, unsigned count, const char *text, size_t size)
+{
+    return emit(text, size);
+}
+
+bool sdpfilter::connection(const char *line, const char *end)
+{
+    const char *cp = line + 4;
+    const char *ap, *ep;
+    unsigned family;
+
+    // c=IN IP4 address[/ttl[/count]]
+    if(!blank(*cp))
+        return emit(line, end - line);
+
+    while(cp < end && blank(*cp))
+        ++cp;
+
+    if(end - cp < 3 || strnicmp(cp, "ip", 2) || (cp[2] != '4' && cp[2] != '6'))
+        return emit(line, end - line);
+
+    family = cp[2] - '0';
+    ap = cp + 3;
+    if(ap >= end || !blank(*ap))
+        return emit(line, end - line);
+
+    while(ap < end && blank(*ap))
+        ++ap;
+
+    ep = ap;
+    while(ep < end && *ep != '/' && !blank(*ep))
+        ++ep;
+
+    if(ep == ap)
+        return emit(line, end - line);
+
+    return emit(line, ap - line) && connect(family, ap, ep - ap) && emit(ep, end - ep);
+}
+
+bool sdpfilter::announce(const char *line, const char *end)
+{
+    const char *cp = line + 2;
+    const char *pp, *ep;
+    unsigned port = 0, count = 1;
+
+    // m=media port[/count] proto fmt...
+    while(cp < end && !blank(*cp))
+        ++cp;
+    while(cp < end && blank(*cp))
+        ++cp;
+
+    ep = pp = cp;
+    while(ep < end && digit(*ep) && port < 65536)
+        port = port * 10 + (*(ep++) - '0');
+
+    if(ep == pp || port > 65535)
+        return emit(line, end - line);
+
+    if(ep < end && *ep == '/') {
+        cp = ++ep;
+        count = 0;
+        while(ep < end && digit(*ep) && count < 65536)
+            count = count * 10 + (*(ep++) - '0');
+        if(ep == cp)
+            return emit(line, end - line);
+    }
+
+    return emit(line, pp - line) && media(port, count, pp, ep - pp) && emit(ep, end - ep);
+}
+
+char *sdpfilter::rewrite(void)
+{
+    const char *line = input;
+    const char *end, *next;
+    bool ok;
+
+    used = 0;
+    if(!output || !limit)
+        return NULL;
+
+    *output = 0;
+    if(!line)
+        return output;
+
+    while(*line) {
+        next = strchr(line, '\n');
+        if(next)
+            end = next++;
+        else
+            end = next = line + strlen(line);
+
+        while(end > line && end[-1] == '\r')
+            --end;
+
+        if(end - line > 4 && !strnicmp(line, "c=in", 4))
+            ok = connection(line, end);
+        else if(end - line > 2 && !strnicmp(line, "m=", 2))
+            ok = announce(line, end);
+        else
+            ok = emit(line, end - line);
+
+        if(!ok || !emit("\r\n", 2))
+            return NULL;
+
+        line = next;
+    }
+    return output;
+}
+
+} // end namespace
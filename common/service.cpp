@@ -21,6 +21,7 @@
 #include <sipwitch/service.h>
 #include <sipwitch/modules.h>
 #include <sipwitch/events.h>
+#include <sipwitch/uri.h>
 #include <ctype.h>
 #include <errno.h>
 #include <stdarg.h>
@@ -62,9 +63,18 @@ voip::context_t service::callback::tcp_context = NULL;
 voip::context_t service::callback::udp_context = NULL;
 voip::context_t service::callback::tls_context = NULL;
 
+#ifdef  _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 static struct sockaddr_storage peering;
 static time_t started = 0l;
 static time_t periodic = 0l;
+static service *retired = NULL;
+static THREAD_LOCAL service *pinned = NULL;
+static THREAD_LOCAL unsigned pins = 0;
 
 static size_t xmldecode(char *out, size_t limit, const char *src)
 {
@@ -119,14 +129,20 @@ service::pointer::pointer(const char *id)
 {
     assert(id != NULL && *id != 0);
 
-    locking.access();
+    node = NULL;
+    if(!pin())
+        return;
+
     node = service::path(id);
+    if(!node)
+        unpin();
 }
 
 service::pointer::pointer(pointer const &copy)
 {
     node = copy.node;
-    locking.access();
+    if(node)
+        pin();
 }
 
 service::pointer::~pointer()
@@ -230,12 +246,13 @@ void service::callback::bind(const char *addr)
 
 service::instance::instance()
 {
-    service::locking.access();
+    generation = service::pin();
 }
 
 service::instance::~instance()
 {
-    service::locking.release();
+    if(generation)
+        service::unpin();
 }
 
 void service::keyclone::splice(keyclone *trunk)
@@ -254,6 +271,7 @@ memalloc(s), root()
     root.setPointer(NULL);
 
     contact = NULL;
+    refs = 0;
 
     if(!started) {
         time(&started);
@@ -307,14 +325,62 @@ long service::uptime(void)
     return (long)(now - started);
 }
 
+service *service::pin(void)
+{
+    service *gen;
+
+    if(pins++)
+        return pinned;
+
+    locking.access();
+    gen = cfg;
+    if(gen) {
+        Mutex::protect(gen);
+        ++gen->refs;
+        Mutex::release(gen);
+    }
+    locking.release();
+
+    if(!gen)
+        pins = 0;
+    pinned = gen;
+    return gen;
+}
+
+void service::unpin(void)
+{
+    service *gen = pinned;
+    bool last;
+
+    if(!pins || --pins)
+        return;
+
+    pinned = NULL;
+    if(!gen)
+        return;
+
+    Mutex::protect(gen);
+    last = (--gen->refs == 0);
+    Mutex::release(gen);
+
+    // a superseded generation goes away with its last reader...
+    if(last)
+        delete gen;
+}
+
 service::keynode *service::path(const char *id)
 {
     assert(id != NULL && *id != 0);
 
-    if(!cfg)
+    service *gen = pinned;
+
+    if(!gen)
+        gen = cfg;
+
+    if(!gen)
         return NULL;
 
-    return cfg->getPath(id);
+    return gen->getPath(id);
 }
 
 service::keynode *service::list(const char *id)
@@ -322,11 +388,15 @@ service::keynode *service::list(const char *id)
     assert(id != NULL && *id != 0);
 
     keynode *node;
+    service *gen = pinned;
 
-    if(!cfg)
+    if(!gen)
+        gen = cfg;
+
+    if(!gen)
         return NULL;
 
-    node = cfg->getPath(id);
+    node = gen->getPath(id);
     if(node)
         return node->getFirst();
     return NULL;
@@ -337,14 +407,13 @@ service::keynode *service::getUser(const char *id)
     assert(id != NULL && *id != 0);
     unsigned path;
     linked_pointer<keymap> map;
+    service *gen = pin();
 
-    if(!cfg)
-        goto bail;
-
-    locking.access();
+    if(!gen)
+        return NULL;
 
     path = NamedObject::keyindex(id, CONFIG_KEY_SIZE);
-    map = cfg->keys[path];
+    map = gen->keys[path];
 
     while(map) {
         if(!stricmp(map->id, id))
@@ -352,8 +421,7 @@ service::keynode *service::getUser(const char *id)
         map.next();
     }
 
-bail:
-    locking.release();
+    unpin();
     return NULL;
 }
 
@@ -362,14 +430,14 @@ service::keynode *service::getProtected(const char *id)
     assert(id != NULL && *id != 0);
 
     keynode *node;
+    service *gen = pin();
 
-    if(!cfg)
+    if(!gen)
         return NULL;
 
-    locking.access();
-    node = cfg->getPath(id);
+    node = gen->getPath(id);
     if(!node)
-        locking.release();
+        unpin();
     return node;
 }
 
@@ -386,15 +454,18 @@ service::keynode *service::getList(const char *path)
 
 service::keynode *service::get(void)
 {
-    if(cfg)
-        locking.access();
-    return &cfg->root;
+    service *gen = pin();
+
+    if(!gen)
+        return NULL;
+
+    return &gen->root;
 }
 
 void service::release(keynode *node)
 {
     if(node)
-        locking.release();
+        unpin();
 }
 
 service::keynode *service::getPath(const char *id)
@@ -706,6 +777,7 @@ void service::startup(void)
     shell::log(shell::NOTIFY, "startup");
 
     cdr::start();
+    srv::startup();
 
     for(unsigned int level = 0;level < (sizeof(callback::runlevels) / sizeof(LinkedObject *));++level) {
         sp = callback::runlevels[level];
@@ -729,6 +801,7 @@ void service::shutdown(void)
         }
     }
 
+    srv::shutdown();
     cdr::stop();
 }
 
@@ -782,10 +855,11 @@ void service::dumpfile(void)
 
     shell::log(DEBUG1, "%s\n",
         _TEXT("dumping config"));
-    locking.access();
-    if(cfg)
-        cfg->service::dump(fp);
-    locking.release();
+    service *gen = pin();
+    if(gen) {
+        gen->service::dump(fp);
+        unpin();
+    }
     fclose(fp);
 }
 
@@ -850,11 +924,9 @@ bool service::period(long slice)
     if(fp)
         fclose(fp);
 
-    linked_pointer<modules::sipwitch> cb = service::getModules();
-    while(is(cb)) {
-        cb->period(slice);
-        cb.next();
-    }
+    modules::sipwitch **cb = modules::hooks(modules::HOOK_PERIOD);
+    while(*cb)
+        (*(cb++))->period(slice);
     return true;
 }
 
@@ -879,10 +951,11 @@ void service::snapshot(void)
             cb.next();
         }
     }
-    locking.access();
-    if(cfg)
-        cfg->dump(fp);
-    locking.release();
+    service *gen = pin();
+    if(gen) {
+        gen->dump(fp);
+        unpin();
+    }
     fclose(fp);
     shell::log(DEBUG1, "%s\n", _TEXT("snapshot completed"));
 }
@@ -910,6 +983,7 @@ bool service::check(void)
 void service::commit(void)
 {
     service *orig;
+    bool last;
     linked_pointer<callback> cb;
     unsigned rl = 0;
 
@@ -925,6 +999,9 @@ void service::commit(void)
 
     confirm();
 
+    // the active generation holds its own reference...
+    refs = 1;
+
     locking.modify();
     if(contact)
         callback::sip_contact = (volatile char *)(contact);
@@ -944,11 +1021,17 @@ void service::commit(void)
     // send any config related reload events...
     events::reload();
 
-    // let short-term volatile references settle before we delete it...
-    if(orig) {
-        Thread::sleep(1000);
-        delete orig;
+    // short-term volatile references, like the published contact, may
+    // still point into the prior generation, so it is kept for one more
+    // reload cycle.  Older generations go away with their last reader.
+    if(retired) {
+        Mutex::protect(retired);
+        last = (--retired->refs == 0);
+        Mutex::release(retired);
+        if(last)
+            delete retired;
     }
+    retired = orig;
 }
 
 bool service::match(const char *digits, const char *match, bool partial)
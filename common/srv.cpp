@@ -50,6 +50,319 @@ typedef union {
 
 namespace sipwitch {
 
+#define RESOLVER_INDEX  177
+
+class __LOCAL resolver : public DetachedThread, public Conditional
+{
+public:
+    resolver();
+
+    inline void lock(void)
+        {Conditional::lock();};
+
+    inline void unlock(void)
+        {Conditional::unlock();};
+
+    inline void signal(void)
+        {Conditional::signal();};
+
+private:
+    void exit(void);
+    void run(void);
+};
+
+class __LOCAL refresh : public srv
+{
+public:
+    inline refresh(const char *uri) : srv()
+        {resolve(uri, false);};
+};
+
+class __LOCAL resolved : public LinkedObject
+{
+public:
+    char key[288];
+    char uri[MAX_URI_SIZE];
+    srv::address *list;
+    unsigned count;
+    unsigned ttl;
+    time_t expires;
+    bool refreshing;
+};
+
+class __LOCAL pending : public LinkedObject
+{
+public:
+    char uri[MAX_URI_SIZE];
+};
+
+static LinkedObject *cachemap[RESOLVER_INDEX];
+static LinkedObject *runlist = NULL;
+static Mutex private_lock;
+static resolver run;
+static bool running = false;
+static bool down = false;
+static unsigned limit = 256;
+static unsigned timeout = 300;
+static unsigned negative = 30;
+static unsigned stale = 30;
+static unsigned entries = 0;
+static unsigned long hits = 0, misses = 0, negatives = 0, stales = 0, prefetches = 0, deferrals = 0;
+
+resolver::resolver() : DetachedThread(), Conditional()
+{
+}
+
+void resolver::exit(void)
+{
+}
+
+void resolver::run(void)
+{
+    linked_pointer<pending> rp;
+    LinkedObject *next;
+
+    shell::log(DEBUG1, "starting resolver thread");
+
+    for(;;) {
+        Conditional::lock();
+        if(!running) {
+            Conditional::unlock();
+            shell::log(DEBUG1, "stopping resolver thread");
+            down = true;
+            return;
+        }
+        if(!runlist)
+            Conditional::wait();
+        rp = runlist;
+        runlist = NULL;
+        Conditional::unlock();
+        while(is(rp)) {
+            next = rp->getNext();
+            refresh lookup(rp->uri);
+            delete *rp;
+            rp = next;
+        }
+    }
+}
+
+static bool queue(const char *uri)
+{
+    linked_pointer<pending> lp;
+    pending *rp;
+
+    run.lock();
+    if(!running) {
+        run.unlock();
+        return false;
+    }
+
+    // many threads may miss on the same name before it is resolved...
+    lp = runlist;
+    while(is(lp)) {
+        if(eq(lp->uri, uri)) {
+            run.unlock();
+            return true;
+        }
+        lp.next();
+    }
+
+    rp = new pending;
+    String::set(rp->uri, sizeof(rp->uri), uri);
+    rp->enlist(&runlist);
+    ++prefetches;
+    run.signal();
+    run.unlock();
+    return true;
+}
+
+static void shuffle(srv::address *list, unsigned count)
+{
+    uint16_t rand;
+
+    while(count--) {
+        if(!list[count].weight)
+            continue;
+        Random::fill((unsigned char *)&rand, sizeof(rand));
+        rand &= 0x7fff;
+        list[count].weight = (1 + rand) % (10000 * list[count].weight);
+    }
+}
+
+static void purge(resolved *cp, unsigned path)
+{
+    cp->delist(&cachemap[path]);
+    if(cp->list)
+        delete[] cp->list;
+    delete cp;
+    --entries;
+}
+
+// expired entries past their stale period are no longer usable at all,
+// and when called with 0 we flush the entire cache.
+static void expire(time_t now)
+{
+    linked_pointer<resolved> cp;
+    LinkedObject *next;
+    unsigned path = 0;
+
+    while(path < RESOLVER_INDEX) {
+        cp = cachemap[path];
+        while(is(cp)) {
+            next = cp->getNext();
+            if(!now || cp->expires + (time_t)stale <= now)
+                purge(*cp, path);
+            cp = next;
+        }
+        ++path;
+    }
+}
+
+// when the cache is full of live entries, the one closest to expiring is
+// let go of, so that a new result, which a lookup may be waiting on, is
+// always kept.
+static void evict(void)
+{
+    linked_pointer<resolved> cp;
+    resolved *oldest = NULL;
+    unsigned path = 0, found = 0;
+
+    while(path < RESOLVER_INDEX) {
+        cp = cachemap[path];
+        while(is(cp)) {
+            if(!oldest || cp->expires < oldest->expires) {
+                oldest = *cp;
+                found = path;
+            }
+            cp.next();
+        }
+        ++path;
+    }
+
+    if(oldest)
+        purge(oldest, found);
+}
+
+// a cached result may be a negative one, with an empty list...
+static bool fetch(const char *key, srv::address **list, unsigned *count)
+{
+    unsigned path = NamedObject::keyindex(key, RESOLVER_INDEX);
+    linked_pointer<resolved> cp;
+    char uri[MAX_URI_SIZE];
+    bool prefetch = false;
+    time_t now;
+
+    time(&now);
+    uri[0] = 0;
+
+    private_lock.acquire();
+    cp = cachemap[path];
+    while(is(cp)) {
+        if(eq(cp->key, key))
+            break;
+        cp.next();
+    }
+
+    if(!is(cp) || (cp->expires <= now && (!cp->count || cp->expires + (time_t)stale <= now))) {
+        ++misses;
+        private_lock.release();
+        return false;
+    }
+
+    if(cp->expires <= now) {
+        ++stales;
+        prefetch = true;
+    }
+    else if((unsigned)(cp->expires - now) * 10 <= cp->ttl)
+        prefetch = true;
+
+    if(prefetch && !cp->refreshing && running) {
+        cp->refreshing = true;
+        String::set(uri, sizeof(uri), cp->uri);
+    }
+
+    if(cp->count)
+        ++hits;
+    else
+        ++negatives;
+
+    *count = cp->count;
+    *list = NULL;
+    if(cp->count) {
+        *list = new srv::address[cp->count];
+        memcpy(*list, cp->list, sizeof(srv::address) * cp->count);
+    }
+    private_lock.release();
+
+    if(uri[0] && !queue(uri)) {
+        private_lock.acquire();
+        cp = cachemap[path];
+        while(is(cp) && !eq(cp->key, key))
+            cp.next();
+        if(is(cp))
+            cp->refreshing = false;
+        private_lock.release();
+    }
+    return true;
+}
+
+static void store(const char *key, const char *uri, srv::address *list, unsigned count, unsigned ttl)
+{
+    unsigned path = NamedObject::keyindex(key, RESOLVER_INDEX);
+    linked_pointer<resolved> cp;
+    resolved *entry;
+    time_t now;
+
+    time(&now);
+
+    private_lock.acquire();
+    cp = cachemap[path];
+    while(is(cp)) {
+        if(eq(cp->key, key))
+            break;
+        cp.next();
+    }
+
+    if(is(cp) && (!ttl || !limit)) {
+        purge(*cp, path);
+        private_lock.release();
+        return;
+    }
+
+    if(!ttl || !limit) {
+        private_lock.release();
+        return;
+    }
+
+    if(is(cp)) {
+        entry = *cp;
+        if(entry->list)
+            delete[] entry->list;
+    }
+    else {
+        if(entries >= limit)
+            expire(now);
+        while(entries >= limit)
+            evict();
+        entry = new resolved;
+        String::set(entry->key, sizeof(entry->key), key);
+        String::set(entry->uri, sizeof(entry->uri), uri);
+        entry->enlist(&cachemap[path]);
+        ++entries;
+    }
+
+    entry->list = NULL;
+    entry->count = count;
+    entry->ttl = ttl;
+    entry->expires = now + ttl;
+    entry->refreshing = false;
+    if(count) {
+        entry->list = new srv::address[count];
+        memcpy(entry->list, list, sizeof(srv::address) * count);
+    }
+    private_lock.release();
+}
+
 srv::srv(const char *uri) : Socket::address()
 {
 #ifdef  _MSWINDOWS_
@@ -58,6 +371,7 @@ srv::srv(const char *uri) : Socket::address()
     srvlist = NULL;
     entry = NULL;
     count = 0;
+    async = waiting = false;
 
     set(uri);
 }
@@ -70,6 +384,7 @@ srv::srv() : Socket::address()
     srvlist = NULL;
     entry = NULL;
     count = 0;
+    async = waiting = false;
 }
 
 uint16_t srv::after(uint16_t prior)
@@ -118,10 +433,33 @@ struct sockaddr *srv::find(uint16_t priority, uint32_t weight)
 }
 
 void srv::set(const char *uri)
+{
+    resolve(uri, true);
+}
+
+void srv::prefer(void)
+{
+    srv::address *current = NULL;
+    unsigned index = 0;
+
+    entry = NULL;
+    while(index < count) {
+        if(!current || srvlist[index].priority < current->priority || srvlist[index].weight > current->weight) {
+            current = &srvlist[index];
+            entry = (struct sockaddr *)&srvlist[index].addr;
+            pri = srvlist[index].priority;
+        }
+        ++index;
+    }
+}
+
+void srv::resolve(const char *uri, bool cached)
 {
     int protocol = IPPROTO_UDP;
     int port = uri::portid(uri);
-    char host[256], svc[10];
+    char host[256], svc[10], key[288];
+    const char *sid = uri;
+    bool numeric = false;
     struct addrinfo hint;
 
     if(service::callback::out_context != service::callback::udp_context)
@@ -132,6 +470,7 @@ void srv::set(const char *uri)
 #endif
 
     clear();
+    waiting = false;
 
     String::set(svc, sizeof(svc), "sip");
 
@@ -171,6 +510,7 @@ void srv::set(const char *uri)
 
     if(Socket::is_numeric(host)) {
         hint.ai_flags |= AI_NUMERICHOST;
+        numeric = true;
 #ifdef  HAVE_RESOLV_H
         nosrv = true;
 #endif
@@ -199,6 +539,29 @@ void srv::set(const char *uri)
         cb.next();
     }
 
+    // numeric hosts never touch dns, so there is nothing to cache...
+    snprintf(key, sizeof(key), "%d/%d/%s/%s", hint.ai_family, protocol, svc, host);
+    if(!numeric && cached && fetch(key, &srvlist, &count)) {
+        shuffle(srvlist, count);
+        prefer();
+        return;
+    }
+
+    // a miss is left to the resolver thread if we may not wait for it,
+    // but only if its result, even a failed one, can then be cached...
+    if(!numeric && cached && async) {
+        private_lock.acquire();
+        waiting = (limit && timeout && negative);
+        private_lock.release();
+        if(waiting && queue(sid)) {
+            private_lock.acquire();
+            ++deferrals;
+            private_lock.release();
+            return;
+        }
+        waiting = false;
+    }
+
 #ifdef  HAVE_RESOLV_H
     int result;
     HEADER *hp;
@@ -206,7 +569,7 @@ void srv::set(const char *uri)
     uint16_t acount, qcount;
     unsigned char *mp, *ep, *cp;
     uint16_t type, weight, priority, hport, dlen;
-    srv::address *current = NULL;
+    uint32_t ttl, expires = 0;
 
     if(nosrv)
         goto nosrv;
@@ -254,7 +617,7 @@ void srv::set(const char *uri)
 		// class
 		cp += sizeof(uint16_t);
 
-        // ttl
+        ttl = ntohl(*((uint32_t *)cp));
         cp += sizeof(uint32_t);
 
         dlen = ntohs(*((uint16_t *)cp));
@@ -282,26 +645,25 @@ void srv::set(const char *uri)
         const struct sockaddr *sp = resolv.getAddr();
 
         if(sp) {
-            uint16_t rand;
-
-            Random::fill((unsigned char *)&rand, sizeof(rand));
-            rand &= 0x7fff;
-            if(weight)
-                weight = (1 + rand) % ( 10000 * weight);
-        
+            // a record set is only good for as long as its shortest ttl
+            if(!count || ttl < expires)
+                expires = ttl;
             srvlist[count].weight = weight;
             srvlist[count].priority = priority;
             Socket::store(&srvlist[count].addr, sp);
-            if(!current || priority < current->priority || weight > current->weight) {
-                current = &srvlist[count];
-                entry = (struct sockaddr *)&srvlist[count].addr;
-                pri = priority;
-            }
             ++count;
         }
 		cp += result;
     }
-	
+
+    // a zero ttl is still cached briefly, for lookups that were deferred
+    if(count)
+        store(key, sid, srvlist, count, expires ? expires : 1);
+    else
+        store(key, sid, NULL, 0, negative);
+
+    shuffle(srvlist, count);
+    prefer();
 	return;
 nosrv:
     if(srvlist) {
@@ -318,12 +680,80 @@ nosrv:
 	struct addrinfo *ap = list;
     count = 0;
 
-    if(ap)
-        entry = ap->ai_addr;
 	while(ap) {
 		++count;
 		ap = ap->ai_next;
 	}
+
+    // kept as a srv list, by priority of the order they were returned in
+    if(count) {
+        srvlist = new srv::address[count];
+        for(ap = list, count = 0; ap; ap = ap->ai_next, ++count) {
+            Socket::store(&srvlist[count].addr, ap->ai_addr);
+            srvlist[count].priority = count;
+            srvlist[count].weight = 0;
+        }
+    }
+
+    if(list) {
+        freeaddrinfo(list);
+        list = NULL;
+    }
+
+    if(!numeric)
+        store(key, sid, srvlist, count, count ? timeout : negative);
+
+    prefer();
+}
+
+void srv::cache(unsigned entries, unsigned ttl, unsigned failed, unsigned expired)
+{
+    private_lock.acquire();
+    limit = entries;
+    timeout = ttl;
+    negative = failed;
+    stale = expired;
+    if(!limit)
+        expire(0);
+    private_lock.release();
+}
+
+void srv::startup(void)
+{
+    // set before the thread runs, so lookups may be queued at once
+    run.lock();
+    running = true;
+    run.unlock();
+    run.start();
+}
+
+void srv::shutdown(void)
+{
+    run.lock();
+    if(!running) {
+        run.unlock();
+        return;
+    }
+    running = false;
+    run.signal();
+    run.unlock();
+
+    while(!down)
+        Thread::sleep(20);
+}
+
+void srv::snapshot(FILE *fp)
+{
+    private_lock.acquire();
+    fprintf(fp, "Resolver:\n");
+    fprintf(fp, "  cached entries: %u\n", entries);
+    fprintf(fp, "  cache hits: %lu\n", hits);
+    fprintf(fp, "  stale hits: %lu\n", stales);
+    fprintf(fp, "  negative hits: %lu\n", negatives);
+    fprintf(fp, "  cache misses: %lu\n", misses);
+    fprintf(fp, "  prefetches: %lu\n", prefetches);
+    fprintf(fp, "  deferred misses: %lu\n", deferrals);
+    private_lock.release();
 }
 
 srv::~srv()
@@ -349,7 +779,6 @@ void srv::clear(void)
 
 struct sockaddr *srv::next(void)
 {
-#ifdef  HAVE_RESOLV_H
     unsigned index = 0;
     srv::address *node = NULL, *np = NULL;
     ++pri;
@@ -366,9 +795,6 @@ struct sockaddr *srv::next(void)
     }
     pri = node->priority;
     entry = (struct sockaddr *)&node->addr;
-#else
-    entry = NULL;
-#endif
     return entry;
 }
 
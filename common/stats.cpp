@@ -22,31 +22,32 @@
 
 namespace sipwitch {
 
-static unsigned used = 0, total = 7;
+static volatile unsigned used = 0;
+static unsigned total = 7;
 static stats *base = NULL;
+static Mutex requests;
 
-static class __LOCAL sta : public mapped_array<stats>
+static class __LOCAL sta : public segmented_array<stats>
 {
 public:
     sta();
 
-    void init(void);
+    void init(bool hugepages);
 } shm;
 
-sta::sta() : mapped_array<stats>()
+sta::sta() : segmented_array<stats>()
 {
 }
 
-void sta::init(void)
+void sta::init(bool hugepages)
 {
-    const char *statmap = control::env("statmap");
-    ::remove(statmap);
-    create(statmap, total);
+    huge(hugepages);
+    create(control::env("statmap"), "sipwsta", STAT_VERSION, total);
 }
 
-stats *stats::create(void)
+stats *stats::create(bool hugepages)
 {
-    shm.init();
+    shm.init(hugepages);
     base = request("system");
     request("extension");
     request("service");
@@ -60,11 +61,16 @@ stats *stats::request(const char *id)
 {
     assert(id && *id);
 
-    if(used >= total)
+    requests.acquire();
+    if(used >= shm.count() && !shm.grow()) {
+        requests.release();
         return NULL;
+    }
 
-    stats *node = shm(used++);
+    stats *node = shm(used);
     snprintf(node->id, sizeof(node->id), "%s", id);
+    ++used;
+    requests.release();
     return node;
 }
 
@@ -83,6 +89,7 @@ unsigned stats::active(void) const
 void stats::assign(stat_t entry)
 {
     Mutex::protect(this);
+    changes.lock();
     ++data[entry].period;
     ++data[entry].total;
     ++data[entry].current;
@@ -90,6 +97,7 @@ void stats::assign(stat_t entry)
         data[entry].peak = data[entry].current;
     if(data[entry].current > data[entry].max)
         data[entry].max = data[entry].current;
+    changes.unlock();
     Mutex::release(this);
     if(this != base)
         base->assign(entry);
@@ -98,17 +106,18 @@ void stats::assign(stat_t entry)
 void stats::release(void)
 {
     shm.release();
-    shm.remove(control::env("statmap"));
 }
 
 void stats::release(stat_t entry)
 {
     Mutex::protect(this);
+    changes.lock();
     if(active() == 1)
         time(&lastcall);
     --data[entry].current;
     if(data[entry].current < data[entry].min)
         data[entry].min = data[entry].current;
+    changes.unlock();
     Mutex::release(this);
     if(this != base)
         base->release(entry);
@@ -121,7 +130,7 @@ void stats::period(FILE *fp)
     size_t len;
     time_t last;
 
-    while(pos < total) {
+    while(pos < used) {
         stats *node = shm(pos++);
         if(!node->id[0])
             continue;
@@ -134,6 +143,7 @@ void stats::period(FILE *fp)
             len = 0;
 
         Mutex::protect(node);
+        node->changes.lock();
         for(unsigned entry = 0; entry < 2; ++entry) {
             if(fp) {
                 snprintf(text + len, sizeof(text) - len, " %09lu %05hu %05hu",
@@ -147,6 +157,7 @@ void stats::period(FILE *fp)
             node->data[entry].period = 0;
         }
         last = node->lastcall;
+        node->changes.unlock();
         Mutex::release(node);
         if(fp)
             fprintf(fp, "%s %ld\n", text, (long)last);
@@ -179,6 +179,29 @@ void voip::send_options_response(context_t ctx, tid_t tid, int status, msg_t msg
     eXosip_unlock(ctx);
 }
 
+bool voip::make_subscription_response(context_t ctx, tid_t tid, int status, msg_t *msg)
+{
+    if(!msg)
+        return false;
+
+    *msg = NULL;
+    eXosip_lock(ctx);
+    eXosip_insubscription_build_answer(ctx, tid, status, msg);
+    if(!*msg) {
+        eXosip_unlock(ctx);
+        return false;
+    }
+    return true;
+}
+
+void voip::send_subscription_response(context_t ctx, tid_t tid, int status, msg_t msg)
+{
+    if(!msg)
+        eXosip_lock(ctx);
+    eXosip_insubscription_send_answer(ctx, tid, status, msg);
+    eXosip_unlock(ctx);
+}
+
 bool voip::make_answer_response(context_t ctx, tid_t tid, int status, msg_t *msg)
 {
     if(!msg)
@@ -584,6 +607,28 @@ void voip::send_options_response(context_t ctx, tid_t tid, int status, msg_t msg
     eXosip_unlock();
 }
 
+bool voip::make_subscription_response(context_t ctx, tid_t tid, int status, msg_t *msg)
+{
+    if(!msg)
+        return false;
+    *msg = NULL;
+    eXosip_lock();
+    eXosip_insubscription_build_answer(tid, status, msg);
+    if(!*msg) {
+        eXosip_unlock();
+        return false;
+    }
+    return true;
+}
+
+void voip::send_subscription_response(context_t ctx, tid_t tid, int status, msg_t msg)
+{
+    if(!msg)
+        eXosip_lock();
+    eXosip_insubscription_send_answer(tid, status, msg);
+    eXosip_unlock();
+}
+
 bool voip::make_answer_response(context_t ctx, tid_t tid, int status, msg_t *msg)
 {
     if(!msg)
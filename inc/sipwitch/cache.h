@@ -107,6 +107,12 @@ public:
      */
     static void add(const char *id, struct sockaddr *addr, time_t create, unsigned expire = 130);
 
+    /**
+     * Remove user from cache.
+     * @param id of user to remove.
+     */
+    static void remove(const char *id);
+
     /**
      * Find user record.
      * @param id to find.
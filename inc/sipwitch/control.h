@@ -115,6 +115,16 @@ public:
      */
     static bool libexec(const char *fmt, ...) __PRINTF(1, 2);
 
+    /**
+     * Start a long running shell command that reads from a pipe.  The
+     * command is detached the same way as for libexec, but this returns
+     * at once with the write end of a pipe feeding its standard input.
+     * Writes fail once the command has exited.
+     * @param format of shell command to execute.
+     * @return pipe to write to, or INVALID_HANDLE_VALUE on failure.
+     */
+    static fd_t pipexec(const char *fmt, ...) __PRINTF(1, 2);
+
     /**
      * Used to open an output session for returning control data.
      * @param id of output type.
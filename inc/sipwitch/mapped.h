@@ -24,6 +24,10 @@
 #ifndef _SIPWITCH_MAPPED_H_
 #define _SIPWITCH_MAPPED_H_
 
+#ifndef _UCOMMON_MAPPED_H_
+#include <ucommon/mapped.h>
+#endif
+
 #ifndef _SIPWITCH_NAMESPACE_H_
 #include <sipwitch/namespace.h>
 #endif
@@ -36,6 +40,14 @@
 #include <sipwitch/stats.h>
 #endif
 
+#ifndef _SIPWITCH_SEQLOCK_H_
+#include <sipwitch/seqlock.h>
+#endif
+
+#ifndef _SIPWITCH_SEGMENTS_H_
+#include <sipwitch/segments.h>
+#endif
+
 /**
  * Classes related to memory mapped objects from sipwitch server.
  * This covers the published interfaces to the sipwitch server itself.  These
@@ -71,10 +83,18 @@
 #define MAX_URI_SIZE        256
 #define MAX_SDP_BUFFER      1024
 
+#if defined(_MSC_VER)
+#define MAPPED_ALIGNED      __declspec(align(MAPPED_CACHELINE))
+#else
+#define MAPPED_ALIGNED      __attribute__((aligned(MAPPED_CACHELINE)))
+#endif
+
 namespace sipwitch {
 
 #define CALL_MAP        "sipwitch.calls"
 #define REGISTRY_MAP    "sipwitch.regs"
+#define REGISTRY_VERSION    5
+#define CALL_VERSION        1
 
 /**
  * User profiles are used to map features and toll restriction level together
@@ -89,29 +109,26 @@ typedef struct {
 /**
  * Representation of a mapped active user record.  These exist in shared
  * memory.  They are used as data structures inside the server, and also
- * can be examined by external client applications.
+ * can be examined by external client applications.  Fields used for
+ * lookups and expiration are kept together in the first cache line of
+ * each entry, and the in use counter, which changes with every call, is
+ * kept apart from them at the end.
  * @author David Sugar <dyfet@gnutelephony.org>
  */
-class MappedRegistry : public LinkedObject
+class MAPPED_ALIGNED MappedRegistry : public LinkedObject
 {
 public:
     typedef enum {OFFLINE = 0, IDLE, BUSY, AWAY, DND} status_t;
 
-    char    userid[MAX_USERID_SIZE];
-    char    display[MAX_DISPLAY_SIZE];
-    char    remote[MAX_USERID_SIZE];
-    char    network[MAX_NETWORK_SIZE];
-    status_t status;
+    volatile time_t  expires;   // when registry expires as a whole
+    time_t  created;            // initial registration
     enum {EXPIRED = 0, USER, GATEWAY, SERVICE, REJECT, REFER, TEMPORARY, EXTERNAL} type;
-    bool hidden;
-    voip::reg_t rid;            // registry remap or peer id
+    status_t status;
     unsigned ext;               // 0 or extnum
     unsigned count;             // active regs count
-    volatile unsigned inuse;    // in use for call count
-    sockaddr_internet contact;  // last/newest created contact registration
-    time_t  created;            // initial registration
-    volatile time_t  expires;   // when registry expires as a whole
-    profile_t profile;          // profile at time of registration
+    voip::reg_t rid;            // registry remap or peer id
+    bool hidden;
+    MappedSequence changes;     // odd while server is changing entry
     union {
         struct {                // external registry properties...
             const char *identity;   // forced identity string when calling
@@ -124,6 +141,14 @@ public:
             LinkedObject *routes;   // active route records
         } internal;
     } source;
+    sockaddr_internet contact;  // last/newest created contact registration
+    char    userid[MAX_USERID_SIZE];
+    char    display[MAX_DISPLAY_SIZE];
+    char    remote[MAX_USERID_SIZE];
+    char    network[MAX_NETWORK_SIZE];
+    profile_t profile;          // profile at time of registration
+    volatile unsigned inuse;    // in use for call count
+    unsigned limit;             // calls allowed at once, 0 for no limit
 
     inline bool is_user(void) const
         {return (type == USER);}
@@ -136,6 +161,17 @@ public:
 
     inline bool has_feature(unsigned short X) const
         {return is_profiled() && (profile.features & X);}
+
+    /**
+     * Read only view of the registry map for client applications.
+     * @author David Sugar <dyfet@gnutelephony.org>
+     */
+    class view : public segmented_view<MappedRegistry>
+    {
+    public:
+        inline view(const char *name) :
+            segmented_view<MappedRegistry>(name, "sipwreg", REGISTRY_VERSION) {}
+    };
 };
 
 /**
@@ -155,6 +191,18 @@ public:
     char display[MAX_DISPLAY_SIZE];
     uint32_t sequence;
     int cid;
+    MappedSequence changes;
+
+    /**
+     * Read only view of the call map for client applications.
+     * @author David Sugar <dyfet@gnutelephony.org>
+     */
+    class view : public segmented_view<MappedCall>
+    {
+    public:
+        inline view(const char *name) :
+            segmented_view<MappedCall>(name, "sipwcal", CALL_VERSION) {}
+    };
 };
 
 } // namespace sipwitch
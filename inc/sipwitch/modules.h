@@ -57,6 +57,24 @@ class __EXPORT modules
 public:
     typedef enum {REG_FAILED, REG_SUCCESS} regmode_t;
 
+    /**
+     * Hooks a plugin may implement.  A plugin names the hooks it
+     * implements when created, and is only called for those.
+     */
+    typedef enum {
+        HOOK_PERIOD =       0x0001,
+        HOOK_ANNOUNCE =     0x0002,
+        HOOK_ACTIVATING =   0x0004,
+        HOOK_EXPIRING =     0x0008,
+        HOOK_REGISTRATION = 0x0010,
+        HOOK_AUTHENTICATE = 0x0020,
+        HOOK_REFER_LOCAL =  0x0040,
+        HOOK_REFER_REMOTE = 0x0080,
+        HOOK_CDRLOG =       0x0100,
+        HOOK_ERRLOG =       0x0200,
+        HOOK_ALL =          0x03ff
+    } hook_t;
+
     /**
      * Common base class for sipwitch plugin services.  This provides
      * interfaces for server and runtime library callbacks to notify
@@ -65,12 +83,18 @@ public:
      */
     class __EXPORT sipwitch : public service::callback
     {
+    private:
+        friend class modules;
+
+        unsigned hooked;
+
     protected:
         /**
          * Create a service instance and add to runtime list of services to
          * start and stop.
+         * @param hooks this plugin implements, all if not given.
          */
-        sipwitch();
+        sipwitch(unsigned hooks = HOOK_ALL);
 
     public:
         /**
@@ -174,6 +198,20 @@ public:
         virtual srv::address *resolve(const char *uri, struct addrinfo *hints);
     };
 
+    /**
+     * Build the list of plugins to call for each hook.  This is done once
+     * all plugins are loaded and before the server starts.  Until then no
+     * plugin hooks are called.
+     */
+    static void dispatch(void);
+
+    /**
+     * Get the plugins that implement a hook.
+     * @param hook to get plugins for.
+     * @return nul terminated list of plugins, empty if none.
+     */
+    static sipwitch **hooks(hook_t hook);
+
     /**
      * Post cdr record to a file. This provides a generic way to output
      * cdr info, such as to a fifo for a database logger.
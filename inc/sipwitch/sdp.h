@@ -0,0 +1,108 @@
+// Copyright (C) 2009-2014 David Sugar, Tycho Softworks.
+// Copyright (C) 2015 Cherokees of Idaho.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * Rewrite sdp bodies in a single pass.  Lines of the source body are
+ * copied straight to the target buffer, and only the address of connection
+ * lines and the port of media lines are offered to a derived class to
+ * replace.  This is placed in common so plugins may rewrite sdp too.
+ * @file sipwitch/sdp.h
+ */
+
+#ifndef _SIPWITCH_SDP_H_
+#define _SIPWITCH_SDP_H_
+
+#ifndef _UCOMMON_STRING_H_
+#include <ucommon/string.h>
+#endif
+
+#ifndef _SIPWITCH_NAMESPACE_H_
+#include <sipwitch/namespace.h>
+#endif
+
+namespace sipwitch {
+
+/**
+ * Single pass sdp rewriter.  Each line is written with a cr/lf ending
+ * whatever line ending the source used.  The default filter copies the
+ * body unchanged.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+class __EXPORT sdpfilter
+{
+private:
+    const char *input;
+    char *output;
+    size_t limit, used;
+
+    bool connection(const char *line, const char *end);
+    bool announce(const char *line, const char *end);
+
+protected:
+    /**
+     * Write text to the target.  Hooks use this to write what replaces
+     * the text they were given.
+     * @param text to write, need not be nul terminated.
+     * @param size of text.
+     * @return false if the target is full.
+     */
+    bool emit(const char *text, size_t size);
+
+    /**
+     * Write the address of a connection line.
+     * @param family of address, 4 or 6.
+     * @param address in the source body, not nul terminated.
+     * @param size of address.
+     * @return false to fail the rewrite.
+     */
+    virtual bool connect(unsigned family, const char *address, size_t size);
+
+    /**
+     * Write the port and port count of a media line.
+     * @param port of media.
+     * @param count of ports, 1 if none given.
+     * @param text of port and count in the source body.
+     * @param size of text.
+     * @return false to fail the rewrite.
+     */
+    virtual bool media(unsigned port, unsigned count, const char *text, size_t size);
+
+public:
+    sdpfilter();
+    sdpfilter(const char *source, char *target, size_t size);
+    virtual ~sdpfilter();
+
+    /**
+     * Set the source body and target buffer to rewrite.
+     * @param source body.
+     * @param target buffer.
+     * @param size of target buffer.
+     */
+    void set(const char *source, char *target, size_t size);
+
+    /**
+     * Rewrite the source body into the target buffer.
+     * @return target, or NULL if it did not fit or a hook failed.
+     */
+    char *rewrite(void);
+
+    inline size_t size(void) const
+        {return used;}
+};
+
+} // namespace sipwitch
+
+#endif
@@ -0,0 +1,345 @@
+// Copyright (C) 2009-2014 David Sugar, Tycho Softworks.
+// Copyright (C) 2015 Cherokees of Idaho.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * Segmented shared memory maps.  A map starts as a single named segment,
+ * which holds a directory page and the first chunk of entries, and grows
+ * by adding further named segments of the same number of entries as they
+ * are needed.  Entries never move once mapped, so the server may keep
+ * pointers to them, and client applications follow growth by re-reading
+ * the directory page.
+ * @file sipwitch/segments.h
+ */
+
+#ifndef _SIPWITCH_SEGMENTS_H_
+#define _SIPWITCH_SEGMENTS_H_
+
+#ifndef _UCOMMON_MAPPED_H_
+#include <ucommon/mapped.h>
+#endif
+
+#ifndef _UCOMMON_STRING_H_
+#include <ucommon/string.h>
+#endif
+
+#ifndef _SIPWITCH_NAMESPACE_H_
+#include <sipwitch/namespace.h>
+#endif
+
+#ifndef _SIPWITCH_SEQLOCK_H_
+#include <sipwitch/seqlock.h>
+#endif
+
+#ifndef _MSWINDOWS_
+#include <sys/mman.h>
+#endif
+
+#define MAPPED_CACHELINE    64
+#define MAPPED_SEGMENTS     64
+
+namespace sipwitch {
+
+/**
+ * Directory page of a segmented shared memory map.  This is one cache line,
+ * so that entries are cache line aligned, and records the layout the map
+ * was created with, so that a client built against a different layout can
+ * tell.  Segments after the first are named after the map with a ".n"
+ * suffix.
+ */
+typedef struct {
+    char magic[8];              // set once the map is ready
+    uint32_t version;           // layout version of entries
+    uint32_t header;            // offset of first entry
+    uint32_t size;              // size of each entry
+    volatile uint32_t count;    // entries mapped in all segments
+    uint32_t chunk;             // entries in each segment
+    volatile uint32_t segments; // segments mapped
+    char reserved[MAPPED_CACHELINE - 32];
+} mapheader_t;
+
+/**
+ * Server side of a segmented shared memory map.  Segments are only added,
+ * and the caller must serialize growth with whatever lock already protects
+ * allocation of entries.  Lookup of mapped entries needs no lock.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+template <class T>
+class segmented_array
+{
+private:
+    MappedMemory *segment[MAPPED_SEGMENTS];
+    caddr_t base[MAPPED_SEGMENTS];
+    mapheader_t *header;
+    char id[64];
+    unsigned chunk, maximum, advised;
+    volatile unsigned segments;
+    bool hugepages;
+
+    void advise(caddr_t addr, size_t size)
+    {
+#ifdef  MADV_HUGEPAGE
+        if(hugepages && !madvise(addr, size, MADV_HUGEPAGE))
+            ++advised;
+#endif
+    }
+
+    bool map(unsigned index, size_t offset)
+    {
+        char name[80];
+
+        if(index)
+            snprintf(name, sizeof(name), "%s.%u", id, index);
+        else
+            String::set(name, sizeof(name), id);
+
+        MappedMemory::remove(name);
+        segment[index] = new MappedMemory(name, offset + chunk * sizeof(T));
+        if(!segment[index]->len()) {
+            delete segment[index];
+            segment[index] = NULL;
+            return false;
+        }
+
+        advise(segment[index]->addr(), segment[index]->len());
+        base[index] = segment[index]->addr() + offset;
+        for(unsigned pos = 0; pos < chunk; ++pos)
+            new(base[index] + pos * sizeof(T)) T;
+        return true;
+    }
+
+public:
+    inline segmented_array()
+        {header = NULL; chunk = maximum = advised = segments = 0; hugepages = false;}
+
+    inline ~segmented_array()
+        {release();}
+
+    /**
+     * Create the first segment of the map.
+     * @param name of map.
+     * @param magic to mark the map with once it is ready.
+     * @param version of entry layout.
+     * @param count of entries in each segment.
+     * @param limit of segments the map may grow to.
+     * @return true if mapped.
+     */
+    bool create(const char *name, const char *magic, unsigned version, unsigned count, unsigned limit = MAPPED_SEGMENTS)
+    {
+        release();
+        String::set(id, sizeof(id), name);
+        chunk = count;
+        maximum = limit;
+        if(!maximum)
+            maximum = 1;
+        else if(maximum > MAPPED_SEGMENTS)
+            maximum = MAPPED_SEGMENTS;
+
+        if(!chunk || !map(0, sizeof(mapheader_t)))
+            return false;
+
+        // clients only trust the map once the header says it is ready
+        segments = 1;
+        header = reinterpret_cast<mapheader_t *>(segment[0]->addr());
+        header->version = version;
+        header->header = sizeof(mapheader_t);
+        header->size = sizeof(T);
+        header->chunk = chunk;
+        header->count = chunk;
+        header->segments = 1;
+        MAPPED_BARRIER();
+        String::set(header->magic, sizeof(header->magic), magic);
+        return true;
+    }
+
+    /**
+     * Add another segment to the map.
+     * @return true if the map grew, false if at its limit or out of memory.
+     */
+    bool grow(void)
+    {
+        if(!header || segments >= maximum || !map(segments, 0))
+            return false;
+
+        // entries are ready before anyone may index into them
+        MAPPED_BARRIER();
+        ++segments;
+        header->segments = segments;
+        MAPPED_BARRIER();
+        header->count = segments * chunk;
+        return true;
+    }
+
+    /**
+     * Release and remove all segments of the map.
+     */
+    void release(void)
+    {
+        char name[80];
+
+        while(segments) {
+            --segments;
+            segment[segments]->release();
+            delete segment[segments];
+            segment[segments] = NULL;
+            if(segments)
+                snprintf(name, sizeof(name), "%s.%u", id, segments);
+            else
+                String::set(name, sizeof(name), id);
+            MappedMemory::remove(name);
+        }
+        header = NULL;
+        advised = 0;
+    }
+
+    /**
+     * Find the index of a mapped entry.
+     * @param entry to find.
+     * @return index of entry, or count() if not in the map.
+     */
+    unsigned index(const T *entry) const
+    {
+        const caddr_t pos = (const caddr_t)entry;
+
+        for(unsigned seg = 0; seg < segments; ++seg) {
+            if(pos >= base[seg] && pos < base[seg] + chunk * sizeof(T))
+                return seg * chunk + (unsigned)((pos - base[seg]) / sizeof(T));
+        }
+        return count();
+    }
+
+    inline T *operator()(unsigned index)
+        {return reinterpret_cast<T *>(base[index / chunk] + (index % chunk) * sizeof(T));}
+
+    inline unsigned count(void) const
+        {return segments * chunk;}
+
+    inline unsigned size(void) const
+        {return segments;}
+
+    inline unsigned limit(void) const
+        {return maximum;}
+
+    /**
+     * Ask the kernel to back segments mapped from now on with transparent
+     * huge pages, where it can.  This only matters for large maps.
+     * @param enable huge pages.
+     */
+    inline void huge(bool enable)
+        {hugepages = enable;}
+
+    /**
+     * Number of segments the kernel accepted huge page advice for.
+     * @return segments advised.
+     */
+    inline unsigned huge(void) const
+        {return advised;}
+
+    inline operator bool() const
+        {return header != NULL;}
+
+    inline bool operator!() const
+        {return header == NULL;}
+};
+
+/**
+ * Read only view of a segmented shared memory map for client applications.
+ * The view is empty if the server is not running, or if the map was created
+ * with a different layout than the client was built with.  Segments the
+ * server added since the view was opened are mapped when count is asked.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+template <class T>
+class segmented_view
+{
+private:
+    MappedMemory *segment[MAPPED_SEGMENTS];
+    caddr_t base[MAPPED_SEGMENTS];
+    volatile const mapheader_t *header;
+    char id[64];
+    unsigned chunk, segments;
+
+    void follow(void)
+    {
+        char name[80];
+        unsigned limit;
+
+        if(!header)
+            return;
+
+        limit = header->segments;
+        MAPPED_BARRIER();
+        if(limit > MAPPED_SEGMENTS)
+            limit = MAPPED_SEGMENTS;
+
+        while(segments < limit) {
+            snprintf(name, sizeof(name), "%s.%u", id, segments);
+            segment[segments] = new MappedMemory(name);
+            if(segment[segments]->len() < chunk * sizeof(T)) {
+                delete segment[segments];
+                segment[segments] = NULL;
+                return;
+            }
+            base[segments] = segment[segments]->addr();
+            ++segments;
+        }
+    }
+
+public:
+    segmented_view(const char *name, const char *magic, unsigned version)
+    {
+        mapheader_t copy;
+
+        header = NULL;
+        chunk = segments = 0;
+        String::set(id, sizeof(id), name);
+        segment[0] = new MappedMemory(name);
+        if(segment[0]->len() < sizeof(copy) || !segment[0]->copy(0, &copy, sizeof(copy)))
+            return;
+
+        if(strncmp(copy.magic, magic, sizeof(copy.magic)) || copy.version != version || copy.size != sizeof(T) || copy.header != sizeof(mapheader_t) || !copy.chunk)
+            return;
+
+        if(segment[0]->len() < sizeof(copy) + copy.chunk * sizeof(T))
+            return;
+
+        chunk = copy.chunk;
+        base[0] = segment[0]->addr() + sizeof(copy);
+        header = reinterpret_cast<volatile const mapheader_t *>(segment[0]->addr());
+        segments = 1;
+        follow();
+    }
+
+    ~segmented_view()
+    {
+        if(!segments)
+            delete segment[0];
+        while(segments)
+            delete segment[--segments];
+    }
+
+    inline unsigned count(void)
+        {follow(); return segments * chunk;}
+
+    inline volatile const T *operator()(unsigned index)
+        {return reinterpret_cast<volatile const T *>(base[index / chunk] + (index % chunk) * sizeof(T));}
+
+    inline bool copy(unsigned index, T& buffer)
+        {return MappedSequence::copy<T>(buffer, (*this)(index));}
+};
+
+} // namespace sipwitch
+
+#endif
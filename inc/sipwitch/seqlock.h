@@ -0,0 +1,98 @@
+// Copyright (C) 2009-2014 David Sugar, Tycho Softworks.
+// Copyright (C) 2015 Cherokees of Idaho.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * Sequence locks for records kept in shared memory.  The server changes
+ * these records in place while client applications may be reading them,
+ * so each record carries a sequence counter which is odd while the record
+ * is being changed.  A client copies a record without taking any lock, and
+ * copies it again if the counter changed while it was doing so.
+ * @file sipwitch/seqlock.h
+ */
+
+#ifndef _SIPWITCH_SEQLOCK_H_
+#define _SIPWITCH_SEQLOCK_H_
+
+#ifndef _UCOMMON_THREAD_H_
+#include <ucommon/thread.h>
+#endif
+
+#ifndef _SIPWITCH_NAMESPACE_H_
+#include <sipwitch/namespace.h>
+#endif
+
+#if defined(_MSC_VER)
+#define MAPPED_BARRIER()    MemoryBarrier()
+#else
+#define MAPPED_BARRIER()    __sync_synchronize()
+#endif
+
+#define MAPPED_RETRIES      1000
+
+namespace sipwitch {
+
+/**
+ * Sequence counter of a shared memory record.  The server brackets changes
+ * to a record with lock and unlock.  Writers of the same record must
+ * already be serialized by the server, so this never blocks the server.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+class MappedSequence
+{
+private:
+    volatile uint32_t counter;
+
+public:
+    inline void lock(void)
+        {++counter; MAPPED_BARRIER();}
+
+    inline void unlock(void)
+        {MAPPED_BARRIER(); ++counter;}
+
+    /**
+     * Copy a consistent snapshot of a record in shared memory.  The record
+     * type must have a MappedSequence member named changes.  If the server
+     * died while changing the record, it is copied as it is after a while.
+     * @param buffer to copy record into.
+     * @param record in shared memory to copy.
+     * @return true if the copy is consistent.
+     */
+    template <typename T>
+    static bool copy(T& buffer, volatile const T *record)
+    {
+        uint32_t seq;
+        unsigned retries = 0;
+
+        for(;;) {
+            seq = record->changes.counter;
+            if((seq & 1) && ++retries < MAPPED_RETRIES) {
+                Thread::yield();
+                continue;
+            }
+            MAPPED_BARRIER();
+            memcpy(&buffer, (const void *)record, sizeof(T));
+            MAPPED_BARRIER();
+            if(record->changes.counter == seq && !(seq & 1))
+                return true;
+            if(++retries >= MAPPED_RETRIES)
+                return false;
+        }
+    }
+};
+
+} // namespace sipwitch
+
+#endif
@@ -155,15 +155,20 @@ public:
 
     /**
      * The current singleton instance of the active xml configuration tree.
+     * The generation active when the instance is created is held for the
+     * lifetime of the instance, even if a newer config is committed.
      */
     class __EXPORT instance
     {
+    private:
+        service *generation;
+
     public:
         instance();
         ~instance();
 
         inline const service *operator->() const
-            {return service::cfg;}
+            {return generation;}
     };
 
     /**
@@ -339,10 +344,27 @@ protected:
     stringbuf<1024> buffer;
     LinkedObject *keys[CONFIG_KEY_SIZE];
     const char *contact;
+    unsigned refs;
 
     static service *cfg;
     static condlock_t locking;
 
+    /**
+     * Hold the active config generation for the calling thread.  Nested
+     * holds from the same thread share the generation first held, so a
+     * thread always sees one consistent config until it fully releases.
+     * The lock is only held long enough to reference the generation,
+     * so a commit never waits for readers to finish.
+     * @return generation held or NULL if not yet configured.
+     */
+    static service *pin(void);
+
+    /**
+     * Release a generation held by pin.  When the last reference to a
+     * superseded generation is released, it is deleted.
+     */
+    static void unpin(void);
+
     /**
      * Add attributes in a XML entity as child nodes of the xml node.
      * @param node in tree of our node.
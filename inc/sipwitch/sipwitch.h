@@ -36,6 +36,10 @@
 #include <sipwitch/control.h>
 #include <sipwitch/cache.h>
 #include <sipwitch/stats.h>
+#include <sipwitch/seqlock.h>
+#include <sipwitch/timing.h>
+#include <sipwitch/segments.h>
+#include <sipwitch/sdp.h>
 #include <sipwitch/uri.h>
 #include <sipwitch/cdr.h>
 
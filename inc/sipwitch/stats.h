@@ -40,9 +40,18 @@
 #include <sipwitch/namespace.h>
 #endif
 
+#ifndef _SIPWITCH_SEQLOCK_H_
+#include <sipwitch/seqlock.h>
+#endif
+
+#ifndef _SIPWITCH_SEGMENTS_H_
+#include <sipwitch/segments.h>
+#endif
+
 namespace sipwitch {
 
-#define STAT_MAP    "sipwitch.stats"
+#define STAT_MAP        "sipwitch.stats"
+#define STAT_VERSION    1
 
 /**
  * A stat element of call traffic.  Stats may cover a specific element for
@@ -72,6 +81,7 @@ public:
 
     time_t lastcall;
     unsigned short limit;
+    MappedSequence changes;
 
     /**
      * Assign a call to inbound or outbound statistic for this stat node.
@@ -105,12 +115,13 @@ public:
      * Create stats in shared memory pool.  Creates several default statistic
      * nodes for groups of calls, and returns the "system" stat node for the
      * total server.
+     * @param hugepages to advise for the stat map, as for the registry.
      */
-    static stats *create(void);
+    static stats *create(bool hugepages = false);
 
     /**
      * Request a stat node from the memory pool by id.  If the node does not
-     * exist, it is created.
+     * exist, it is created.  The pool grows if all nodes are in use.
      * @return node from shared memory or NULL if out of nodes.
      */
     static stats *request(const char *id);
@@ -125,6 +136,17 @@ public:
      * Release stat nodes shared memory segment.
      */
     static void release(void);
+
+    /**
+     * Read only view of the stat map for client applications.
+     * @author David Sugar <dyfet@gnutelephony.org>
+     */
+    class view : public segmented_view<stats>
+    {
+    public:
+        inline view(const char *name) :
+            segmented_view<stats>(name, "sipwsta", STAT_VERSION) {}
+    };
 };
 
 } // namespace sipwitch
@@ -0,0 +1,125 @@
+// Copyright (C) 2009-2014 David Sugar, Tycho Softworks.
+// Copyright (C) 2015 Cherokees of Idaho.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * Elapsed time clocks and latency percentiles.  These are inline so that
+ * the server, its benchmarks, and the load and replay utilities, which do
+ * not link the runtime library, all measure time the same way.
+ * @file sipwitch/timing.h
+ */
+
+#ifndef _SIPWITCH_TIMING_H_
+#define _SIPWITCH_TIMING_H_
+
+#ifndef _UCOMMON_THREAD_H_
+#include <ucommon/thread.h>
+#endif
+
+#ifndef _SIPWITCH_NAMESPACE_H_
+#include <sipwitch/namespace.h>
+#endif
+
+#ifndef _MSWINDOWS_
+#include <sys/time.h>
+#endif
+
+#include <stdlib.h>
+
+namespace sipwitch {
+
+/**
+ * Millisecond and microsecond clocks, and percentiles of samples taken
+ * with them.
+ * @author David Sugar <dyfet@gnutelephony.org>
+ */
+class timing
+{
+private:
+    template <typename T>
+    static int compare(const void *p1, const void *p2)
+    {
+        T v1 = *((const T *)p1);
+        T v2 = *((const T *)p2);
+
+        if(v1 < v2)
+            return -1;
+        if(v1 > v2)
+            return 1;
+        return 0;
+    }
+
+public:
+    /**
+     * Get elapsed milliseconds.  Only differences between two readings
+     * are meaningful.
+     * @return milliseconds.
+     */
+    static inline unsigned long mstime(void)
+    {
+#ifdef  _MSWINDOWS_
+        return GetTickCount();
+#else
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        return (unsigned long)now.tv_sec * 1000l + now.tv_usec / 1000l;
+#endif
+    }
+
+    /**
+     * Get elapsed microseconds, to millisecond accuracy on windows.
+     * @return microseconds.
+     */
+    static inline unsigned long usecs(void)
+    {
+#ifdef  _MSWINDOWS_
+        return GetTickCount() * 1000l;
+#else
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        return (unsigned long)now.tv_sec * 1000000l + now.tv_usec;
+#endif
+    }
+
+    /**
+     * Sort samples so percentiles may be taken from them.
+     * @param samples to sort in place.
+     * @param count of samples.
+     */
+    template <typename T>
+    static void sort(T *samples, unsigned long count)
+        {qsort(samples, count, sizeof(T), &compare<T>);}
+
+    /**
+     * Get a percentile of sorted samples.
+     * @param samples that were sorted.
+     * @param count of samples, which must not be 0.
+     * @param pct to get.
+     * @return sample at that percentile.
+     */
+    template <typename T>
+    static T percentile(const T *samples, unsigned long count, unsigned pct)
+    {
+        unsigned long pos = (count * pct) / 100;
+
+        if(pos >= count)
+            pos = count - 1;
+        return samples[pos];
+    }
+};
+
+} // namespace sipwitch
+
+#endif
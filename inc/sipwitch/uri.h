@@ -81,14 +81,75 @@ protected:
     struct sockaddr *entry;
     uint16_t pri;
     unsigned count;
+    bool async, waiting;
+
+    /**
+     * Resolve a uri, optionally from the resolver cache, and store the
+     * result in the cache.
+     * @param uri to resolve.
+     * @param cached if we may use a cached result.
+     */
+    void resolve(const char *uri, bool cached);
+
+    /**
+     * Select the preferred entry of the current srv list.
+     */
+    void prefer(void);
 
 public:
     srv(const char *uri);
     srv();
     ~srv();
 
+    /**
+     * Resolve a uri.  Results are kept in a resolver cache that honors
+     * the dns ttl, and entries near expiry are refreshed in the
+     * background, so most lookups never wait on dns.
+     * @param uri to resolve.
+     */
     void set(const char *uri);
 
+    /**
+     * Never wait on dns for a cache miss.  The lookup is handed to the
+     * resolver thread instead, and this one fails with deferred() set,
+     * so a sip event thread can park its work and look again once the
+     * result is cached.
+     */
+    inline void nowait(void)
+        {async = true;};
+
+    /**
+     * Test if the last lookup failed because it was deferred.
+     * @return true if still being resolved in the background.
+     */
+    inline bool deferred(void) const
+        {return waiting;};
+
+    /**
+     * Set resolver cache limits.
+     * @param limit of cached entries, 0 to disable caching.
+     * @param ttl in seconds for results which do not carry a dns ttl.
+     * @param negative ttl in seconds for failed lookups.
+     * @param stale seconds an expired entry may be used while refreshed.
+     */
+    static void cache(unsigned limit, unsigned ttl, unsigned negative, unsigned stale);
+
+    /**
+     * Start background resolver thread.
+     */
+    static void startup(void);
+
+    /**
+     * Stop background resolver thread.
+     */
+    static void shutdown(void);
+
+    /**
+     * Dump resolver cache statistics.
+     * @param file to write to.
+     */
+    static void snapshot(FILE *file);
+
     void clear(void);
 
     inline struct sockaddr *operator*() const
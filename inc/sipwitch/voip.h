@@ -83,6 +83,9 @@ public:
 	static bool make_options_response(context_t ctx, tid_t tid, int status, msg_t *msg);
 	static void send_options_response(context_t ctx, tid_t tid, int status, msg_t msg = NULL);
 
+	static bool make_subscription_response(context_t ctx, tid_t tid, int status, msg_t *msg);
+	static void send_subscription_response(context_t ctx, tid_t tid, int status, msg_t msg = NULL);
+
 	static bool make_invite_request(context_t ctx, const char *to, const char *from, const char *subject, msg_t *msg, const char *route = NULL);
 	static call_t send_invite_request(context_t ctx, msg_t msg);
 
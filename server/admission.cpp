@@ -0,0 +1,247 @@
+// Copyright (C) 2006-2014 David Sugar, Tycho Softworks.
+// Copyright (C) 2015 Cherokees of Idaho.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "server.h"
+
+namespace sipwitch {
+
+#define ADMISSION_INDEX 177
+
+static LinkedObject *sources[ADMISSION_INDEX];
+static LinkedObject *networks = NULL;
+static LinkedObject *freebuckets = NULL;
+static Mutex private_lock;
+static volatile unsigned allocated_buckets = 0;
+static unsigned active_sources = 0;
+static unsigned source_rate = 0;
+static unsigned source_burst = 10;
+static unsigned network_rate = 0;
+static unsigned network_burst = 0;
+static unsigned max_retry = 120;
+static unsigned max_sources = 4096;
+static unsigned long admitted = 0;
+static unsigned long rejected_sources = 0;
+static unsigned long rejected_networks = 0;
+
+// a deferred request is given the next free slot at the refill rate, so
+// that clients come back paced rather than all at once.  Once the backlog
+// reaches our longest retry, clients are spread randomly within it.
+bool admission::take(bucket *bp, unsigned rate, unsigned burst, unsigned long now, unsigned *retry)
+{
+    unsigned long limit = burst * 1000l;
+    uint16_t rand;
+
+    if(!burst)
+        limit = rate * 1000l;
+
+    bp->tokens += (now - bp->stamp) * rate;
+    if(bp->tokens > limit)
+        bp->tokens = limit;
+    bp->stamp = now;
+
+    if(bp->tokens >= 1000) {
+        bp->tokens -= 1000;
+        return true;
+    }
+
+    ++bp->rejects;
+    if((long)(bp->horizon - now) < (long)(1000 - bp->tokens) / (long)rate)
+        bp->horizon = now + (1000 - bp->tokens) / rate;
+
+    if(bp->horizon - now < max_retry * 1000l) {
+        *retry = (unsigned)((bp->horizon - now + 999) / 1000);
+        bp->horizon += 1000 / rate;
+    }
+    else {
+        Random::fill((unsigned char *)&rand, sizeof(rand));
+        *retry = max_retry / 2 + rand % (max_retry / 2 + 1);
+    }
+    if(!*retry)
+        *retry = 1;
+    return false;
+}
+
+admission::bucket *admission::source(const struct sockaddr *addr, unsigned long now)
+{
+    unsigned path = Socket::keyindex(addr, ADMISSION_INDEX);
+    linked_pointer<bucket> bp = sources[path];
+    LinkedObject *next;
+    bucket *node;
+
+    while(is(bp)) {
+        if(Socket::equal(addr, (struct sockaddr *)(&bp->address)))
+            return *bp;
+        bp.next();
+    }
+
+    // reclaim sources which would have refilled to a full bucket anyway
+    if(active_sources >= max_sources) {
+        for(unsigned index = 0; index < ADMISSION_INDEX; ++index) {
+            bp = sources[index];
+            while(is(bp)) {
+                next = bp->getNext();
+                if((long)(now - bp->horizon) >= 0 && bp->tokens + (now - bp->stamp) * source_rate >= source_burst * 1000l) {
+                    bp->delist(&sources[index]);
+                    bp->enlist(&freebuckets);
+                    --active_sources;
+                }
+                bp = next;
+            }
+        }
+    }
+
+    if(active_sources >= max_sources)
+        return NULL;
+
+    node = (bucket *)server::allocate(sizeof(bucket), &freebuckets, &allocated_buckets);
+    Socket::store(&node->address, addr);
+    node->tokens = source_burst * 1000l;
+    node->stamp = node->horizon = now;
+    node->enlist(&sources[path]);
+    ++active_sources;
+    return node;
+}
+
+admission::bucket *admission::network(const char *id)
+{
+    linked_pointer<bucket> bp = networks;
+    bucket *node;
+
+    while(is(bp)) {
+        if(eq(bp->network, id))
+            return *bp;
+        bp.next();
+    }
+
+    node = (bucket *)server::allocate(sizeof(bucket), &freebuckets, &allocated_buckets);
+    String::set(node->network, sizeof(node->network), id);
+    node->tokens = network_burst * 1000l;
+    node->stamp = node->horizon = timing::mstime();
+    node->enlist(&networks);
+    return node;
+}
+
+bool admission::admit(const struct sockaddr *addr, stack::subnet *access, unsigned *retry)
+{
+    assert(retry != NULL);
+
+    unsigned long now = timing::mstime();
+    bucket *sp = NULL, *np = NULL;
+    const char *id = "*";
+
+    *retry = 0;
+    if(!addr || (!source_rate && !network_rate))
+        return true;
+
+    if(access)
+        id = access->getId();
+
+    private_lock.acquire();
+    if(network_rate) {
+        np = network(id);
+        if(!take(np, network_rate, network_burst, now, retry)) {
+            ++rejected_networks;
+            private_lock.release();
+            return false;
+        }
+    }
+
+    if(source_rate)
+        sp = source(addr, now);
+
+    if(sp && !take(sp, source_rate, source_burst, now, retry)) {
+        // give back the network token we took for this request, but never
+        // more than the network bucket can hold...
+        if(np) {
+            np->tokens += 1000;
+            if(np->tokens > (network_burst ? network_burst : network_rate) * 1000l)
+                np->tokens = (network_burst ? network_burst : network_rate) * 1000l;
+        }
+        ++rejected_sources;
+        private_lock.release();
+        return false;
+    }
+
+    ++admitted;
+    private_lock.release();
+    return true;
+}
+
+void admission::limit(unsigned srate, unsigned sburst, unsigned nrate, unsigned nburst, unsigned retry, unsigned count)
+{
+    linked_pointer<bucket> bp;
+    LinkedObject *next;
+
+    if(srate && sburst < srate)
+        sburst = srate;
+
+    if(nrate && nburst < nrate)
+        nburst = nrate;
+
+    if(retry < 2)
+        retry = 2;
+
+    private_lock.acquire();
+    source_rate = srate;
+    source_burst = sburst;
+    network_rate = nrate;
+    network_burst = nburst;
+    max_retry = retry;
+    max_sources = count;
+
+    // subnets may have been renamed or removed, so start them over
+    bp = networks;
+    while(is(bp)) {
+        next = bp->getNext();
+        bp->enlist(&freebuckets);
+        bp = next;
+    }
+    networks = NULL;
+    private_lock.release();
+}
+
+void admission::snapshot(FILE *fp)
+{
+    assert(fp != NULL);
+
+    linked_pointer<bucket> bp;
+    unsigned long now = timing::mstime();
+    unsigned long tokens;
+
+    private_lock.acquire();
+    fprintf(fp, "Admission:\n");
+    fprintf(fp, "  source rate:  %u/%u\n", source_rate, source_burst);
+    fprintf(fp, "  network rate: %u/%u\n", network_rate, network_burst);
+    fprintf(fp, "  active sources:    %u\n", active_sources);
+    fprintf(fp, "  allocated buckets: %u\n", allocated_buckets);
+    fprintf(fp, "  admitted: %lu\n", admitted);
+    fprintf(fp, "  rejected by source:  %lu\n", rejected_sources);
+    fprintf(fp, "  rejected by network: %lu\n", rejected_networks);
+    bp = networks;
+    while(is(bp)) {
+        tokens = bp->tokens + (now - bp->stamp) * network_rate;
+        if(tokens > network_burst * 1000l)
+            tokens = network_burst * 1000l;
+        fprintf(fp, "  network %s; tokens=%lu, rejects=%lu", bp->network, tokens / 1000, bp->rejects);
+        if((long)(bp->horizon - now) > 0)
+            fprintf(fp, ", backlog=%lu", (bp->horizon - now + 999) / 1000);
+        fputc('\n', fp);
+        bp.next();
+    }
+    private_lock.release();
+}
+
+} // end namespace
@@ -0,0 +1,114 @@
+// Copyright (C) 2006-2014 David Sugar, Tycho Softworks.
+// Copyright (C) 2015 Cherokees of Idaho.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "server.h"
+
+namespace sipwitch {
+
+// text is kept in blocks of power of two size classes, from the smallest
+// that can hold a free list link up to the largest sdp body we accept.
+// Freed blocks are kept on the free list of their class for re-use.
+
+#define ARENA_MINIMUM   64
+#define ARENA_CLASSES   8
+#define ARENA_HEADER    16
+
+static LinkedObject *freelist[ARENA_CLASSES];
+static volatile unsigned allocated[ARENA_CLASSES];
+static volatile unsigned active[ARENA_CLASSES];
+static mutex_t lock;
+
+static unsigned classify(size_t size)
+{
+    unsigned slab = 0;
+    size_t limit = ARENA_MINIMUM;
+
+    while(limit < size) {
+        if(++slab >= ARENA_CLASSES)
+            return ARENA_CLASSES;
+        limit *= 2;
+    }
+    return slab;
+}
+
+char *arena::dup(const char *text)
+{
+    assert(text != NULL);
+
+    size_t len = strlen(text) + 1;
+    unsigned slab = classify(len + ARENA_HEADER);
+    caddr_t mp;
+
+    if(slab >= ARENA_CLASSES)
+        return NULL;
+
+    lock.acquire();
+    mp = (caddr_t)server::allocate(ARENA_MINIMUM << slab, &freelist[slab], &allocated[slab]);
+    ++active[slab];
+    lock.release();
+
+    *((unsigned *)mp) = slab;
+    memcpy(mp + ARENA_HEADER, text, len);
+    return mp + ARENA_HEADER;
+}
+
+char *arena::set(char **text, const char *value)
+{
+    assert(text != NULL);
+
+    char *prior = *text;
+
+    if(value && *value)
+        *text = dup(value);
+    else
+        *text = NULL;
+
+    release(prior);
+    return *text;
+}
+
+void arena::release(char *text)
+{
+    caddr_t mp;
+    unsigned slab;
+
+    if(!text)
+        return;
+
+    mp = text - ARENA_HEADER;
+    slab = *((unsigned *)mp);
+    assert(slab < ARENA_CLASSES);
+
+    lock.acquire();
+    ((LinkedObject*)(mp))->enlist(&freelist[slab]);
+    --active[slab];
+    lock.release();
+}
+
+void arena::snapshot(FILE *fp)
+{
+    assert(fp != NULL);
+
+    fprintf(fp, "Arena:\n");
+    for(unsigned slab = 0; slab < ARENA_CLASSES; ++slab) {
+        if(!allocated[slab])
+            continue;
+        fprintf(fp, "  %5d bytes: %d active, %d allocated\n",
+            ARENA_MINIMUM << slab, active[slab], allocated[slab]);
+    }
+}
+
+} // end namespace
@@ -0,0 +1,350 @@
+// Copyright (C) 2006-2014 David Sugar, Tycho Softworks.
+// Copyright (C) 2015 Cherokees of Idaho.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "server.h"
+
+namespace sipwitch {
+
+#define BENCHMARK_ENTRIES   4096
+#define BENCHMARK_USECS     200000l
+#define BENCHMARK_CID       0x40000000
+
+static const unsigned sizes[] = {16, 256, BENCHMARK_ENTRIES};
+static char ids[BENCHMARK_ENTRIES][16];
+static struct sockaddr_internet addresses[BENCHMARK_ENTRIES];
+static unsigned entries = 0;
+static stats *statnode = NULL;
+static dialplan *plan = NULL;
+static volatile unsigned long found = 0;
+
+static const char *patterns[] = {"1NXXNXXXXXX", "011+", "9XXX", "*XX", "NXXXXXX", "18005551212"};
+static const char *dialed[] = {"18005551212", "0114412345678", "9123", "*67", "5551212", "2125551212"};
+static const char *uris[] = {
+    "sip:alice@example.com",
+    "sip:bob@192.168.1.20:5062;transport=udp",
+    "\"Carol\" <sips:carol@[2001:db8::1]:5061>",
+    "sip:200@127.0.0.1"};
+
+static const char *session_sdp =
+    "v=0\r\n"
+    "o=- 1 1 IN IP4 10.0.0.1\r\n"
+    "s=-\r\n"
+    "c=IN IP4 10.0.0.1\r\n"
+    "t=0 0\r\n"
+    "m=audio 4000 RTP/AVP 0 8 101\r\n"
+    "a=rtpmap:0 PCMU/8000\r\n"
+    "a=rtpmap:8 PCMA/8000\r\n"
+    "a=rtpmap:101 telephone-event/8000\r\n"
+    "a=fmtp:101 0-15\r\n";
+
+// repeat until a measurement takes long enough to be meaningful, so fast
+// and slow operations are reported with similar accuracy.
+void benchmark::measure(FILE *fp, const char *id, unsigned size, method_t method)
+{
+    unsigned long count = 64, index, elapsed;
+
+    for(;;) {
+        elapsed = timing::usecs();
+        for(index = 0; index < count; ++index)
+            method(index);
+        elapsed = timing::usecs() - elapsed;
+        if(elapsed >= BENCHMARK_USECS || count >= (1ul << 30))
+            break;
+        if(elapsed < BENCHMARK_USECS / 16)
+            count *= 16;
+        else
+            count *= 2;
+    }
+    fprintf(fp, "%s,%u,%lu,%lu,%.1f\n", id, size, count, elapsed, (elapsed * 1000.0) / count);
+    fflush(fp);
+}
+
+void benchmark::find(unsigned long index)
+{
+    if(registry::find(ids[index % entries]))
+        ++found;
+}
+
+void benchmark::access(unsigned long index)
+{
+    registry::mapped *rr = registry::access(ids[index % entries]);
+    if(rr)
+        ++found;
+    registry::detach(rr);
+}
+
+void benchmark::address(unsigned long index)
+{
+    registry::mapped *rr = registry::address((struct sockaddr *)&addresses[index % entries]);
+    if(rr)
+        ++found;
+    registry::detach(rr);
+}
+
+void benchmark::session(unsigned long index)
+{
+    stack::session *s = stack::access(BENCHMARK_CID + (voip::call_t)(index % entries));
+    if(s)
+        ++found;
+    stack::detach(s);
+}
+
+// the linear walk routing used before dialplan, first match wins...
+void benchmark::match(unsigned long index)
+{
+    const char *id = dialed[index % (sizeof(dialed) / sizeof(const char *))];
+
+    for(unsigned pos = 0; pos < sizeof(patterns) / sizeof(const char *); ++pos) {
+        if(service::match(id, patterns[pos], false)) {
+            ++found;
+            return;
+        }
+    }
+}
+
+void benchmark::route(unsigned long index)
+{
+    dialplan::match *mp;
+    if(plan->find(dialed[index % (sizeof(dialed) / sizeof(const char *))], &mp) && mp)
+        ++found;
+}
+
+void benchmark::userid(unsigned long index)
+{
+    char buffer[MAX_USERID_SIZE];
+    if(uri::userid(uris[index % (sizeof(uris) / sizeof(const char *))], buffer, sizeof(buffer)))
+        ++found;
+}
+
+void benchmark::hostid(unsigned long index)
+{
+    char buffer[MAX_URI_SIZE];
+    if(uri::hostid(uris[index % (sizeof(uris) / sizeof(const char *))], buffer, sizeof(buffer)))
+        ++found;
+}
+
+void benchmark::portid(unsigned long index)
+{
+    found += uri::portid(uris[index % (sizeof(uris) / sizeof(const char *))]);
+}
+
+void benchmark::rewrite(unsigned long index)
+{
+    char buffer[MAX_SDP_SIZE];
+    struct sockaddr_in peering;
+    media::sdp parser;
+
+    memset(&peering, 0, sizeof(peering));
+    peering.sin_family = AF_INET;
+    peering.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    parser.set(session_sdp, buffer, sizeof(buffer));
+    parser.peering = (struct sockaddr *)&peering;
+    if(media::rewrite(&parser))
+        ++found;
+}
+
+void benchmark::filter(unsigned long index)
+{
+    char buffer[MAX_SDP_SIZE];
+    sdpfilter parser(session_sdp, buffer, sizeof(buffer));
+
+    if(parser.rewrite())
+        ++found;
+}
+
+// the line at a time copy media::sdp used before sdpfilter, kept as the
+// baseline the single pass rewriter is measured against.
+void benchmark::lines(unsigned long index)
+{
+    char buffer[MAX_SDP_SIZE];
+    char line[256];
+    const char *bufdata = session_sdp;
+    char *outdata = buffer;
+    size_t len, outpos = 0;
+
+    while(*bufdata) {
+        len = 0;
+        while(len < sizeof(line) - 1 && *bufdata) {
+            if(*bufdata == '\r') {
+                ++bufdata;
+                continue;
+            }
+            else if(*bufdata == '\n') {
+                ++bufdata;
+                break;
+            }
+            line[len++] = *(bufdata++);
+        }
+        line[len] = 0;
+        if(outpos + len + 3 > sizeof(buffer))
+            return;
+        memcpy(outdata, line, len);
+        outdata += len;
+        *(outdata++) = '\r';
+        *(outdata++) = '\n';
+        *outdata = 0;
+        outpos += len + 2;
+    }
+    ++found;
+}
+
+void benchmark::assign(unsigned long index)
+{
+    statnode->assign(stats::INCOMING);
+    statnode->release(stats::INCOMING);
+}
+
+void benchmark::cached(unsigned long index)
+{
+    UserCache *entry = UserCache::find(ids[index % entries]);
+    if(entry)
+        ++found;
+    UserCache::release(entry);
+}
+
+void benchmark::digest(unsigned long index)
+{
+    const char *hash = digests::get(ids[index % entries]);
+    if(hash)
+        ++found;
+    digests::release(hash);
+}
+
+void benchmark::registries(FILE *fp)
+{
+    registry::mapped *rr;
+    char contact[MAX_URI_SIZE];
+    char host[32];
+    unsigned size, index = 0;
+    time_t now, expires;
+
+    time(&now);
+    expires = now + 3600;
+
+    for(size = 0; size < sizeof(sizes) / sizeof(unsigned); ++size) {
+        while(entries < sizes[size]) {
+            snprintf(ids[entries], sizeof(ids[entries]), "bench%u", entries);
+            snprintf(host, sizeof(host), "127.1.%u.%u", entries / 250, entries % 250 + 1);
+            snprintf(contact, sizeof(contact), "sip:%s@%s:5060", ids[entries], host);
+            rr = registry::populate(ids[entries]);
+            if(!rr)
+                break;
+
+            Socket::address via(host, 5060);
+            Socket::store(&addresses[entries], via.getAddr());
+            rr->addTarget(via, expires, contact, "-", (struct sockaddr *)&addresses[entries], NULL);
+            registry::detach(rr);
+            UserCache::add(ids[entries], (struct sockaddr *)&addresses[entries], now, 3600);
+            digests::set(ids[entries], "00000000000000000000000000000000");
+            ++entries;
+        }
+
+        // the registry may be smaller than the size we asked for...
+        if(entries <= index)
+            break;
+
+        index = entries;
+        measure(fp, "registry::find", entries, &find);
+        measure(fp, "registry::access", entries, &access);
+        measure(fp, "registry::address", entries, &address);
+        measure(fp, "UserCache::find", entries, &cached);
+        measure(fp, "digests::get", entries, &digest);
+    }
+
+    while(entries) {
+        registry::remove(ids[--entries]);
+        UserCache::remove(ids[entries]);
+        digests::clear(ids[entries]);
+    }
+}
+
+void benchmark::sessions(FILE *fp)
+{
+    stack::session *s;
+    unsigned size, index = 0;
+
+    for(size = 0; size < sizeof(sizes) / sizeof(unsigned); ++size) {
+        while(entries < sizes[size]) {
+            s = stack::create(stack::sip.out_context, BENCHMARK_CID + entries, -1, 0);
+            if(!s)
+                break;
+            stack::detach(s);
+            ++entries;
+        }
+
+        if(entries <= index)
+            break;
+
+        index = entries;
+        measure(fp, "stack::access", entries, &session);
+    }
+
+    // never really offered to the sip stack, so nothing to close there...
+    while(entries) {
+        s = stack::access(BENCHMARK_CID + --entries);
+        if(!s)
+            continue;
+        s->closed = true;
+        s->state = stack::session::CLOSED;
+        stack::destroy(s);
+        stack::detach(s);
+    }
+}
+
+void benchmark::parsers(FILE *fp)
+{
+    memalloc heap;
+    dialplan routes(&heap);
+    unsigned index;
+
+    for(index = 0; index < sizeof(patterns) / sizeof(const char *); ++index)
+        routes.add(patterns[index], (void *)patterns[index], 0, index);
+
+    plan = &routes;
+    measure(fp, "service::match", sizeof(patterns) / sizeof(const char *), &match);
+    measure(fp, "dialplan::find", sizeof(patterns) / sizeof(const char *), &route);
+    plan = NULL;
+    measure(fp, "uri::userid", sizeof(uris) / sizeof(const char *), &userid);
+    measure(fp, "uri::hostid", sizeof(uris) / sizeof(const char *), &hostid);
+    measure(fp, "uri::portid", sizeof(uris) / sizeof(const char *), &portid);
+    measure(fp, "sdp::lines", (unsigned)strlen(session_sdp), &lines);
+    measure(fp, "sdpfilter", (unsigned)strlen(session_sdp), &filter);
+    measure(fp, "media::sdp", (unsigned)strlen(session_sdp), &rewrite);
+}
+
+void benchmark::caches(FILE *fp)
+{
+    // stat nodes are never released, so one is kept for every run...
+    if(!statnode)
+        statnode = stats::request("benchmark");
+    if(statnode)
+        measure(fp, "stats::assign", 1, &assign);
+}
+
+void benchmark::run(FILE *fp)
+{
+    assert(fp != NULL);
+
+    shell::log(shell::NOTIFY, "benchmark starting");
+    fprintf(fp, "benchmark,size,iterations,usecs,nsecs/op\n");
+    registries(fp);
+    sessions(fp);
+    parsers(fp);
+    caches(fp);
+    shell::log(shell::NOTIFY, "benchmark finished; %lu found", found);
+}
+
+} // end namespace
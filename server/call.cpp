@@ -18,6 +18,9 @@
 
 namespace sipwitch {
 
+#define RESOLVE_POLL    250     // msecs between looks at a parked route
+#define RESOLVE_WAIT    4       // seconds a parked route is left to resolve
+
 stack::call::call() : LinkedList(), segments()
 {
     arm(stack::resetTimeout());
@@ -34,6 +37,11 @@ stack::call::call() : LinkedList(), segments()
     reason = joined = NULL;
     map = NULL;
     timer = Timer::inf;
+    pins = 0;
+    removed = false;
+    hunting = NULL;
+    resolving = credentials = NULL;
+    ringtime = 0;
 }
 
 void stack::call::arm(timeout_t timeout)
@@ -47,6 +55,46 @@ void stack::call::disarm(void)
     timer = Timer::inf;
 }
 
+// pins are kept under their own lock, which is never held while taking any
+// other, so they may be changed with a session shard or the call locked.
+void stack::call::pin(void)
+{
+    pinning.acquire();
+    ++pins;
+    pinning.release();
+}
+
+bool stack::call::unpin(void)
+{
+    bool last;
+
+    pinning.acquire();
+    last = (--pins == 0 && removed);
+    pinning.release();
+    return last;
+}
+
+bool stack::call::remove(void)
+{
+    bool last;
+
+    pinning.acquire();
+    last = (!removed && !pins);
+    removed = true;
+    pinning.release();
+    return last;
+}
+
+bool stack::call::reapable(void)
+{
+    bool result;
+
+    pinning.acquire();
+    result = (removed && !pins);
+    pinning.release();
+    return result;
+}
+
 void stack::call::terminateLocked(void)
 {
     if(state != INITIAL)
@@ -90,9 +138,11 @@ void stack::call::joinLocked(session *join)
     shell::debug(2, "joining call %08x:%u with session %08x:%u",
         source->sequence, source->cid, join->sequence, join->cid);
 
+    map->changes.lock();
     String::set(map->target, sizeof(map->target), join->sysident);
     if(!map->active)
         time(&map->active);
+    map->changes.unlock();
 
     // once we have joined, there is no more forwarding...
     forwarding = diverting = NULL;
@@ -209,7 +259,7 @@ void stack::call::reply_source(int error)
         answering = 16;
 
     if(voip::make_answer_response(source->context, source->tid, error, &reply)) {
-        stack::siplog(reply);
+        stack::siplog(reply, true);
         voip::send_answer_response(source->context, source->tid, error, reply);
     }
     else {
@@ -224,8 +274,10 @@ void stack::call::set(state_t flag, char id, const char *text)
     if(!map)
         return;
 
+    map->changes.lock();
     map->state[0] = id;
     String::set(map->state + 1, sizeof(map->state) - 1, text);
+    map->changes.unlock();
 }
 
 void stack::call::bye(thread *thread, session *s)
@@ -315,6 +367,16 @@ void stack::call::failed(thread *thread, session *s)
     if(s->state != session::CLOSED)
         s->state = session::OPEN;
 
+    // a hunt moves on to its next member when the one ringing fails
+    if(hunting && s != source && !ringing && invited < 2 && (state == TRYING || state == RINGING)) {
+        cancelLocked();
+        if(stack::hunt(this)) {
+            Mutex::release(this);
+            stack::close(s);
+            return;
+        }
+    }
+
     switch(state) {
     case RINGING:
         if(!ringing && ringbusy)
@@ -381,7 +443,7 @@ unconnected:
             Mutex::release(this);
             if(voip::make_answer_response(source->context, source->tid, 500, &reply)) {
                 voip::header(reply, "Reply-After", "8");
-                stack::siplog(reply);
+                stack::siplog(reply, true);
                 voip::send_answer_response(source->context, source->tid, 500, reply);
             }
             return;
@@ -407,7 +469,7 @@ unconnected:
                 else
                     error = SIP_TEMPORARILY_UNAVAILABLE;
             }
-            stack::siplog(reply);
+            stack::siplog(reply, true);
             voip::send_answer_response(source->context, source->tid, error, reply);
         }
         return;
@@ -429,7 +491,7 @@ unconnected:
                 voip::server_supports(reply, "100rel,replaces");
             if(body && body->body)
                 voip::attach(reply, SDP_BODY, body->body);
-            stack::siplog(reply);
+            stack::siplog(reply, true);
             voip::send_dialog_message(ctx, did, reply);
             update->state = session::REINVITE;
         }
@@ -470,6 +532,8 @@ void stack::call::answer(thread *thread, session *s)
     case TRYING:
         joinLocked(s);
         set(ANSWERED, 'a', "answered");
+        arena::release(hunting);
+        hunting = NULL;
         arm(16000l);
     case ANSWERED:
         if(thread->sevent->did > -1)
@@ -498,8 +562,9 @@ void stack::call::answer(thread *thread, session *s)
     }
     Mutex::release(this);
     if(voip::make_answer_response(ctx, tid, SIP_OK, &reply)) {
-        voip::attach(reply, SDP_BODY, s->sdp);
-        stack::siplog(reply);
+        if(s->sdp)
+            voip::attach(reply, SDP_BODY, s->sdp);
+        stack::siplog(reply, true);
         voip::send_answer_response(ctx, tid, SIP_OK, reply);
     }
     else {
@@ -631,7 +696,7 @@ void stack::call::confirm(thread *thread, session *s)
     }
     Mutex::release(this);
     if(voip::make_ack_message(ctx, did, &ack)) {
-        stack::siplog(ack);
+        stack::siplog(ack, true);
         voip::send_ack_message(ctx, did, ack);
     }
     else {
@@ -681,6 +746,19 @@ void stack::call::busy(thread *thread, session *s)
     case RINGBACK:
         // we goto busy in this special case, otherwise stack::close handles na
         if(!ringing && ringbusy && invited == 1 && s != source) {
+            if(hunting) {
+                if(s)
+                    s->state = session::CLOSED;
+                if(s && !s->closed) {
+                    registry::decUse(s->reg, stats::OUTGOING);
+                    s->closed = true;
+                }
+                ringbusy = invited = 0;
+                if(stack::hunt(this)) {
+                    Mutex::release(this);
+                    return;
+                }
+            }
             if(forwarding) {
                 forwarding = "busy";
                 if(s)
@@ -730,7 +808,10 @@ void stack::call::trying(thread *thread)
 
     Mutex::protect(this);
     set(TRYING, 't', "trying");
-    arm(4000);
+    if(resolving)
+        arm(RESOLVE_POLL);
+    else
+        arm(4000);
     Mutex::release(this);
 }
 
@@ -747,6 +828,42 @@ timeout_t stack::call::getTimeout(void)
     return current;
 }
 
+// a call parked on a cold dns miss polls the cache for its route, and once
+// past the time it may wait resolves inline so it can never be parked for
+// good.  It then proceeds as thread::invite would have.
+void stack::call::resolve(void)
+{
+    time_t now;
+    char target[MAX_URI_SIZE];
+    char digest[MAX_URI_SIZE];
+    int result;
+
+    time(&now);
+    String::set(target, sizeof(target), resolving);
+    digest[0] = 0;
+    if(credentials)
+        String::set(digest, sizeof(digest), credentials);
+
+    result = stack::inviteRemote(source, target, digest[0] ? digest : NULL, now < starting + RESOLVE_WAIT);
+    if(result < 0) {
+        arm(RESOLVE_POLL);
+        return;
+    }
+
+    shell::debug(3, "resuming call %08x:%u for %s", source->sequence, source->cid, target);
+    arena::release(resolving);
+    arena::release(credentials);
+    resolving = credentials = NULL;
+
+    if(invited || stack::forward(this)) {
+        arm(4000);
+        return;
+    }
+
+    set(BUSY, 'b', "busy");
+    disconnectLocked();
+}
+
 void stack::call::expired(void)
 {
     linked_pointer<segment> sp;
@@ -758,6 +875,14 @@ void stack::call::expired(void)
     case RINGING:   // re-generate ring event to origination...
                     // also controls call-forward no-answer timing...
 
+            if(answering == 1 && hunting) {
+                cancelLocked();
+                if(stack::hunt(this)) {
+                    arm(1000);
+                    reply_source(SIP_RINGING);
+                    return;
+                }
+            }
             if(answering == 1 && forwarding) {
                 forwarding = "na";
                 cancelLocked();
@@ -774,6 +899,20 @@ void stack::call::expired(void)
             arm(1000);
             reply_source(SIP_RINGING);
             return;
+    case TRYING:    // no member of a hunt answered the invite in time
+            if(resolving) {
+                resolve();
+                return;
+            }
+            if(hunting) {
+                cancelLocked();
+                if(stack::hunt(this)) {
+                    arm(4000);
+                    return;
+                }
+            }
+            disconnectLocked();
+            break;
     case REDIRECT:  // FIXME: add refer select of next segment if list....
 
     case RINGBACK:
@@ -781,7 +920,6 @@ void stack::call::expired(void)
     case JOINED:    // active call session expired without re-invite
     case ANSWERED:
     case REORDER:
-    case TRYING:
     case FAILED:
             disconnectLocked();
             break;
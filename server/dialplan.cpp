@@ -0,0 +1,465 @@
+// Copyright (C) 2006-2014 David Sugar, Tycho Softworks.
+// Copyright (C) 2015 Cherokees of Idaho.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "server.h"
+
+namespace sipwitch {
+
+// symbols of a pattern, the first 12 being literal dialed digits...
+#define SYMBOL_X        12
+#define SYMBOL_N        13
+#define SYMBOL_Z        14
+#define SYMBOL_ANY      15
+#define SYMBOL_O        16
+#define SYMBOLS         17
+
+#define MAX_DIALED      31
+#define MAX_SYMBOLS     63
+#define MAX_ACTIVE      128
+
+static int symbol(char c)
+{
+    if(c >= '0' && c <= '9')
+        return c - '0';
+
+    switch(c) {
+    case '*':
+        return 10;
+    case '#':
+        return 11;
+    case 'x':
+    case 'X':
+        return SYMBOL_X;
+    case 'n':
+    case 'N':
+        return SYMBOL_N;
+    case 'z':
+    case 'Z':
+        return SYMBOL_Z;
+    case '?':
+        return SYMBOL_ANY;
+    case 'o':
+    case 'O':
+        return SYMBOL_O;
+    }
+    return -1;
+}
+
+static unsigned keyindex(const char *id)
+{
+    unsigned key = 0;
+
+    while(*id)
+        key = (key << 1) ^ (tolower(*(id++)) & 0x1f);
+
+    return key % CONFIG_KEY_SIZE;
+}
+
+// digits are normalized the same way service::match does.  Returns 1 if
+// dialable, 0 if the id is only matched literally, and -1 if the id is
+// too long for any pattern to match.
+static int normalize(const char *id, char *digits, unsigned *len)
+{
+    unsigned dlen = 0;
+
+    if(*id == '+')
+        ++id;
+
+    while(*id && dlen < MAX_DIALED) {
+        if(isdigit(*id) || *id == '*' || *id == '#') {
+            digits[dlen++] = *(id++);
+            continue;
+        }
+
+        if(*id == ' ' || *id == ',') {
+            ++id;
+            continue;
+        }
+
+        if(*id == '!')
+            break;
+
+        return 0;
+    }
+
+    if(*id && *id != '!')
+        return -1;
+
+    digits[dlen] = 0;
+    *len = dlen;
+    return 1;
+}
+
+static dialplan::match *choose(dialplan::match *best, LinkedObject *list, unsigned levels)
+{
+    linked_pointer<dialplan::match> mp = list;
+
+    while(is(mp)) {
+        if(levels && mp->level >= levels) {
+            mp.next();
+            continue;
+        }
+        if(!best || mp->level > best->level || (mp->level == best->level && mp->rank < best->rank))
+            best = *mp;
+        mp.next();
+    }
+    return best;
+}
+
+// a pattern may be reached by more than one branch, so is only kept once.
+static void gather(dialplan::match **list, unsigned size, unsigned *count, LinkedObject *matches, unsigned levels)
+{
+    linked_pointer<dialplan::match> mp = matches;
+    unsigned pos;
+
+    while(is(mp) && *count < size) {
+        if(!levels || mp->level < levels) {
+            for(pos = 0; pos < *count; ++pos) {
+                if(list[pos] == *mp)
+                    break;
+            }
+            if(pos == *count)
+                list[(*count)++] = *mp;
+        }
+        mp.next();
+    }
+}
+
+dialplan::dialplan(memalloc *pager)
+{
+    heap = pager;
+    root = NULL;
+    memset(suffix, 0, sizeof(suffix));
+    memset(exact, 0, sizeof(exact));
+    freenodes = freematches = NULL;
+    patterns = nodes = 0;
+}
+
+void *dialplan::alloc(size_t size, LinkedObject **list)
+{
+    if(heap)
+        return heap->zalloc(size);
+
+    return server::allocate(size, list);
+}
+
+void dialplan::release(void *obj, LinkedObject **list)
+{
+    // paged heaps are released with the config generation that owns them
+    if(heap)
+        return;
+
+    ((LinkedObject *)(obj))->enlist(list);
+}
+
+void dialplan::assign(const char *id, void *object, unsigned rank)
+{
+    assert(id != NULL && *id != 0);
+
+    match *mp = new(alloc(sizeof(match), &freematches)) match();
+    mp->object = object;
+    mp->text = id;
+    mp->level = 0;
+    mp->rank = rank;
+    mp->identity = true;
+    mp->enlist(&exact[keyindex(id)]);
+}
+
+void dialplan::add(const char *pattern, void *object, unsigned level, unsigned rank)
+{
+    assert(pattern != NULL && *pattern != 0);
+
+    const char *cp = pattern;
+    node **base = &root;
+    node *np;
+    match *mp;
+    int sym;
+
+    // ids which are not dialable only ever match the pattern literally
+    mp = new(alloc(sizeof(match), &freematches)) match();
+    mp->object = object;
+    mp->text = pattern;
+    mp->level = level;
+    mp->rank = rank;
+    mp->identity = false;
+    mp->enlist(&exact[keyindex(pattern)]);
+
+    // leading + matches as a suffix of the dialed digits...
+    if(*cp == '+') {
+        ++cp;
+        if(!*cp || strlen(cp) > MAX_DIALED)
+            return;
+        base = &suffix[strlen(cp)];
+    }
+
+    if(!*cp || strlen(cp) > MAX_SYMBOLS)
+        return;
+
+    while(*cp) {
+        if(symbol(*(cp++)) < 0)
+            return;
+    }
+
+    cp = pattern;
+    if(*cp == '+')
+        ++cp;
+
+    if(!*base) {
+        *base = new(alloc(sizeof(node), &freenodes)) node();
+        ++nodes;
+    }
+    np = *base;
+    ++np->refs;
+
+    while(*cp) {
+        sym = symbol(*(cp++));
+        if(!np->child[sym]) {
+            np->child[sym] = new(alloc(sizeof(node), &freenodes)) node();
+            ++nodes;
+        }
+        np = np->child[sym];
+        ++np->refs;
+    }
+
+    mp = new(alloc(sizeof(match), &freematches)) match();
+    mp->object = object;
+    mp->text = pattern;
+    mp->level = level;
+    mp->rank = rank;
+    mp->identity = false;
+    mp->enlist(&np->matches);
+    ++patterns;
+}
+
+void dialplan::remove(const char *pattern, void *object)
+{
+    assert(pattern != NULL && *pattern != 0);
+
+    const char *cp = pattern;
+    node **base = &root;
+    node *path[MAX_SYMBOLS + 1];
+    int syms[MAX_SYMBOLS + 1];
+    unsigned depth = 0;
+    linked_pointer<match> mp = exact[keyindex(pattern)];
+
+    while(is(mp)) {
+        if(mp->object == object && !mp->identity) {
+            mp->delist(&exact[keyindex(pattern)]);
+            release(*mp, &freematches);
+            break;
+        }
+        mp.next();
+    }
+
+    if(*cp == '+') {
+        ++cp;
+        if(!*cp || strlen(cp) > MAX_DIALED)
+            return;
+        base = &suffix[strlen(cp)];
+    }
+
+    path[0] = *base;
+    while(path[depth] && *cp && depth < MAX_SYMBOLS) {
+        syms[depth] = symbol(*(cp++));
+        if(syms[depth] < 0)
+            return;
+        path[depth + 1] = path[depth]->child[syms[depth]];
+        ++depth;
+    }
+
+    if(!path[depth] || *cp)
+        return;
+
+    mp = path[depth]->matches;
+    while(is(mp)) {
+        if(mp->object == object)
+            break;
+        mp.next();
+    }
+
+    if(!is(mp))
+        return;
+
+    mp->delist(&path[depth]->matches);
+    release(*mp, &freematches);
+    --patterns;
+
+    // prune branches no longer used by any pattern...
+    for(;;) {
+        if(--path[depth]->refs) {
+            if(!depth--)
+                break;
+            continue;
+        }
+
+        release(path[depth], &freenodes);
+        --nodes;
+        if(!depth) {
+            *base = NULL;
+            break;
+        }
+        --depth;
+        path[depth]->child[syms[depth]] = NULL;
+    }
+}
+
+bool dialplan::step(node *np, char digit, node **list, unsigned *count)
+{
+    node *cp;
+
+    if(*count + SYMBOLS > MAX_ACTIVE)
+        return false;
+
+    cp = np->child[symbol(digit)];
+    if(cp)
+        list[(*count)++] = cp;
+
+    if(isdigit(digit)) {
+        cp = np->child[SYMBOL_X];
+        if(cp)
+            list[(*count)++] = cp;
+
+        cp = np->child[SYMBOL_N];
+        if(cp && digit >= '2')
+            list[(*count)++] = cp;
+
+        cp = np->child[SYMBOL_Z];
+        if(cp && digit >= '1')
+            list[(*count)++] = cp;
+    }
+
+    cp = np->child[SYMBOL_ANY];
+    if(cp)
+        list[(*count)++] = cp;
+
+    // optional 1, if not dialed we match the digit against what follows
+    cp = np->child[SYMBOL_O];
+    if(cp && digit == '1')
+        list[(*count)++] = cp;
+    else if(cp)
+        return step(cp, digit, list, count);
+
+    return true;
+}
+
+// patterns ending at a node match the dialed digits.  Like service::match,
+// a pattern is also matched as a prefix when digits are left over, and an
+// optional 1 left at the end of the pattern is skipped unless the next
+// digit is a 1, which it takes instead.
+void dialplan::collect(node *np, bool skip, match **result, unsigned levels, unsigned *found, unsigned size)
+{
+    while(np) {
+        if(found)
+            gather(result, size, found, np->matches, levels);
+        else
+            *result = choose(*result, np->matches, levels);
+
+        if(!skip)
+            break;
+        np = np->child[SYMBOL_O];
+    }
+}
+
+bool dialplan::walk(node *start, const char *digits, unsigned len, match **result, unsigned levels, unsigned *found, unsigned size)
+{
+    node *active[2][MAX_ACTIVE];
+    unsigned count[2];
+    unsigned pos, index, cur = 0;
+
+    count[0] = 1;
+    active[0][0] = start;
+
+    for(pos = 0; pos < len && count[cur]; ++pos) {
+        count[cur ^ 1] = 0;
+        for(index = 0; index < count[cur]; ++index) {
+            collect(active[cur][index], digits[pos] != '1', result, levels, found, size);
+            if(!step(active[cur][index], digits[pos], active[cur ^ 1], &count[cur ^ 1]))
+                return false;
+        }
+        cur ^= 1;
+    }
+
+    // a pattern longer than the digits dialed is only a partial match
+    for(index = 0; index < count[cur]; ++index)
+        collect(active[cur][index], false, result, levels, found, size);
+
+    return true;
+}
+
+bool dialplan::find(const char *id, match **result, unsigned levels)
+{
+    assert(id != NULL && *id != 0);
+    assert(result != NULL);
+
+    char digits[MAX_DIALED + 1];
+    unsigned len = 0, size;
+    int mode = normalize(id, digits, &len);
+    linked_pointer<match> mp = exact[keyindex(id)];
+
+    *result = NULL;
+
+    while(is(mp)) {
+        if((mp->identity || !mode) && (!levels || mp->level < levels) && !stricmp(mp->text, id)) {
+            if(!*result || mp->level > (*result)->level || (mp->level == (*result)->level && mp->rank < (*result)->rank))
+                *result = *mp;
+        }
+        mp.next();
+    }
+
+    if(mode < 1)
+        return true;
+
+    if(root && !walk(root, digits, len, result, levels))
+        return false;
+
+    for(size = 1; size <= len; ++size) {
+        if(suffix[size] && !walk(suffix[size], digits + len - size, size, result, levels))
+            return false;
+    }
+    return true;
+}
+
+bool dialplan::find(const char *id, match **list, unsigned size, unsigned *count, unsigned levels)
+{
+    assert(id != NULL && *id != 0);
+    assert(list != NULL && count != NULL);
+
+    char digits[MAX_DIALED + 1];
+    unsigned len = 0, length;
+    int mode = normalize(id, digits, &len);
+    linked_pointer<match> mp = exact[keyindex(id)];
+
+    *count = 0;
+    while(is(mp) && *count < size) {
+        if((mp->identity || !mode) && (!levels || mp->level < levels) && !stricmp(mp->text, id))
+            list[(*count)++] = *mp;
+        mp.next();
+    }
+
+    if(mode < 1)
+        return true;
+
+    if(root && !walk(root, digits, len, list, levels, count, size))
+        return false;
+
+    for(length = 1; length <= len; ++length) {
+        if(suffix[length] && !walk(suffix[length], digits + len - length, length, list, levels, count, size))
+            return false;
+    }
+    return true;
+}
+
+} // end namespace
@@ -98,6 +98,24 @@ bool digests::set(const char *id, const char *hash)
     return true;
 }
 
+// the key stays in the private cache until the next reload purges it.
+void digests::clear(const char *id)
+{
+    assert(id != NULL);
+
+    private_lock.modify();
+    unsigned path = NamedObject::keyindex(id, INDEX_KEYSIZE);
+    linked_pointer<key> keys = private_paths[path];
+    while(is(keys)) {
+        if(String::equal(id, keys->id)) {
+            keys->delist(&private_paths[path]);
+            break;
+        }
+        keys.next();
+    }
+    private_lock.commit();
+}
+
 void digests::load(void)
 {
     FILE *fp;
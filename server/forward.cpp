@@ -71,7 +71,8 @@ private:
 static forward forward_plugin;
 
 forward::forward() :
-modules::sipwitch()
+modules::sipwitch(modules::HOOK_ANNOUNCE | modules::HOOK_ACTIVATING | modules::HOOK_EXPIRING |
+    modules::HOOK_REGISTRATION | modules::HOOK_AUTHENTICATE | modules::HOOK_REFER_LOCAL)
 {
     shell::log(shell::INFO, "%s\n",
         _TEXT("server forward plugin loaded"));
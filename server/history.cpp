@@ -18,73 +18,92 @@
 
 namespace sipwitch {
 
+// Each line takes the next sequence number, and with it a slot of the
+// ring.  A slot is claimed by moving its sequence to odd, and released by
+// moving it to even once the line is in place, so a reader can tell when
+// a slot it copied was changed under it.  A writer that finds its slot
+// still being written by another thread a full lap behind drops its line
+// rather than wait.  Rings replaced by a resize are kept, since a writer
+// may still be using one, and are re-used if that size is asked for again.
+
 static mutex_t histlock;
-static OrderedIndex histindex;
-static unsigned histcount = 0;
-static unsigned histlimit = 0;
 
-history::history(shell::loglevel_t lid, const char *msg) :
-OrderedObject(&histindex)
-{
-    ++histcount;
-    set(lid, msg);
-}
+history::ring *volatile history::current = NULL;
+history::ring *history::rings = NULL;
+volatile uint64_t history::counter = 0;
 
-void history::set(shell::loglevel_t lid, const char *msg)
+void history::add(shell::loglevel_t lid, const char *msg)
 {
-    Time now;
+    ring *rp = current;
+    record *slot;
+    uint64_t seq, mark, old;
     char buf[20];
+    char text[sizeof(slot->text)];
+    char *cp;
+    Time now;
 
-    now.put(buf);
-    snprintf(text, sizeof(text), "%s %02d %s",
-        buf, (int)lid, msg);
+    // if no logging active, nothing to add...
+    if(!rp)
+        return;
 
-    char *cp = strchr(text, '\n');
+    now.put(buf);
+    snprintf(text, sizeof(text), "%s %02d %s", buf, (int)lid, msg);
+    cp = strchr(text, '\n');
     if(cp)
         *cp = 0;
+
+    seq = __sync_fetch_and_add(&counter, 1);
+    slot = &rp->slots[seq % rp->limit];
+    mark = seq * 2 + 1;
+    for(;;) {
+        old = slot->sequence;
+        if((old & 1) || old > mark)
+            return;
+        if(__sync_bool_compare_and_swap(&slot->sequence, old, mark))
+            break;
+    }
+
+    memcpy(slot->text, text, sizeof(text));
+    MAPPED_BARRIER();
+    slot->sequence = mark + 1;
 }
 
-void history::add(shell::loglevel_t lid, const char *msg)
+void history::set(unsigned limit)
 {
-    history *reuse;
-
-    // if no logging active, nothing to add...
-    if(!histlimit)
-        return;
+    ring *rp;
 
     histlock.acquire();
-    // if not to buffer limit, start by allocating
-    // maybe we could use a pager heap....
-    if(histcount < histlimit) {
-        new history(lid, msg);
+    if(!limit) {
+        current = NULL;
         histlock.release();
         return;
     }
 
-    reuse = (history *)histindex.begin();
-    reuse->delist(&histindex);
-    reuse->set(lid, msg);
-    reuse->enlist(&histindex);
-    histlock.release();
-}
-
-void history::set(unsigned limit)
-{
-    history *reuse;
+    rp = rings;
+    while(rp && rp->limit != limit)
+        rp = rp->prior;
 
-    histlock.acquire();
-    while(histcount > limit) {
-        reuse = (history *)histindex.begin();
-        reuse->delist(&histindex);
-        delete reuse;
+    if(!rp) {
+        rp = (ring *)new char[sizeof(ring) + (limit - 1) * sizeof(record)];
+        memset(rp, 0, sizeof(ring) + (limit - 1) * sizeof(record));
+        rp->limit = limit;
+        rp->prior = rings;
+        rings = rp;
     }
-    histlimit = limit;
+
+    MAPPED_BARRIER();
+    current = rp;
     histlock.release();
 }
 
 void history::out(void)
 {
-    if(!histlimit)
+    ring *rp = current;
+    record *slot;
+    uint64_t seq, end, mark;
+    char text[sizeof(slot->text)];
+
+    if(!rp)
         return;
 
     FILE *fp = control::output("history");
@@ -92,13 +111,26 @@ void history::out(void)
     if(!fp)
         return;
 
-    histlock.acquire();
-    linked_pointer<history> hp = histindex.begin();
-    while(is(hp)) {
-        fprintf(fp, "%s\n", hp->text);
-        hp.next();
+    // lines overwritten while we copy are skipped, never waited for
+    end = counter;
+    seq = 0;
+    if(end > rp->limit)
+        seq = end - rp->limit;
+
+    while(seq < end) {
+        slot = &rp->slots[seq % rp->limit];
+        mark = seq++ * 2 + 2;
+        if(slot->sequence != mark)
+            continue;
+        MAPPED_BARRIER();
+        memcpy(text, slot->text, sizeof(text));
+        MAPPED_BARRIER();
+        if(slot->sequence != mark)
+            continue;
+        text[sizeof(text) - 1] = 0;
+        fprintf(fp, "%s\n", text);
     }
-    histlock.release();
+
     fclose(fp);
 }
 
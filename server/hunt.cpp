@@ -0,0 +1,156 @@
+// Copyright (C) 2006-2014 David Sugar, Tycho Softworks.
+// Copyright (C) 2015 Cherokees of Idaho.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "server.h"
+
+namespace sipwitch {
+
+// Group members are user ids or extensions, each with an optional weight,
+// such as "201,202:3,tycho".  A parallel group rings every member at once
+// as branches of one fanout.  A sequential group rings one member at a
+// time in the order given, and a weighted group in an order drawn by
+// weight for each call, moving on when a member is busy, fails, or has
+// rung for the group ringtime.  The members left to hunt are kept with
+// the call, and a member of weight 0 is never rung.
+
+int stack::inviteGroup(stack::session *s, service::keynode *group)
+{
+    assert(s != NULL && s->parent != NULL);
+    assert(group != NULL);
+
+    stack::call *cr = s->parent;
+    const char *list = service::getValue(group, "members");
+    const char *policy = service::getValue(group, "policy");
+    const char *ringtime = service::getValue(group, "ringtime");
+    char buffer[HUNT_MEMBERS * MAX_USERID_SIZE];
+    char order[HUNT_MEMBERS * MAX_USERID_SIZE];
+    char *member[HUNT_MEMBERS];
+    unsigned weight[HUNT_MEMBERS];
+    unsigned count = 0, total = 0, pos, next, pick;
+    char *tp = NULL;
+    char *cp, *wp;
+    registry::mapped *rr;
+
+    if(!list || !*list) {
+        shell::log(shell::ERR, "group %s has no members", cr->dialed);
+        return 0;
+    }
+
+    String::set(buffer, sizeof(buffer), list);
+    while(count < HUNT_MEMBERS && NULL != (cp = String::token(buffer, &tp, ", ;\t\r\n"))) {
+        weight[count] = 1;
+        wp = strchr(cp, ':');
+        if(wp) {
+            *(wp++) = 0;
+            weight[count] = atoi(wp);
+        }
+        if(!*cp || !weight[count])
+            continue;
+        total += weight[count];
+        member[count++] = cp;
+    }
+
+    if(policy && !stricmp(policy, "weighted")) {
+        for(pos = 0; pos + 1 < count; ++pos) {
+            Random::fill((unsigned char *)&pick, sizeof(pick));
+            pick %= total;
+            next = pos;
+            while(pick >= weight[next])
+                pick -= weight[next++];
+            total -= weight[next];
+            cp = member[next];
+            member[next] = member[pos];
+            member[pos] = cp;
+            pick = weight[next];
+            weight[next] = weight[pos];
+            weight[pos] = pick;
+        }
+    }
+    else if(!policy || stricmp(policy, "sequential")) {
+        if(policy && stricmp(policy, "parallel"))
+            shell::log(shell::WARN, "group %s has unknown policy %s", cr->dialed, policy);
+
+        fanout branches(s);
+        for(pos = 0; pos < count; ++pos) {
+            rr = registry::access(member[pos]);
+            if(!rr)
+                continue;
+            branches.invite(rr, LOCAL);
+            registry::detach(rr);
+        }
+        shell::debug(3, "group %s rang %u branches", cr->dialed, branches.branches);
+        return branches.branches;
+    }
+
+    order[0] = 0;
+    for(pos = 0; pos < count; ++pos) {
+        if(pos)
+            String::add(order, sizeof(order), ",");
+        String::add(order, sizeof(order), member[pos]);
+    }
+
+    if(ringtime)
+        cr->ringtime = atoi(ringtime);
+    else
+        cr->ringtime = (unsigned)(stack::cfnaTimeout() / 1000l);
+
+    arena::set(&cr->hunting, order);
+    if(!hunt(cr))
+        return 0;
+    return cr->invited;
+}
+
+bool stack::hunt(stack::call *cr)
+{
+    assert(cr != NULL);
+
+    char id[MAX_USERID_SIZE];
+    const char *ep;
+    size_t len;
+    registry::mapped *rr;
+    int icount;
+
+    while(cr->hunting) {
+        ep = strchr(cr->hunting, ',');
+        if(ep)
+            len = (size_t)(ep - cr->hunting);
+        else
+            len = strlen(cr->hunting);
+        if(len >= sizeof(id))
+            len = sizeof(id) - 1;
+        memcpy(id, cr->hunting, len);
+        id[len] = 0;
+
+        // value is copied before the old list is let go of...
+        arena::set(&cr->hunting, ep ? ep + 1 : NULL);
+
+        rr = registry::access(id);
+        if(!rr)
+            continue;
+
+        icount = inviteLocal(cr->source, rr, LOCAL);
+        registry::detach(rr);
+        if(icount > 0) {
+            shell::debug(3, "hunting %s for call %08x:%u",
+                id, cr->source->sequence, cr->source->cid);
+            cr->answering = cr->ringtime;
+            return true;
+        }
+    }
+    return false;
+}
+
+} // end namespace
@@ -232,20 +232,26 @@ void media::proxy::release(time_t expire)
     so = INVALID_SOCKET;
 }
 
-media::sdp::sdp()
+media::sdp::sdp() :
+sdpfilter()
 {
-    outdata = result = NULL;
-    bufdata = NULL;
+    peering = NULL;
     mediacount = 0;
     mediaport = 0;
     nat = NULL;
     memset(&local, 0, sizeof(local));
-    memset(&top, 0, sizeof(local));
+    memset(&top, 0, sizeof(top));
 }
 
-media::sdp::sdp(const char *source, char *target, size_t len)
+media::sdp::sdp(const char *source, char *target, size_t len) :
+sdpfilter(source, target, len)
 {
-    set(source, target, len);
+    peering = NULL;
+    mediacount = 0;
+    mediaport = 0;
+    nat = NULL;
+    memset(&local, 0, sizeof(local));
+    memset(&top, 0, sizeof(top));
 }
 
 void media::sdp::reconnect(void)
@@ -259,157 +265,23 @@ void media::sdp::reconnect(void)
     memcpy(&local, &top, sizeof(local));
 }
 
-void media::sdp::set(const char *source, char *target, size_t len)
-{
-    outdata = result = target;
-    bufdata = source;
-    outpos = 0;
-}
-
-char *media::sdp::get(char *buffer, size_t len)
-{
-    char *base = buffer;
-    size_t blen = len;
-
-    // if eod, return NULL
-    if(!bufdata || *bufdata == 0) {
-        *buffer = 0;
-        return NULL;
-    }
-
-    while(len > 1 && *bufdata != 0) {
-        if(*bufdata == '\r') {
-            ++bufdata;
-            continue;
-        }
-        else if(*bufdata == '\n') {
-            ++bufdata;
-            break;
-        }
-        *(buffer++) = *(bufdata++);
-        --len;
-    }
-    *buffer = 0;
-    check_connect(base, blen);
-
-    if(!result)
-        return NULL;
-
-    return base;
-}
-
-void media::sdp::check_media(char *buffer, size_t len)
+bool media::sdp::connect(unsigned family, const char *address, size_t size)
 {
-    char *cp, *ep, *sp;
-    char tmp[128];
-    char mtype[32];
-    unsigned tport;
-    unsigned tcount = 1;
-    media::proxy *pp;
-
-    if(strnicmp(buffer, "m=", 2))
-        return;
-
-    cp = sp = strchr(buffer, ' ');
-    if(!cp)
-        return;
-
-    while(isspace(*cp))
-        ++cp;
-
-    tport = atoi(cp);
-    if(!tport)
-        return;
-
-    ep = strchr(cp, '/');
-    if(ep)
-        tcount = atoi(ep + 1);
-
-    // at the moment we can only do rtp/rtcp pairs...
-    if(tcount > 2) {
-        result = NULL;
-        return;
-    }
-
-    mediacount = tcount;
-    tcount = align(tcount);
-
-    ep = strchr(cp, ' ');
-    if(!ep)
-        ep = (char *)"";
-    else while(isspace(*ep))
-        ++ep;
-
-    mediaport = tport;
-    mediacount = tcount;
-    tport = 0;
-
-    lock.acquire();
-    String::set(tmp, sizeof(tmp), ep);
-    while(tcount--) {
-        pp = media::get(this);
-        if(!pp) {
-            result = NULL;
-            lock.release();
-            return;
-        }
-        if(!tport)
-            tport = (pp->port / 2) * 2;
-    }
-    lock.release();
-
-    *sp = 0;
-    String::set(mtype, sizeof(mtype), buffer);
-    if(mediacount > 1)
-        snprintf(buffer, len, "%s %u/%u %s",
-            mtype, tport, mediacount, tmp);
-    else
-        snprintf(buffer, len, "%s %u %s",
-            mtype, tport, tmp);
-
-    mediacount = align(mediacount);
-}
-
-void media::sdp::check_connect(char *buffer, size_t len)
-{
-    char *cp = buffer + 4;
-    char *ap;
-    char ttl[16];
+    char buffer[64];
     const struct sockaddr *hp;
 
-    if(strnicmp(buffer, "c=in", 4))
-        return;
-
-    while(isspace(*cp))
-        ++cp;
+    if(family != (ipv6 ? 6u : 4u) || !peering || size >= sizeof(buffer))
+        return emit(address, size);
 
-    if(ipv6 && strnicmp(cp, "ip6", 3))
-        return;
-    else if(!ipv6 && strnicmp(cp, "ip4", 3))
-        return;
-
-    ap = cp + 3;
-    while(isspace(*ap))
-        ++ap;
-
-    cp = strchr(ap, '/');
-    if(cp) {
-        String::set(ttl, sizeof(ttl), cp);
-        *cp = 0;
-    }
-    else
-        ttl[0] = 0;
-
-    if(!Socket::is_numeric(ap)) {
-invalid:
-        *cp = '/';
-        return;
-    }
+    memcpy(buffer, address, size);
+    buffer[size] = 0;
+    if(!Socket::is_numeric(buffer))
+        return emit(address, size);
 
-    Socket::address addr(ap);
+    Socket::address addr(buffer);
     hp = addr.getAddr();
     if(!hp)
-        goto invalid;
+        return emit(address, size);
 
     Socket::store(&local, hp);
     if(!mediaport)
@@ -417,26 +289,10 @@ invalid:
     else
         reconnect();
 
-    Socket::query((struct sockaddr *)&peering, ap, len - 8);
-    String::add(buffer, len, ttl);
-}
-
-size_t media::sdp::put(char *buffer)
-{
-    size_t outsize = 0;
+    if(!Socket::query(peering, buffer, sizeof(buffer)))
+        return emit(address, size);
 
-    if(!outdata)
-        return 0;
-
-    while(*buffer && outpos < (MAX_SDP_BUFFER - 2)) {
-        ++outsize;
-        *(outdata++) = *(buffer++);
-    }
-
-    *(outdata++) = '\r';
-    *(outdata++) = '\n';
-    *outdata = 0;
-    return outsize + 2;
+    return emit(buffer, strlen(buffer));
 }
 
 media::media() :
@@ -640,6 +496,7 @@ char *media::reinvite(stack::session *session, const char *sdpin)
     struct sockaddr_storage peering;
     stack::session *target = NULL;
     LinkedObject **nat;
+    char buffer[MAX_SDP_SIZE];
 
     if(session == cr->source)
         target = cr->target;
@@ -650,17 +507,18 @@ char *media::reinvite(stack::session *session, const char *sdpin)
     nat = &target->nat;
     media::release(nat, 2);
 
-    if(!isProxied(session->network, target->network, &peering)) {
-        String::set(session->sdp, sizeof(session->sdp), sdpin);
-        return session->sdp;
-    }
+    if(!isProxied(session->network, target->network, &peering))
+        return arena::set(&session->sdp, sdpin);
 
     shell::log(DEBUG3, "reinvite proxied %s to %s", session->network, target->network);
-    sdp parser(sdpin, session->sdp, sizeof(session->sdp));
+    sdp parser(sdpin, buffer, sizeof(buffer));
     parser.peering = (struct sockaddr *)&peering;
     parser.nat = nat;
 
-    return rewrite(&parser);
+    if(!rewrite(&parser))
+        return NULL;
+
+    return arena::set(&session->sdp, buffer);
 }
 
 char *media::answer(stack::session *session, const char *sdpin)
@@ -672,6 +530,7 @@ char *media::answer(stack::session *session, const char *sdpin)
     stack::call *cr = session->parent;
     stack::session *target = cr->source;
     struct sockaddr_storage peering;
+    char buffer[MAX_SDP_SIZE];
 
     if(session == target || (cr->target != NULL && cr->target != session))
         return NULL;
@@ -680,17 +539,18 @@ char *media::answer(stack::session *session, const char *sdpin)
     nat = &target->nat;
     media::release(nat, 2);
 
-    if(!isProxied(session->network, target->network, &peering)) {
-        String::set(session->sdp, sizeof(session->sdp), sdpin);
-        return session->sdp;
-    }
+    if(!isProxied(session->network, target->network, &peering))
+        return arena::set(&session->sdp, sdpin);
 
     shell::log(DEBUG3, "answer proxied %s to %s", session->network, target->network);
-    sdp parser(sdpin, session->sdp, sizeof(session->sdp));
+    sdp parser(sdpin, buffer, sizeof(buffer));
     parser.peering = (struct sockaddr *)&peering;
     parser.nat = nat;
 
-    return rewrite(&parser);
+    if(!rewrite(&parser))
+        return NULL;
+
+    return arena::set(&session->sdp, buffer);
 }
 
 char *media::invite(stack::session *session, const char *target, LinkedObject **nat, char *sdpout, size_t size)
@@ -701,14 +561,18 @@ char *media::invite(stack::session *session, const char *target, LinkedObject **
 
     *nat = NULL;
     struct sockaddr_storage peering;
+    const char *sdpin = session->sdp;
+
+    if(!sdpin)
+        sdpin = "";
 
     if(!isProxied(session->network, target, &peering)) {
-        String::set(sdpout, size, session->sdp);
+        String::set(sdpout, size, sdpin);
         return sdpout;
     }
 
     shell::log(DEBUG3, "invite proxied %s to %s", session->network, target);
-    sdp parser(session->sdp, sdpout, size);
+    sdp parser(sdpin, sdpout, size);
     parser.peering = (struct sockaddr *)&peering;
     parser.nat = nat;
 
@@ -717,15 +581,7 @@ char *media::invite(stack::session *session, const char *target, LinkedObject **
 
 char *media::rewrite(media::sdp *parser)
 {
-    char buffer[256];
-
-    // simple copy rewrite parser for now....
-    while(NULL != parser->get(buffer, sizeof(buffer))) {
-        if(!parser->put(buffer))
-            return NULL;
-
-    }
-    return parser->result;
+    return parser->rewrite();
 }
 
 } // end namespace
@@ -217,13 +217,16 @@ int messages::remote(const char *to, message *msg, const char *digest)
     int error = SIP_BAD_REQUEST;
     char route[MAX_URI_SIZE];
     srv resolv;
-    voip::context_t ctx = resolv.route(to, route, sizeof(route));
+    voip::context_t ctx;
     char rewrite[MAX_URI_SIZE];
     const char *schema = NULL;
 
+    ctx = resolv.route(to, route, sizeof(route));
     if(!ctx)
         return error;
 
+    trunks::used(route);
+
     if(eq(to, "tcp:", 4)) {
         schema = "sip";
         to += 4;
@@ -272,7 +275,7 @@ int messages::remote(const char *to, message *msg, const char *digest)
     }
     if(im) {
         voip::attach(im, msg->type, msg->body, msg->msglen);
-        stack::siplog(im);
+        stack::siplog(im, true);
         voip::send_request_message(ctx, im);
         error = SIP_OK;
     }
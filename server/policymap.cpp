@@ -0,0 +1,124 @@
+// Copyright (C) 2006-2014 David Sugar, Tycho Softworks.
+// Copyright (C) 2015 Cherokees of Idaho.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "server.h"
+
+namespace sipwitch {
+
+static inline unsigned bit(const unsigned char *addr, unsigned pos)
+{
+    return (addr[pos >> 3] >> (7 - (pos & 7))) & 1;
+}
+
+policymap::policymap(memalloc *pager)
+{
+    heap = pager;
+    ipv4 = ipv6 = NULL;
+    nodes = 0;
+}
+
+bool policymap::add(stack::subnet *entry)
+{
+    assert(entry != NULL);
+
+    struct hostaddr_internet network = entry->getNetwork();
+    struct hostaddr_internet netmask = entry->getNetmask();
+    const unsigned char *addr = (const unsigned char *)&network;
+    const unsigned char *mask = (const unsigned char *)&netmask;
+    unsigned bits = entry->getMask();
+    unsigned limit, pos;
+    node **np;
+
+    switch(entry->getFamily()) {
+    case AF_INET:
+        np = &ipv4;
+        limit = 32;
+        break;
+#ifdef  AF_INET6
+    case AF_INET6:
+        np = &ipv6;
+        limit = 128;
+        break;
+#endif
+    default:
+        return true;
+    }
+
+    // empty masks, like world and nat, are never a policy match...
+    if(!bits)
+        return true;
+
+    if(bits > limit)
+        return false;
+
+    // only contiguous netmasks can be indexed by prefix...
+    for(pos = 0; pos < limit; ++pos) {
+        if(bit(mask, pos) != (pos < bits ? 1u : 0u))
+            return false;
+    }
+
+    for(pos = 0; pos <= bits; ++pos) {
+        if(!*np) {
+            *np = (node *)heap->zalloc(sizeof(node));
+            ++nodes;
+        }
+        if(pos < bits)
+            np = &((*np)->child[bit(addr, pos)]);
+    }
+
+    // acl is listed newest first, and the newest duplicate wins...
+    if(!(*np)->entry)
+        (*np)->entry = entry;
+    return true;
+}
+
+stack::subnet *policymap::find(const struct sockaddr *addr)
+{
+    assert(addr != NULL);
+
+    const unsigned char *bytes;
+    stack::subnet *policy = NULL;
+    unsigned limit, pos = 0;
+    node *np;
+
+    switch(addr->sa_family) {
+    case AF_INET:
+        np = ipv4;
+        limit = 32;
+        bytes = (const unsigned char *)&(((const struct sockaddr_in *)addr)->sin_addr);
+        break;
+#ifdef  AF_INET6
+    case AF_INET6:
+        np = ipv6;
+        limit = 128;
+        bytes = (const unsigned char *)&(((const struct sockaddr_in6 *)addr)->sin6_addr);
+        break;
+#endif
+    default:
+        return NULL;
+    }
+
+    while(np) {
+        if(np->entry)
+            policy = np->entry;
+        if(pos >= limit)
+            break;
+        np = np->child[bit(bytes, pos++)];
+    }
+    return policy;
+}
+
+} // end namespace
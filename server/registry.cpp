@@ -18,6 +18,37 @@
 
 namespace sipwitch {
 
+#define CHECKPOINT_VERSION  1
+#define ROUTING_CHOICES     16
+#define ROUTING_UNLIMITED   65536
+
+// registry checkpoint file records.  The header records the layout, so a
+// checkpoint written by a differently built server is simply ignored.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint32_t target_size;
+    time_t saved;
+} chkheader_t;
+
+typedef struct {
+    char userid[MAX_USERID_SIZE];
+    time_t created;
+    time_t expires;
+    unsigned targets;
+    unsigned contacts;
+} chkentry_t;
+
+typedef struct {
+    struct sockaddr_internet address;
+    struct sockaddr_storage peering;
+    time_t expires;
+    int context;
+    char contact[MAX_URI_SIZE];
+    char network[MAX_NETWORK_SIZE];
+} chktarget_t;
+
 static volatile unsigned active_routes = 0;
 static volatile unsigned active_entries = 0;
 static volatile unsigned active_targets = 0;
@@ -26,6 +57,7 @@ static volatile unsigned allocated_routes = 0;
 static volatile unsigned allocated_targets = 0;
 static volatile unsigned allocated_entries = 0;
 static unsigned mapped_entries = 999;
+static unsigned mapped_segments = 8;
 
 static unsigned keysize = 177;
 static registry::mapped **extmap = NULL;
@@ -33,15 +65,44 @@ static LinkedObject **addresses = NULL;
 static LinkedObject **publishing = NULL;
 static LinkedObject **contacts = NULL;
 static LinkedObject **primap = NULL;
+static dialplan routing;
+static unsigned sequence = (unsigned)(~0);
 static LinkedObject *freeroutes = NULL;
 static LinkedObject *freetargets = NULL;
 static LinkedObject **keys = NULL;
 static condlock_t locking;
 static stats *statmap = NULL;
 static LinkedObject *freelist = NULL;
+static time_t checkpointed = 0;
 
 registry registry::reg;
 
+// contexts are saved by transport, since pointers do not survive restart
+static int transport(voip::context_t context)
+{
+    if(context == stack::sip.udp_context)
+        return 1;
+    if(context == stack::sip.tcp_context)
+        return 2;
+    if(context == stack::sip.tls_context)
+        return 3;
+    return 0;
+}
+
+static voip::context_t transport(int context)
+{
+    switch(context) {
+    case 1:
+        return stack::sip.udp_context;
+    case 2:
+        return stack::sip.tcp_context;
+    case 3:
+        return stack::sip.tls_context;
+    default:
+        return stack::sip.out_context;
+    }
+}
+
 registry::pointer::pointer()
 {
     entry = NULL;
@@ -104,12 +165,13 @@ void registry::route::operator delete(void *obj)
 }
 
 registry::registry() :
-service::callback(0), mapped_array<MappedRegistry>()
+service::callback(0), segmented_array<MappedRegistry>()
 {
     prefix = 100;
     range = 600;
     expires = 300l;
     routes = 10;
+    saving = 60;
 }
 
 const char *registry::getDomain(void)
@@ -136,12 +198,23 @@ const char *registry::getDomain(void)
     return reg.realm;
 }
 
-void registry::incUse(mapped *rr, stats::stat_t stat)
+// calls are counted against the limit of an entry without taking a lock,
+// so that event threads routing to the same gateway never wait on each
+// other.  An external entry may be limited by its stat node instead.
+static unsigned capacity(registry::mapped *rr)
+{
+    if(rr->limit)
+        return rr->limit;
+
+    if(rr->type == MappedRegistry::EXTERNAL && rr->source.external.statnode)
+        return rr->source.external.statnode->limit;
+
+    return 0;
+}
+
+static void assign(registry::mapped *rr, stats::stat_t stat)
 {
     if(rr) {
-        Mutex::protect(rr);
-        ++rr->inuse;
-        Mutex::release(rr);
         switch(rr->type) {
         case MappedRegistry::EXTERNAL:
             if(rr->source.external.statnode) {
@@ -164,12 +237,38 @@ void registry::incUse(mapped *rr, stats::stat_t stat)
         statmap[4].assign(stat);
 }
 
+void registry::incUse(mapped *rr, stats::stat_t stat)
+{
+    if(rr)
+        __sync_add_and_fetch(&rr->inuse, 1);
+    assign(rr, stat);
+}
+
+bool registry::reserve(mapped *rr, stats::stat_t stat)
+{
+    unsigned limit, use;
+
+    if(!rr) {
+        assign(rr, stat);
+        return true;
+    }
+
+    limit = capacity(rr);
+    for(;;) {
+        use = rr->inuse;
+        if(limit && use >= limit)
+            return false;
+        if(__sync_bool_compare_and_swap(&rr->inuse, use, use + 1))
+            break;
+    }
+    assign(rr, stat);
+    return true;
+}
+
 void registry::decUse(mapped *rr, stats::stat_t stat)
 {
     if(rr) {
-        Mutex::protect(rr);
-        --rr->inuse;
-        Mutex::release(rr);
+        __sync_sub_and_fetch(&rr->inuse, 1);
         switch(rr->type) {
         case MappedRegistry::EXTERNAL:
             if(rr->source.external.statnode) {
@@ -211,22 +310,42 @@ registry::mapped *registry::find(const char *id)
 
 unsigned registry::getIndex(mapped *rr)
 {
-    assert((caddr_t)rr >= reg.addr());
+    unsigned x = reg.index(rr);
 
-    unsigned x = (unsigned)(((caddr_t)rr - reg.addr()) / sizeof(MappedRegistry));
+    assert(x < reg.count());
     return x;
 }
 
+// entries come from the free list, then from the map, which grows by
+// another segment once every entry has been used.  Called locked.
+registry::mapped *registry::claim(void)
+{
+    mapped *rr;
+
+    if(freelist) {
+        rr = (mapped *)freelist;
+        freelist = rr->getNext();
+        return rr;
+    }
+
+    if(allocated_entries >= reg.count()) {
+        if(!reg.grow())
+            return NULL;
+        shell::log(shell::INFO, "registry grown to %d entries", reg.count());
+    }
+    return (mapped *)reg(allocated_entries++);
+}
+
 void registry::start(service *cfg)
 {
     assert(cfg != NULL);
 
     shell::log(DEBUG1, "starting registry; mapping %d entries", mapped_entries);
-    create(control::env("regmap"), mapped_entries);
+    huge(server::hugepages());
+    create(control::env("regmap"), "sipwreg", REGISTRY_VERSION, mapped_entries, mapped_segments);
     if(!reg)
         shell::log(shell::FAIL, "registry could not be mapped");
-    initialize();
-    statmap = stats::create();
+    statmap = stats::create(server::hugepages());
 }
 
 bool registry::check(void)
@@ -242,8 +361,8 @@ void registry::stop(service *cfg)
     assert(cfg != NULL);
 
     shell::log(DEBUG1, "stopping registry");
-    MappedMemory::release();
-    MappedMemory::remove(control::env("regmap"));
+    checkpoint(true);
+    segmented_array<MappedRegistry>::release();
     stats::release();
 }
 
@@ -260,16 +379,20 @@ void registry::snapshot(FILE *fp)
 
     locking.access();
     fprintf(fp, "Registry:\n");
-    fprintf(fp, "  mapped entries: %d\n", mapped_entries);
+    fprintf(fp, "  mapped entries: %d\n", reg.count());
+    fprintf(fp, "  mapped segments: %d of %d, %d huge paged\n", reg.size(), reg.limit(), reg.huge());
+    fprintf(fp, "  mapped layout:  version %d, %u bytes per entry\n", REGISTRY_VERSION, (unsigned)sizeof(MappedRegistry));
     fprintf(fp, "  active entries: %d\n", active_entries);
     fprintf(fp, "  active routes:  %d\n", active_routes);
     fprintf(fp, "  active targets: %d\n", active_targets);
     fprintf(fp, "  published routes:  %d\n", published_routes);
+    fprintf(fp, "  routing patterns:  %d\n", routing.getPatterns());
+    fprintf(fp, "  routing nodes:     %d\n", routing.getNodes());
     fprintf(fp, "  allocated routes:  %d\n", allocated_routes);
     fprintf(fp, "  allocated targets: %d\n", allocated_targets);
     fprintf(fp, "  allocated entries: %d\n", allocated_entries);
 
-    while(regcount < mapped_entries) {
+    while(regcount < allocated_entries) {
         time(&now);
         rr = static_cast<mapped*>(reg(regcount++));
         if(rr->type == MappedRegistry::TEMPORARY) {
@@ -284,9 +407,9 @@ void registry::snapshot(FILE *fp)
                 fprintf(fp, "  user %s; extension=%s, profile=%s, use=%d,",
                     rr->userid, buffer, rr->profile.id, rr->inuse);
             else if(rr->type == MappedRegistry::GATEWAY)
-                fprintf(fp, "  gateway %s; use=%d,", rr->userid, rr->inuse);
+                fprintf(fp, "  gateway %s; use=%d, limit=%d,", rr->userid, rr->inuse, rr->limit);
             else if(rr->type == MappedRegistry::SERVICE)
-                fprintf(fp, "  service %s; use=%d", rr->userid, rr->inuse);
+                fprintf(fp, "  service %s; use=%d, limit=%d", rr->userid, rr->inuse, rr->limit);
             else if(rr->type == MappedRegistry::REFER)
                 fprintf(fp, "  refer %s; extensions=%s,",
                     rr->userid, buffer);
@@ -394,6 +517,7 @@ void registry::expire(mapped *rr)
     unsigned path;
 
     --active_entries;
+    rr->changes.lock();
 
     while(rp) {
         route *nr = rp.getNext();
@@ -401,8 +525,10 @@ void registry::expire(mapped *rr)
             path = NamedObject::keyindex(rp->entry.text, keysize);
             rp->entry.delist(&contacts[path]);
         }
-        else
+        else {
+            routing.remove(rp->entry.text, &rp->entry);
             rp->entry.delist(&primap[rp->entry.priority]);
+        }
         rp->entry.text[0] = 0;
         delete *rp;
         rp = nr;
@@ -447,6 +573,7 @@ void registry::expire(mapped *rr)
     rr->rid = -1;
     rr->delist(&keys[path]);
     rr->enlist(&freelist);
+    rr->changes.unlock();
 }
 
 unsigned registry::cleanup(time_t period)
@@ -457,12 +584,21 @@ unsigned registry::cleanup(time_t period)
     bool expired;
     unsigned expcount = 0;
 
-    while(regcount < mapped_entries) {
+    time(&now);
+    while(regcount < allocated_entries) {
         expired = false;
-        time(&now);
         rr = static_cast<mapped*>(reg(regcount++));
-        store_unsafe<mapped>(save, rr);
+
+        // only the hot header is looked at until there is something to
+        // do, and it is checked again once locked.
+        if(rr->type == MappedRegistry::EXPIRED && rr->status == MappedRegistry::OFFLINE)
+            continue;
+        if(rr->type != MappedRegistry::EXPIRED && (!rr->expires || rr->expires + period >= now))
+            continue;
+
+        time(&now);
         locking.modify();
+        store_unsafe<mapped>(save, rr);
         if(rr->type != MappedRegistry::EXPIRED && rr->expires && rr->expires + period < now && !rr->inuse) {
             expire(rr);
             expired = true;
@@ -481,6 +617,190 @@ unsigned registry::cleanup(time_t period)
     return expcount;
 }
 
+void registry::checkpoint(bool force)
+{
+    mapped *rr;
+    unsigned regcount = 0, saved = 0;
+    linked_pointer<target> tp;
+    linked_pointer<route> rp;
+    chkheader_t header;
+    chkentry_t entry;
+    chktarget_t record;
+    char path[256], temp[256];
+    bool failed;
+    time_t now;
+    FILE *fp;
+
+    time(&now);
+    if(!force && (!reg.saving || now < checkpointed + (time_t)reg.saving))
+        return;
+
+    checkpointed = now;
+    snprintf(path, sizeof(path), "%s/registry.chk", control::env("cache"));
+    snprintf(temp, sizeof(temp), "%s/registry.tmp", control::env("cache"));
+
+    fp = fopen(temp, "w");
+    if(!fp) {
+        shell::log(shell::ERR, "cannot checkpoint registry to %s", temp);
+        return;
+    }
+
+    memset(&header, 0, sizeof(header));
+    String::set(header.magic, sizeof(header.magic), "sipwreg");
+    header.version = CHECKPOINT_VERSION;
+    header.entry_size = sizeof(chkentry_t);
+    header.target_size = sizeof(chktarget_t);
+    header.saved = now;
+    fwrite(&header, sizeof(header), 1, fp);
+
+    // each entry is only locked while it is being copied out...
+    while(regcount < allocated_entries) {
+        rr = static_cast<mapped*>(reg(regcount++));
+        locking.access();
+        if(rr->type == MappedRegistry::EXPIRED || rr->type == MappedRegistry::TEMPORARY || !rr->expires || rr->expires <= now) {
+            locking.release();
+            continue;
+        }
+
+        memset(&entry, 0, sizeof(entry));
+        String::set(entry.userid, sizeof(entry.userid), rr->userid);
+        entry.created = rr->created;
+        entry.expires = rr->expires;
+
+        tp = rr->source.internal.targets;
+        while(is(tp)) {
+            if(tp->expires > now)
+                ++entry.targets;
+            tp.next();
+        }
+
+        // services may learn their contacts when they register...
+        rp = rr->source.internal.routes;
+        while(is(rp) && rr->type == MappedRegistry::SERVICE) {
+            ++entry.contacts;
+            rp.next();
+        }
+
+        if(!entry.targets) {
+            locking.release();
+            continue;
+        }
+
+        fwrite(&entry, sizeof(entry), 1, fp);
+        tp = rr->source.internal.targets;
+        while(is(tp)) {
+            if(tp->expires > now) {
+                memset(&record, 0, sizeof(record));
+                memcpy(&record.address, &tp->address, sizeof(record.address));
+                memcpy(&record.peering, &tp->peering, sizeof(record.peering));
+                record.expires = tp->expires;
+                record.context = transport(tp->context);
+                String::set(record.contact, sizeof(record.contact), tp->contact);
+                String::set(record.network, sizeof(record.network), tp->network);
+                fwrite(&record, sizeof(record), 1, fp);
+            }
+            tp.next();
+        }
+        rp = rr->source.internal.routes;
+        while(is(rp) && rr->type == MappedRegistry::SERVICE) {
+            fwrite(rp->entry.text, MAX_USERID_SIZE, 1, fp);
+            rp.next();
+        }
+        locking.release();
+        ++saved;
+        Thread::yield();
+    }
+
+    failed = (ferror(fp) != 0);
+    if(fclose(fp))
+        failed = true;
+
+    if(failed || rename(temp, path)) {
+        shell::log(shell::ERR, "cannot checkpoint registry to %s", path);
+        ::remove(temp);
+        return;
+    }
+
+    shell::debug(9, "registry checkpoint; %d entries saved", saved);
+}
+
+void registry::restore(void)
+{
+    chkheader_t header;
+    chkentry_t entry;
+    chktarget_t saved;
+    char path[256];
+    char text[MAX_USERID_SIZE];
+    unsigned restored = 0, index;
+    bool active, listed;
+    mapped *rr;
+    time_t now;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/registry.chk", control::env("cache"));
+    fp = fopen(path, "r");
+    if(!fp)
+        return;
+
+    if(fread(&header, sizeof(header), 1, fp) != 1 || !eq(header.magic, "sipwreg", sizeof(header.magic)) || header.version != CHECKPOINT_VERSION || header.entry_size != sizeof(chkentry_t) || header.target_size != sizeof(chktarget_t)) {
+        shell::log(shell::WARN, "ignoring incompatible registry checkpoint %s", path);
+        fclose(fp);
+        return;
+    }
+
+    time(&now);
+    while(fread(&entry, sizeof(entry), 1, fp) == 1) {
+        entry.userid[sizeof(entry.userid) - 1] = 0;
+        active = listed = false;
+        rr = NULL;
+
+        // entries are rebuilt from current provisioning, so users since
+        // removed are dropped, and routes and profiles are current...
+        if(entry.expires > now && isUserid(entry.userid))
+            rr = allocate(entry.userid);
+
+        if(rr)
+            listed = (rr->source.internal.routes != NULL);
+
+        for(index = 0; index < entry.targets; ++index) {
+            if(fread(&saved, sizeof(saved), 1, fp) != 1)
+                break;
+            if(!rr || saved.expires <= now)
+                continue;
+
+            saved.contact[sizeof(saved.contact) - 1] = 0;
+            saved.network[sizeof(saved.network) - 1] = 0;
+            Socket::address addr((struct sockaddr *)(&saved.address));
+            if(rr->type == MappedRegistry::USER)
+                active = (rr->addTarget(addr, saved.expires, saved.contact, saved.network, (struct sockaddr *)(&saved.peering), transport(saved.context)) > 0);
+            else
+                active = (rr->setTarget(addr, saved.expires, saved.contact, saved.network, (struct sockaddr *)(&saved.peering), transport(saved.context)) > 0);
+        }
+
+        for(index = 0; index < entry.contacts; ++index) {
+            if(fread(text, sizeof(text), 1, fp) != 1)
+                break;
+            text[sizeof(text) - 1] = 0;
+            if(active && !listed && rr->type == MappedRegistry::SERVICE && text[0])
+                rr->addContact(text);
+        }
+
+        if(!rr)
+            continue;
+
+        if(active) {
+            rr->created = entry.created;
+            ++restored;
+            server::activate(rr);
+        }
+        detach(rr);
+    }
+
+    fclose(fp);
+    if(restored)
+        shell::log(shell::NOTIFY, "restored %d registrations from checkpoint", restored);
+}
+
 void registry::reload(service *cfg)
 {
     assert(cfg != NULL);
@@ -499,6 +819,8 @@ void registry::reload(service *cfg)
         if(key && value) {
             if(!stricmp(key, "mapped") && !is_configured())
                 mapped_entries = atoi(value);
+            else if(!stricmp(key, "segments") && !is_configured())
+                mapped_segments = atoi(value);
             else if(!stricmp(key, "digest")) {
                 digest = cfg->dup(value);
                 String::upper((char *)digest);
@@ -515,6 +837,8 @@ void registry::reload(service *cfg)
                 expires = atoi(value);
             else if(!stricmp(key, "keysize") && !is_configured())
                 keysize = atoi(value);
+            else if(!stricmp(key, "checkpoint"))
+                saving = atoi(value);
         }
         sp.next();
     }
@@ -627,23 +951,20 @@ registry::mapped *registry::invite(const char *id, stats::stat_t stat)
     }
 
     locking.exclusive();
-    if(freelist) {
-        rr = (mapped *)freelist;
-        freelist = rr->getNext();
-    }
-    else if(allocated_entries < mapped_entries)
-        rr = (mapped *)reg(allocated_entries++);
-    else {
+    rr = claim();
+    if(!rr) {
         locking.commit();
         return NULL;
     }
 
+    rr->changes.lock();
     clear(rr);
     rr->type = MappedRegistry::TEMPORARY;
     rr->expires = 0;
     rr->created = 0;
     rr->display[0] = 0;
     rr->inuse = 0;
+    rr->limit = 0;
     rr->rid = -1;
 
     // in case inter-nodel temporary, create properties for call use...
@@ -669,6 +990,7 @@ registry::mapped *registry::invite(const char *id, stats::stat_t stat)
     rr->ext = ext;
     rr->enlist(&keys[path]);
     rr->status = MappedRegistry::OFFLINE;
+    rr->changes.unlock();
     incUse(rr, stat);
 
     locking.commit();
@@ -700,11 +1022,7 @@ registry::mapped *registry::allocate(const char *id)
     if(rr)
         listed = true;
     else {
-        if(freelist) {
-            rr = (mapped *)freelist;
-            freelist = rr->getNext();
-        } else if(allocated_entries < mapped_entries)
-            rr = (mapped *)reg(allocated_entries++);
+        rr = claim();
         if(rr)
             clear(rr);
     }
@@ -713,6 +1031,7 @@ registry::mapped *registry::allocate(const char *id)
         return NULL;
     }
 
+    rr->changes.lock();
     server::getProvision(id, user);
     node = user.keys;
     cp = "none";
@@ -721,6 +1040,7 @@ registry::mapped *registry::allocate(const char *id)
     rr->expires = 0;
     rr->created = 0;
     rr->display[0] = 0;
+    rr->limit = 0;
 
     if(!listed)
         rr->inuse = 0;
@@ -749,6 +1069,7 @@ registry::mapped *registry::allocate(const char *id)
         }
         if(!listed)
             rr->enlist(&freelist);
+        rr->changes.unlock();
         locking.commit();
         return NULL;
     }
@@ -788,6 +1109,10 @@ registry::mapped *registry::allocate(const char *id)
     if(is(rp) && rp->getPointer())
         String::set(rr->display, sizeof(rr->display), rp->getPointer());
 
+    rp = node->leaf("limit");
+    if(is(rp) && rp->getPointer())
+        rr->limit = atoi(rp->getPointer());
+
     // we add routes while still exclusive owner of registry since
     // they update priority indexes.
     rp = node->leaf("routes");
@@ -857,6 +1182,7 @@ registry::mapped *registry::allocate(const char *id)
         shell::log(shell::INFO, "activating %s; extension=%d", rr->userid, ext);
     }
     ++active_entries;
+    rr->changes.unlock();
 
     // exchange exclusive mutex lock for registry to shared before return
     // when registry state is again stable.
@@ -866,6 +1192,36 @@ registry::mapped *registry::allocate(const char *id)
     return rr;
 }
 
+// an unprovisioned user entry, so benchmarks can size the registry.  Like
+// allocate, this returns with the registry share locked.
+registry::mapped *registry::populate(const char *id)
+{
+    assert(id != NULL && *id != 0);
+
+    mapped *rr = NULL;
+    unsigned path = NamedObject::keyindex(id, keysize);
+
+    locking.modify();
+    if(!find(id))
+        rr = claim();
+
+    if(!rr) {
+        locking.commit();
+        return NULL;
+    }
+
+    rr->changes.lock();
+    clear(rr);
+    rr->type = MappedRegistry::USER;
+    rr->status = MappedRegistry::IDLE;
+    String::set(rr->userid, sizeof(rr->userid), id);
+    rr->enlist(&keys[path]);
+    rr->changes.unlock();
+    ++active_entries;
+    locking.share();
+    return rr;
+}
+
 registry::mapped *registry::address(const struct sockaddr *addr)
 {
     assert(addr != NULL);
@@ -990,11 +1346,42 @@ bool registry::isExtension(const char *id)
     return false;
 }
 
-registry::pattern *registry::getRouting(unsigned trs, const char *id)
+// a route is saturated when its registry has as many calls as it allows.
+// Otherwise the least loaded route is preferred, comparing the fraction
+// of the limit in use, with routes without a limit taken as very large.
+static bool saturated(registry::mapped *rr)
+{
+    unsigned limit = capacity(rr);
+
+    return limit && rr->inuse >= limit;
+}
+
+static bool lighter(registry::mapped *rr, registry::mapped *best)
+{
+    unsigned long limit = capacity(rr), prior = capacity(best);
+
+    if(!limit)
+        limit = ROUTING_UNLIMITED;
+    if(!prior)
+        prior = ROUTING_UNLIMITED;
+
+    return (unsigned long)rr->inuse * prior < (unsigned long)best->inuse * limit;
+}
+
+registry::pattern *registry::getRouting(unsigned trs, const char *id, bool *busy)
 {
     assert(id != NULL && *id != 0);
 
     linked_pointer<pattern> pp;
+    dialplan::match *list[ROUTING_CHOICES];
+    dialplan::match *best = NULL, *mp;
+    pattern *choice = NULL;
+    unsigned count = 0, pos;
+    bool full = false;
+
+    if(busy)
+        *busy = false;
+
     if(trs > reg.routes)
         trs = reg.routes;
 
@@ -1002,14 +1389,47 @@ registry::pattern *registry::getRouting(unsigned trs, const char *id)
         return NULL;
 
     locking.access();
-    while(trs--) {
+    if(routing.find(id, list, ROUTING_CHOICES, &count, trs)) {
+        for(pos = 0; pos < count; ++pos) {
+            mp = list[pos];
+            if(saturated(((pattern *)mp->object)->registry)) {
+                full = true;
+                continue;
+            }
+            if(!best || mp->level > best->level)
+                best = mp;
+            else if(mp->level == best->level) {
+                if(lighter(((pattern *)mp->object)->registry, ((pattern *)best->object)->registry))
+                    best = mp;
+                else if(mp->rank < best->rank && !lighter(((pattern *)best->object)->registry, ((pattern *)mp->object)->registry))
+                    best = mp;
+            }
+        }
+        if(best)
+            return (pattern *)best->object;
+        if(busy)
+            *busy = full;
+        locking.release();
+        return NULL;
+    }
+
+    // too many wildcard branches active, so walk the priority lists...
+    while(trs-- && !choice) {
         pp = primap[trs];
         while(pp) {
-            if(service::match(id, pp->text, false) && pp->registry)
-                return *pp;
+            if(service::match(id, pp->text, false) && pp->registry) {
+                if(saturated(pp->registry))
+                    full = true;
+                else if(!choice || lighter(pp->registry, choice->registry))
+                    choice = *pp;
+            }
             pp.next();
         }
     }
+    if(choice)
+        return choice;
+    if(busy)
+        *busy = full;
     locking.release();
     return NULL;
 }
@@ -1131,6 +1551,7 @@ unsigned registry::mapped::setTarget(Socket::address& target_addr, time_t lease,
     len = Socket::len(ai);
 
     locking.exclusive();
+    changes.lock();
     tp = source.internal.targets;
     while(is(tp) && count > 1) {
         delete *tp;
@@ -1178,6 +1599,7 @@ unsigned registry::mapped::setTarget(Socket::address& target_addr, time_t lease,
     String::set(tp->contact, sizeof(tp->contact), target_contact);
     String::set(network, sizeof(network), target_network);
     uri::userid(target_contact, remote, sizeof(remote));
+    changes.unlock();
     locking.share();
     return 1;
 }
@@ -1201,6 +1623,9 @@ void registry::mapped::addRoute(const char *route_pattern, unsigned route_priori
     rp->entry.registry = this;
     rp->entry.enlist(&primap[route_priority]);
     rp->enlist(&source.internal.routes);
+
+    // newer routes of the same priority are preferred, as in primap...
+    routing.add(rp->entry.text, &rp->entry, route_priority, sequence--);
     locking.share();
 }
 
@@ -1318,8 +1743,10 @@ bool registry::mapped::expire(Socket::address& saddr)
         registry::mapped save;
         Mutex::protect(this);
         store_unsafe<registry::mapped>(save, this);
+        changes.lock();
         type = MappedRegistry::EXPIRED;
         expires = 0;
+        changes.unlock();
         Mutex::release(this);
         server::expire(&save);
         return true;
@@ -1406,6 +1833,7 @@ unsigned registry::mapped::addTarget(Socket::address& target_addr, time_t lease,
         context = stack::sip.out_context;
 
     locking.exclusive();
+    changes.lock();
     tp = source.internal.targets;
     if(lease > expires)
         expires = lease;
@@ -1437,6 +1865,7 @@ unsigned registry::mapped::addTarget(Socket::address& target_addr, time_t lease,
         Socket::store(&tp->peering, target_peering);
         String::set(tp->contact, sizeof(tp->contact), target_contact);
         String::set(tp->network, sizeof(tp->network), target_network);
+        changes.unlock();
         locking.share();
         return count;
     }
@@ -1468,6 +1897,7 @@ unsigned registry::mapped::addTarget(Socket::address& target_addr, time_t lease,
     expired->index.registry = this;
     expired->index.address = (struct sockaddr *)(&expired->address);
     expired->index.enlist(&addresses[Socket::keyindex(expired->index.address, keysize)]);
+    changes.unlock();
     locking.share();
     update();
     return count;
@@ -1495,6 +1925,7 @@ unsigned registry::mapped::setTargets(Socket::address& target_addr, voip::contex
     if(!context)
         context = stack::sip.out_context;
 
+    changes.lock();
     tp = source.internal.targets;
     while(tp) {
         delete *tp;
@@ -1532,6 +1963,7 @@ unsigned registry::mapped::setTargets(Socket::address& target_addr, voip::contex
         al = al->ai_next;
     }
     expires = 0;
+    changes.unlock();
     locking.share();
     update();
     return count;
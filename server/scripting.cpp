@@ -16,32 +16,236 @@
 
 #include <sipwitch-config.h>
 #include <sipwitch/sipwitch.h>
+#ifndef _MSWINDOWS_
+#include <unistd.h>
+#include <errno.h>
+#endif
 
 namespace sipwitch {
 
+// When the script directory has a "sipevents" script, it is started once
+// and kept running, and each event is written to it as a line, such as
+// "up userid ext address:port type", "down userid ext", or "state name".
+// Events are queued so registration threads never wait on the script,
+// and are written in batches.  If the queue is full, events are dropped
+// and counted.  Without sipevents, each event runs its own script as
+// before.
+
+#define SCRIPT_QUEUE    256
+#define SCRIPT_EVENT    160
+#define SCRIPT_BATCH    4096
+#define SCRIPT_RETRY    1000
+
 static const char *dirpath = NULL;
 static char prior[65] = "down";
 
+class __LOCAL feeder : public JoinableThread, public Conditional
+{
+public:
+    feeder();
+
+    bool post(const char *text);
+    void stop(void);
+    void snapshot(FILE *fp);
+
+private:
+    char queue[SCRIPT_QUEUE][SCRIPT_EVENT + 1];
+    unsigned head, tail, count;
+    unsigned long posted, written, batches, dropped, restarts;
+    bool stopping;
+    fd_t fd;
+
+    bool send(const char *text, size_t size);
+    void release(void);
+    void run(void);
+};
+
 class __LOCAL scripting : public modules::sipwitch
 {
 public:
     scripting();
 
 private:
+    feeder *events;
+
     void start(service *cfg);
+    void stop(service *cfg);
     void reload(service *cfg);
+    void snapshot(FILE *fp);
     void activating(MappedRegistry *rr);
     void expiring(MappedRegistry *rr);
 };
 
 static scripting scripting_plugin;
 
+feeder::feeder() :
+JoinableThread(), Conditional()
+{
+    head = tail = count = 0;
+    posted = written = batches = dropped = restarts = 0;
+    stopping = false;
+    fd = INVALID_HANDLE_VALUE;
+}
+
+bool feeder::post(const char *text)
+{
+    Conditional::lock();
+    if(count >= SCRIPT_QUEUE) {
+        ++dropped;
+        Conditional::unlock();
+        return false;
+    }
+    snprintf(queue[tail], sizeof(queue[tail]), "%s\n", text);
+    tail = (tail + 1) % SCRIPT_QUEUE;
+    ++count;
+    ++posted;
+    Conditional::signal();
+    Conditional::unlock();
+    return true;
+}
+
+void feeder::stop(void)
+{
+    Conditional::lock();
+    stopping = true;
+    Conditional::signal();
+    Conditional::unlock();
+    join();
+}
+
+bool feeder::send(const char *text, size_t size)
+{
+#ifdef  _MSWINDOWS_
+    return false;
+#else
+    ssize_t result;
+
+    while(size) {
+        result = ::write(fd, text, size);
+        if(result < 0 && errno == EINTR)
+            continue;
+        if(result <= 0)
+            return false;
+        text += result;
+        size -= result;
+    }
+    return true;
+#endif
+}
+
+void feeder::release(void)
+{
+    if(fd == INVALID_HANDLE_VALUE)
+        return;
+
+#ifndef _MSWINDOWS_
+    ::close(fd);
+#endif
+    fd = INVALID_HANDLE_VALUE;
+}
+
+void feeder::run(void)
+{
+    char batch[SCRIPT_BATCH];
+    size_t size, len;
+    unsigned lines;
+
+    for(;;) {
+        Conditional::lock();
+        while(!count && !stopping)
+            Conditional::wait();
+        if(!count && stopping) {
+            Conditional::unlock();
+            break;
+        }
+
+        size = 0;
+        lines = 0;
+        while(count) {
+            len = strlen(queue[head]);
+            if(size + len > sizeof(batch))
+                break;
+            memcpy(batch + size, queue[head], len);
+            size += len;
+            head = (head + 1) % SCRIPT_QUEUE;
+            --count;
+            ++lines;
+        }
+        Conditional::unlock();
+
+        if(fd == INVALID_HANDLE_VALUE) {
+            fd = control::pipexec("%s/sipevents", dirpath);
+            if(fd == INVALID_HANDLE_VALUE) {
+                shell::log(shell::ERR, "scripting plugin cannot start %s/sipevents", dirpath);
+                Conditional::lock();
+                dropped += lines;
+                Conditional::unlock();
+                Thread::sleep(SCRIPT_RETRY);
+                continue;
+            }
+        }
+
+        if(send(batch, size)) {
+            Conditional::lock();
+            written += lines;
+            ++batches;
+            Conditional::unlock();
+            continue;
+        }
+
+        // the script went away, so it is started again for what follows,
+        // but not so quickly that a failing script is forked in a loop
+        shell::log(shell::WARN, "scripting plugin lost %s/sipevents", dirpath);
+        release();
+        Conditional::lock();
+        dropped += lines;
+        ++restarts;
+        Conditional::unlock();
+        Thread::sleep(SCRIPT_RETRY);
+    }
+
+    release();
+}
+
+void feeder::snapshot(FILE *fp)
+{
+    Conditional::lock();
+    fprintf(fp, "  script events queued:  %u\n", count);
+    fprintf(fp, "  script events posted:  %lu\n", posted);
+    fprintf(fp, "  script events written: %lu in %lu batches\n", written, batches);
+    fprintf(fp, "  script events dropped: %lu\n", dropped);
+    fprintf(fp, "  script restarts:       %lu\n", restarts);
+    Conditional::unlock();
+}
+
 scripting::scripting() :
-modules::sipwitch()
+modules::sipwitch(modules::HOOK_ACTIVATING | modules::HOOK_EXPIRING)
 {
+    events = NULL;
     shell::log(shell::INFO, "scripting plugin loaded");
 }
 
+void scripting::snapshot(FILE *fp)
+{
+    assert(fp != NULL);
+
+    if(!events)
+        return;
+
+    fprintf(fp, "Scripting:\n");
+    events->snapshot(fp);
+}
+
+void scripting::stop(service *cfg)
+{
+    if(!events)
+        return;
+
+    events->stop();
+    delete events;
+    events = NULL;
+}
+
 void scripting::reload(service *cfg)
 {
     assert(cfg != NULL);
@@ -59,7 +263,13 @@ void scripting::reload(service *cfg)
     if(String::equal(state, prior))
         return;
 
-    control::libexec("%s/sipstate %s", dirpath, state);
+    if(events) {
+        char text[SCRIPT_EVENT];
+        snprintf(text, sizeof(text), "state %s", state);
+        events->post(text);
+    }
+    else
+        control::libexec("%s/sipstate %s", dirpath, state);
 
     String::set(prior, sizeof(prior), state);
 }
@@ -69,6 +279,7 @@ void scripting::start(service *cfg)
     assert(cfg != NULL);
 
     static char buf[256];
+    char path[256];
     const char *home = control::env("HOME");
 
     if(fsys::is_dir(DEFAULT_CFGPATH "/sysconfig/sipwitch-scripts"))
@@ -85,6 +296,17 @@ void scripting::start(service *cfg)
         shell::log(shell::INFO, "scripting plugin path %s", dirpath);
     else
         shell::log(shell::ERR, "scripting plugin disabled; no script directory");
+
+#ifndef _MSWINDOWS_
+    if(dirpath && !events) {
+        snprintf(path, sizeof(path), "%s/sipevents", dirpath);
+        if(fsys::is_file(path)) {
+            shell::log(shell::INFO, "scripting plugin events to %s", path);
+            events = new feeder();
+            events->start();
+        }
+    }
+#endif
 }
 
 void scripting::activating(MappedRegistry *rr)
@@ -94,9 +316,17 @@ void scripting::activating(MappedRegistry *rr)
         return;
 
     Socket::query((struct sockaddr *)&rr->contact, addr, sizeof(addr));
-    control::libexec("%s/sipup %s %d %s:%d %d", dirpath, rr->userid, rr->ext,
-        addr, Socket::port((struct sockaddr *)&rr->contact),
-        (int)(rr->type - MappedRegistry::EXPIRED));
+    if(events) {
+        char text[SCRIPT_EVENT];
+        snprintf(text, sizeof(text), "up %s %d %s:%d %d", rr->userid, rr->ext,
+            addr, Socket::port((struct sockaddr *)&rr->contact),
+            (int)(rr->type - MappedRegistry::EXPIRED));
+        events->post(text);
+    }
+    else
+        control::libexec("%s/sipup %s %d %s:%d %d", dirpath, rr->userid, rr->ext,
+            addr, Socket::port((struct sockaddr *)&rr->contact),
+            (int)(rr->type - MappedRegistry::EXPIRED));
 }
 
 void scripting::expiring(MappedRegistry *rr)
@@ -104,7 +334,13 @@ void scripting::expiring(MappedRegistry *rr)
     if(!dirpath)
         return;
 
-    control::libexec("%s/sipdown %s %d", dirpath, rr->userid, rr->ext);
+    if(events) {
+        char text[SCRIPT_EVENT];
+        snprintf(text, sizeof(text), "down %s %d", rr->userid, rr->ext);
+        events->post(text);
+    }
+    else
+        control::libexec("%s/sipdown %s %d", dirpath, rr->userid, rr->ext);
 }
 
 } // end namespace
@@ -37,10 +37,100 @@
 #include <sys/sockio.h>
 #endif
 
+#ifndef _MSWINDOWS_
+#include <sys/time.h>
+#endif
+
+#ifdef  HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
 namespace sipwitch {
 
+class __LOCAL userfile : public OrderedObject
+{
+public:
+    const char *path;
+    const char *id;
+    service::keynode *tree;
+};
+
+class __LOCAL userloader : public JoinableThread
+{
+public:
+    service *heap;
+    unsigned long opening, loading;
+
+    userloader(userfile **list, unsigned count);
+
+    inline void wait(void)
+        {join();}
+
+private:
+    userfile **files;
+    unsigned total;
+
+    void run(void);
+};
+
 static mempager mempool(PAGING_SIZE);
+static mutex_t hugelock;
+static caddr_t hugepool = NULL;
+static size_t hugesize = 0, hugeused = 0;
+static const char *hugetype = "none";
+static bool hugemaps = false;
 static bool running = true;
+static mutex_t loadlock;
+static unsigned loadnext = 0;
+
+static int usercompare(const void *p1, const void *p2)
+{
+    const userfile *u1 = *((const userfile **)p1);
+    const userfile *u2 = *((const userfile **)p2);
+
+    return strcmp(u1->id, u2->id);
+}
+
+userloader::userloader(userfile **list, unsigned count) :
+JoinableThread()
+{
+    files = list;
+    total = count;
+    opening = loading = 0l;
+    heap = new service("provision", PAGING_SIZE);
+}
+
+void userloader::run(void)
+{
+    userfile *uf;
+    unsigned long mark;
+    FILE *fp;
+
+    for(;;) {
+        loadlock.acquire();
+        if(loadnext < total)
+            uf = files[loadnext++];
+        else
+            uf = NULL;
+        loadlock.release();
+
+        if(!uf)
+            return;
+
+        mark = timing::mstime();
+        fp = fopen(uf->path, "r");
+        opening += timing::mstime() - mark;
+        if(!fp)
+            continue;
+
+        // parsed into our private heap until spliced into the config...
+        mark = timing::mstime();
+        uf->tree = heap->addNode(heap->getRoot(), "provision", NULL);
+        if(!heap->load(fp, uf->tree))
+            shell::log(shell::ERR, "cannot load user cache %s", uf->id);
+        loading += timing::mstime() - mark;
+    }
+}
 
 static bool activating(int argc, char **args, voip::context_t context)
 {
@@ -83,7 +173,18 @@ service(id, PAGING_SIZE)
     assert(id != NULL && *id != 0);
 
     memset(keys, 0, sizeof(keys));
+    memset(heaps, 0, sizeof(heaps));
     acl = NULL;
+    policies = NULL;
+    routing = NULL;
+}
+
+server::~server()
+{
+    for(unsigned pos = 0; pos < USER_LOADERS; ++pos) {
+        if(heaps[pos])
+            delete heaps[pos];
+    }
 }
 
 const char *server::referRemote(MappedRegistry *rr, const char *target, char *buffer, size_t size)
@@ -93,15 +194,13 @@ const char *server::referRemote(MappedRegistry *rr, const char *target, char *bu
     assert(size > 0);
 
     const char *refer = NULL;
-    linked_pointer<modules::sipwitch> cb = getModules();
+    modules::sipwitch **cb = modules::hooks(modules::HOOK_REFER_REMOTE);
 
     if(!rr)
         return NULL;
 
-    while(!refer && is(cb)) {
-        refer = cb->referRemote(rr, target, buffer, size);
-        cb.next();
-    }
+    while(!refer && *cb)
+        refer = (*(cb++))->referRemote(rr, target, buffer, size);
     return refer;
 }
 
@@ -112,63 +211,54 @@ const char *server::referLocal(MappedRegistry *rr, const char *target, char *buf
     assert(size > 0);
 
     const char *refer = NULL;
-    linked_pointer<modules::sipwitch> cb = getModules();
+    modules::sipwitch **cb = modules::hooks(modules::HOOK_REFER_LOCAL);
 
     if(!rr)
         return NULL;
 
-    while(!refer && is(cb)) {
-        refer = cb->referLocal(rr, target, buffer, size);
-        cb.next();
-    }
+    while(!refer && *cb)
+        refer = (*(cb++))->referLocal(rr, target, buffer, size);
     return refer;
 }
 
 bool server::authenticate(voip::reg_t id, const char *realm)
 {
-    linked_pointer<modules::sipwitch> cb = getModules();
+    modules::sipwitch **cb = modules::hooks(modules::HOOK_AUTHENTICATE);
 
-    while(is(cb)) {
-        if(cb->authenticate(id, realm))
+    while(*cb) {
+        if((*(cb++))->authenticate(id, realm))
             return true;
-        cb.next();
     }
     return false;
 }
 
 void server::registration(voip::reg_t id, modules::regmode_t mode)
 {
-    linked_pointer<modules::sipwitch> cb = getModules();
+    modules::sipwitch **cb = modules::hooks(modules::HOOK_REGISTRATION);
 
-    while(is(cb)) {
-        cb->registration(id, mode);
-        cb.next();
-    }
+    while(*cb)
+        (*(cb++))->registration(id, mode);
 }
 
 void server::activate(MappedRegistry *rr)
 {
-    linked_pointer<modules::sipwitch> cb = getModules();
+    modules::sipwitch **cb = modules::hooks(modules::HOOK_ACTIVATING);
     logging(rr, "activating");
 
     events::activate(rr);
 
-    while(is(cb)) {
-        cb->activating(rr);
-        cb.next();
-    }
+    while(*cb)
+        (*(cb++))->activating(rr);
 }
 
 void server::expire(MappedRegistry *rr)
 {
-    linked_pointer<modules::sipwitch> cb = getModules();
+    modules::sipwitch **cb = modules::hooks(modules::HOOK_EXPIRING);
 
     logging(rr, "releasing");
 
-    while(is(cb)) {
-        cb->expiring(rr);
-        cb.next();
-    }
+    while(*cb)
+        (*(cb++))->expiring(rr);
     events::release(rr);
 }
 
@@ -180,13 +270,11 @@ void server::logging(MappedRegistry *rr, const char *reason)
 
 bool server::announce(MappedRegistry *rr, const char *msgtype, const char *event, const char *expires, const char *body)
 {
-    linked_pointer<modules::sipwitch> cb = getModules();
+    modules::sipwitch **cb = modules::hooks(modules::HOOK_ANNOUNCE);
     bool rtn = false;
 
-    while(!rtn && is(cb)) {
-        rtn = cb->announce(rr, msgtype, event, expires, body);
-        cb.next();
-    }
+    while(!rtn && *cb)
+        rtn = (*(cb++))->announce(rr, msgtype, event, expires, body);
     return rtn;
 }
 
@@ -243,10 +331,27 @@ void server::confirm(void)
     const char *dirpath = ".";
     const char *fn;
     digest_t digest(registry::getDigest());
+    unsigned long confirming = timing::mstime();
+    unsigned rank = 0;
 
     // add any missing keys
     getPath("devices");
 
+    // compile routing patterns and identities for dialing lookups...
+    mp = alloc(sizeof(dialplan));
+    routing = new(mp) dialplan(this);
+    node = getList("routing");
+    while(is(node)) {
+        fn = getValue(*node, "pattern");
+        if(fn && *fn)
+            routing->add(fn, *node, 0, rank);
+        fn = getValue(*node, "identity");
+        if(fn && *fn)
+            routing->assign(fn, *node, rank);
+        ++rank;
+        node.next();
+    }
+
     // construct default profiles
 
     provision = getPath("provision");
@@ -391,6 +496,20 @@ void server::confirm(void)
         node.next();
     }
 
+    // index policies for longest prefix lookups, unless a netmask is not
+    // contiguous, in which case we scan the acl as before...
+    mp = alloc(sizeof(policymap));
+    policies = new(mp) policymap(this);
+    linked_pointer<stack::subnet> sp = acl;
+    while(is(sp)) {
+        if(!policies->add(*sp)) {
+            shell::log(shell::WARN, "cannot index policy %s", sp->getId());
+            policies = NULL;
+            break;
+        }
+        sp.next();
+    }
+
     node = provision->getFirst();
     while(is(node)) {
         number = 0;
@@ -445,6 +564,8 @@ void server::confirm(void)
         node.next();
     }
 
+    shell::log(shell::INFO, "confirmed provisioning in %lu msec", timing::mstime() - confirming);
+
     if(!sipadmin && !sipusers)
         return;
 
@@ -577,7 +698,7 @@ final:
 void server::release(keynode *node)
 {
     if(node)
-        locking.release();
+        unpin();
 }
 
 void server::release(usernode& user)
@@ -594,7 +715,7 @@ void server::release(usernode& user)
 void server::release(stack::subnet *access)
 {
     if(access)
-        locking.release();
+        unpin();
 }
 
 bool server::isLocal(const struct sockaddr *addr)
@@ -606,23 +727,26 @@ bool server::isLocal(const struct sockaddr *addr)
     cidr *access = getPolicy(addr);
     if(access) {
         rtn = true;
-        locking.release();
+        unpin();
     }
     return rtn;
 }
 
 stack::subnet *server::getSubnet(const char *id)
 {
-    locking.access();
+    server *cfgp = static_cast<server*>(pin());
 
-    linked_pointer<stack::subnet> np = (((server *)(cfg))->acl);
+    if(!cfgp)
+        return NULL;
+
+    linked_pointer<stack::subnet> np = cfgp->acl;
 
     while(is(np)) {
         if(String::equal(np->getId(), id))
             return *np;
         np.next();
     }
-    locking.release();
+    unpin();
     return NULL;
 }
 
@@ -636,9 +760,12 @@ void server::listPolicy(FILE *fp)
     struct sockaddr_in6 *ipv6;
 #endif
     struct hostaddr_internet ha;
+    server *cfgp = static_cast<server*>(pin());
+
+    if(!cfgp)
+        return;
 
-    locking.access();
-    pp = ((server *)(cfg))->acl;
+    pp = cfgp->acl;
     while(is(pp)) {
         const char *id = pp->getId();
         int fam = pp->getFamily();
@@ -680,7 +807,7 @@ void server::listPolicy(FILE *fp)
             fprintf(fp, "policy %s; interface=%s, %s/%s\n", id, buf, baddr, bmask);
         pp.next();
     }
-    locking.release();
+    unpin();
 }
 
 stack::subnet *server::getPolicy(const struct sockaddr *addr)
@@ -689,14 +816,17 @@ stack::subnet *server::getPolicy(const struct sockaddr *addr)
     assert(cfg != NULL);
 
     stack::subnet *policy;
+    server *cfgp = static_cast<server*>(pin());
 
-    if(!cfg)
+    if(!cfgp)
         return NULL;
 
-    locking.access();
-    policy = (stack::subnet *)cidr::find(((server *)(cfg))->acl, addr);
+    if(cfgp->policies)
+        policy = cfgp->policies->find(addr);
+    else
+        policy = (stack::subnet *)cidr::find(cfgp->acl, addr);
     if(!policy)
-        locking.release();
+        unpin();
     return policy;
 }
 
@@ -709,7 +839,7 @@ profile_t *server::getProfile(const char *pro)
     linked_pointer<profile> pp;
     profile_t *ppd = NULL;
 
-    cfgp = static_cast<server*>(cfg);
+    cfgp = static_cast<server*>(pin());
     if(!cfgp) {
         return NULL;
     }
@@ -722,6 +852,9 @@ profile_t *server::getProfile(const char *pro)
             break;
         pp.next();
     }
+    // profiles remain valid past a reload while the prior generation
+    // is retained, so callers may copy from the result unpinned...
+    unpin();
     if(!ppd && !*pp) {
         return NULL;
     }
@@ -732,13 +865,7 @@ profile_t *server::getProfile(const char *pro)
 
 service::keynode *server::getConfig(void)
 {
-    locking.access();
-    if(!cfg) {
-        locking.release();
-        return NULL;
-    }
-
-    return (keynode *)cfg;
+    return (keynode *)pin();
 }
 
 Socket::address *server::getContact(const char *cuid)
@@ -767,6 +894,7 @@ service::keynode *server::getRouting(const char *id)
     assert(cfg != NULL);
 
     linked_pointer<keynode> node;
+    dialplan::match *mp;
     const char *cp;
 
     // never re-route in-dialing nodes...
@@ -774,11 +902,19 @@ service::keynode *server::getRouting(const char *id)
     if(registry::isExtension(id))
         return NULL;
 
-    if(!cfg)
+    server *cfgp = static_cast<server*>(pin());
+    if(!cfgp)
+        return NULL;
+
+    if(cfgp->routing && cfgp->routing->find(id, &mp)) {
+        if(mp)
+            return (keynode *)mp->object;
+        unpin();
         return NULL;
+    }
 
-    locking.access();
-    node = cfg->getList("routing");
+    // too many wildcard branches active, so walk the patterns...
+    node = cfgp->getList("routing");
     while(is(node)) {
         cp = getValue(*node, "pattern");
         if(cp && match(id, cp, false))
@@ -789,7 +925,7 @@ service::keynode *server::getRouting(const char *id)
             return *node;
         node.next();
     }
-    locking.release();
+    unpin();
     return NULL;
 }
 
@@ -800,14 +936,12 @@ bool server::checkId(const char *cuid)
     keynode *node = NULL;
     server *cfgp;
 
-    locking.access();
-    cfgp = static_cast<server*>(cfg);
-    if(!cfgp) {
-        locking.release();
+    cfgp = static_cast<server*>(pin());
+    if(!cfgp)
         return false;
-    }
+
     node = cfgp->find(cuid);
-    locking.release();
+    unpin();
     if(node)
         return true;
     return false;
@@ -827,12 +961,10 @@ void server::getDialing(const char *cuid, usernode& user)
 
     server::release(user);
 
-    locking.access();
-    cfgp = static_cast<server*>(cfg);
-    if(!cfgp) {
-        locking.release();
+    cfgp = static_cast<server*>(pin());
+    if(!cfgp)
         return;
-    }
+
     node = cfgp->find(cuid);
     if(node)
         leaf = node->leaf("extension");
@@ -843,7 +975,7 @@ void server::getDialing(const char *cuid, usernode& user)
         node = cfgp->extmap[ext - prefix];
 
     if(!node)
-        locking.release();
+        unpin();
     user.keys = node;
 }
 
@@ -860,17 +992,15 @@ void server::getProvision(const char *cuid, usernode& user)
 
     server::release(user);
 
-    locking.access();
-    cfgp = static_cast<server*>(cfg);
-    if(!cfgp) {
-        locking.release();
+    cfgp = static_cast<server*>(pin());
+    if(!cfgp)
         return;
-    }
+
     node = cfgp->find(cuid);
     if(!node && range && ext >= prefix && ext < prefix + range)
         node = cfgp->extmap[ext - prefix];
     if(!node)
-        locking.release();
+        unpin();
     user.keys = node;
 }
 
@@ -895,8 +1025,13 @@ void server::dump(FILE *fp)
 
     fprintf(fp, "Server:\n");
     fprintf(fp, "  allocated pages: %d\n", server::allocate());
-    fprintf(fp, "  configure pages: %d\n", cfg->pages());
+    fprintf(fp, "  configure pages: %d\n", pages());
     fprintf(fp, "  memory paging:   %ld\n", (long)PAGING_SIZE);
+    fprintf(fp, "  huge page pool:  %s, %ld of %ld bytes used\n", hugetype, (long)hugeused, (long)hugesize);
+    if(routing)
+        fprintf(fp, "  routing patterns: %d, nodes: %d\n", routing->getPatterns(), routing->getNodes());
+    if(policies)
+        fprintf(fp, "  policy nodes: %d\n", policies->getNodes());
     keynode *reg = getPath("registry");
     if(reg && reg->getFirst()) {
         fprintf(fp, "  registry keys:\n");
@@ -980,24 +1115,82 @@ void server::reload(void)
             shell::log(shell::ERR, "cannot load provisioning cache");
     }
 
-    // scan for user records individually also...
+    // scan for user records individually also.  These are parsed in
+    // parallel into private trees, and spliced in filename order...
     const char *dirpath = _STR(control::path("cache"));
     char filename[65];
     dir_t dir(dirpath);
+    memalloc names(PAGING_SIZE);
+    OrderedIndex found;
+    linked_pointer<userfile> up;
+    userfile *uf, **files;
+    userloader *loaders[USER_LOADERS];
+    service::keynode *leaf;
+    unsigned count = 0, pos, threads;
+    unsigned long scanning = timing::mstime(), parsing, splicing, opening = 0, loading = 0;
+    size_t dirlen = strlen(dirpath) + 1;
+
     while(node && is(dir) && dir.read(filename, sizeof(filename)) > 0) {
         const char *ext = strrchr(filename, '.');
         if(!ext || !String::equal(ext, ".xml"))
             continue;
         if(!String::equal(filename, "user-", 5))
-            continue; 
-        snprintf(buf, sizeof(buf), "%s/%s", dirpath, filename);
-        fp = fopen(buf, "r");
-        if(!fp)
             continue;
-        if(!cfgp->load(fp, node))
-            shell::log(shell::ERR, "cannot load user cache %s", filename);
+        snprintf(buf, sizeof(buf), "%s/%s", dirpath, filename);
+        uf = (userfile *)names.alloc(sizeof(userfile));
+        new(uf) userfile();
+        uf->path = names.dup(buf);
+        uf->id = uf->path + dirlen;
+        uf->tree = NULL;
+        uf->enlistTail(&found);
+        ++count;
     }
     dir.close();
+    scanning = timing::mstime() - scanning;
+
+    if(count) {
+        files = (userfile **)names.alloc(sizeof(userfile *) * count);
+        pos = 0;
+        up = found.begin();
+        while(is(up)) {
+            files[pos++] = *up;
+            up.next();
+        }
+        qsort(files, count, sizeof(userfile *), &usercompare);
+
+        threads = count / 32 + 1;
+        if(threads > USER_LOADERS)
+            threads = USER_LOADERS;
+
+        parsing = timing::mstime();
+        loadnext = 0;
+        for(pos = 0; pos < threads; ++pos) {
+            loaders[pos] = new userloader(files, count);
+            loaders[pos]->start();
+        }
+        for(pos = 0; pos < threads; ++pos) {
+            loaders[pos]->wait();
+            opening += loaders[pos]->opening;
+            loading += loaders[pos]->loading;
+            cfgp->heaps[pos] = loaders[pos]->heap;
+            delete loaders[pos];
+        }
+        parsing = timing::mstime() - parsing;
+
+        splicing = timing::mstime();
+        for(pos = 0; pos < count; ++pos) {
+            if(!files[pos]->tree)
+                continue;
+            while(NULL != (leaf = files[pos]->tree->getFirst()))
+                leaf->relistTail(node);
+        }
+        splicing = timing::mstime() - splicing;
+
+        shell::log(shell::INFO, "loaded %u user caches with %u threads in %lu msec",
+            count, threads, scanning + parsing + splicing);
+        shell::log(shell::INFO, "user cache scan %lu, open %lu, read/parse %lu, splice %lu msec",
+            scanning, opening, loading, splicing);
+    }
 
     node = cfgp->getPath("provider");
     if(node)
@@ -1027,6 +1220,66 @@ unsigned server::allocate(void)
     return mempool.pages();
 }
 
+// the huge page pool is carved before the mempool is used, and once it is
+// used up, further objects come from the mempool as before.
+static void *hugealloc(size_t size)
+{
+    void *mp = NULL;
+
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    hugelock.acquire();
+    if(hugeused + size <= hugesize) {
+        mp = hugepool + hugeused;
+        hugeused += size;
+    }
+    hugelock.release();
+    return mp;
+}
+
+void server::hugepages(size_t size)
+{
+    hugemaps = true;
+    size = (size + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1);
+    if(!size || hugepool)
+        return;
+
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS)
+    void *mp = MAP_FAILED;
+
+#ifdef  MAP_HUGETLB
+    mp = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(mp != MAP_FAILED)
+        hugetype = "hugetlb";
+#endif
+
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+    if(mp == MAP_FAILED) {
+        mp = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mp != MAP_FAILED && madvise(mp, size, MADV_HUGEPAGE)) {
+            munmap(mp, size);
+            mp = MAP_FAILED;
+        }
+        if(mp != MAP_FAILED)
+            hugetype = "transparent";
+    }
+#endif
+
+    if(mp != MAP_FAILED) {
+        hugepool = (caddr_t)mp;
+        hugesize = size;
+        shell::log(DEBUG1, "huge page pool of %ld bytes; %s", (long)size, hugetype);
+        return;
+    }
+#endif
+
+    shell::log(shell::WARN, "huge pages unavailable; using normal pages");
+}
+
+bool server::hugepages(void)
+{
+    return hugemaps;
+}
+
 void *server::allocate(size_t size, LinkedObject **list, volatile unsigned *count)
 {
     assert(size > 0);
@@ -1038,7 +1291,11 @@ void *server::allocate(size_t size, LinkedObject **list, volatile unsigned *coun
     else {
         if(count)
             ++(*count);
-        mp = mempool.alloc(size);
+        mp = NULL;
+        if(hugepool)
+            mp = hugealloc(size);
+        if(!mp)
+            mp = mempool.alloc(size);
     }
     memset(mp, 0, size);
     return mp;
@@ -1111,6 +1368,9 @@ void server::run(void)
     // initial load of digest cache
     digests::load();
 
+    // registrations kept by a prior instance, now that we are listening
+    registry::restore();
+
     printlog("server starting %s\n", (const char *)logtime);
 
     while(running && NULL != (cp = control::receive())) {
@@ -1230,6 +1490,20 @@ void server::run(void)
             continue;
         }
 
+        if(eq(argv[0], "capture")) {
+            if(argc != 2)
+                goto invalid;
+            if(!stricmp(argv[1], "on"))
+                stack::enableCapture();
+            else if(!stricmp(argv[1], "off"))
+                stack::disableCapture();
+            else if(!stricmp(argv[1], "clear"))
+                stack::clearCapture();
+            else
+                goto invalid;
+            continue;
+        }
+
         if(eq(argv[0], "uid")) {
             if(argc != 2) {
 invalid:
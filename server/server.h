@@ -38,12 +38,17 @@
 namespace sipwitch {
 
 #define PAGING_SIZE (2048l * sizeof(void *))
+#define MAX_SDP_SIZE    4096
+#define HUGEPAGE_SIZE   (2048l * 1024l)
+#define USER_LOADERS    8
+#define HUNT_MEMBERS    32
 
 #define ALLOWS_INVITE       0x0001
 #define ALLOWS_MESSAGE      0x0002
 #define ALLOWS_DEFAULT      0x0003
 
 class thread;
+class benchmark;
 
 typedef enum {EXTERNAL, LOCAL, PUBLIC, ROUTED, FORWARDED, REDIRECTED} destination_t;
 
@@ -56,12 +61,81 @@ public:
 
     static bool set(const char *id, const char *hash);
 
+    static void clear(const char *id);
+
     static void release(const char *hash);
 
     static void load(void);
 };
 
-class __LOCAL registry : private service::callback, private mapped_array<MappedRegistry>
+// size classed slabs for per-call strings, such as the sdp of a session...
+class __LOCAL arena
+{
+public:
+    static char *dup(const char *text);
+
+    static char *set(char **text, const char *value);
+
+    static void release(char *text);
+
+    static void snapshot(FILE *fp);
+};
+
+// dialing patterns compiled into a trie, with wildcard symbols as their
+// own branches, so a lookup is one pass over the dialed digits...
+class __LOCAL dialplan
+{
+public:
+    class __LOCAL match : public LinkedObject
+    {
+    public:
+        void *object;
+        const char *text;
+        unsigned level;         // higher levels are preferred
+        unsigned rank;          // then lower ranks
+        bool identity;          // exact id, not a pattern
+    };
+
+    dialplan(memalloc *heap = NULL);
+
+    void add(const char *pattern, void *object, unsigned level, unsigned rank);
+    void assign(const char *identity, void *object, unsigned rank);
+    void remove(const char *pattern, void *object);
+    bool find(const char *id, match **result, unsigned levels = 0);
+    bool find(const char *id, match **list, unsigned size, unsigned *count, unsigned levels = 0);
+
+    inline unsigned getPatterns(void) const
+        {return patterns;}
+
+    inline unsigned getNodes(void) const
+        {return nodes;}
+
+private:
+    class __LOCAL node : public LinkedObject
+    {
+    public:
+        node *child[17];
+        LinkedObject *matches;
+        unsigned refs;
+    };
+
+    memalloc *heap;
+    node *root;
+    node *suffix[32];
+    LinkedObject *exact[CONFIG_KEY_SIZE];
+    LinkedObject *freenodes;
+    LinkedObject *freematches;
+    unsigned patterns;
+    unsigned nodes;
+
+    void *alloc(size_t size, LinkedObject **list);
+    void release(void *obj, LinkedObject **list);
+    bool step(node *np, char digit, node **list, unsigned *count);
+    void collect(node *np, bool skip, match **result, unsigned levels, unsigned *found, unsigned size);
+    bool walk(node *start, const char *digits, unsigned len, match **result, unsigned levels, unsigned *found = NULL, unsigned size = 0);
+};
+
+class __LOCAL registry : private service::callback, private segmented_array<MappedRegistry>
 {
 public:
     class __LOCAL mapped : public MappedRegistry
@@ -143,6 +217,8 @@ public:
     };
 
 private:
+    friend class benchmark;
+
     class __LOCAL route : public LinkedObject
     {
     public:
@@ -161,6 +237,8 @@ private:
     static void clear(mapped *rr);
     static void expire(mapped *rr);
     static mapped *find(const char *id);
+    static mapped *populate(const char *id);
+    static mapped *claim(void);
 
     static registry reg;
 
@@ -171,6 +249,7 @@ private:
     unsigned prefix;
     unsigned range;
     unsigned routes;
+    unsigned saving;
 
 public:
     registry();
@@ -195,6 +274,7 @@ public:
 
     static const char *getDomain(void);
     static void incUse(mapped *rr, stats::stat_t stat);
+    static bool reserve(mapped *rr, stats::stat_t stat);
     static void decUse(mapped *rr, stats::stat_t stat);
     static unsigned getEntries(void);
     static unsigned getIndex(mapped *rr);
@@ -209,15 +289,19 @@ public:
     static mapped *invite(const char *id, stats::stat_t stat);
     static mapped *dialing(const char *id);
     static bool exists(const char *id);
-    static pattern *getRouting(unsigned trs, const char *id);
+    static pattern *getRouting(unsigned trs, const char *id, bool *busy = NULL);
     static void detach(mapped *m);
     static bool remove(const char *id);
     static unsigned cleanup(time_t period);
+    static void checkpoint(bool force = false);
+    static void restore(void);
 };
 
-class __LOCAL stack : public service::callback, private mapped_array<MappedCall>, public OrderedIndex
+class __LOCAL stack : public service::callback, private segmented_array<MappedCall>, public OrderedIndex
 {
 private:
+    using segmented_array<MappedCall>::count;
+
     friend class proxy;
     friend class thread;
     friend class messages;
@@ -262,7 +346,7 @@ private:
 
         enum {OPEN, CLOSED, RING, BUSY, REORDER, REFER, REINVITE} state;
 
-        char sdp[MAX_SDP_BUFFER];       // sdp body to use in exchange
+        char *sdp;                      // sdp body to use in exchange
         char identity[MAX_URI_SIZE];    // our effective contact/to point...
         char sysident[MAX_IDENT_SIZE];  // ident of this session
         char display[MAX_DISPLAY_SIZE]; // callerid reference field
@@ -273,10 +357,6 @@ private:
         LinkedObject *nat;              // media nat chain...
         struct sockaddr_storage peering;
 
-        char authid[MAX_USERID_SIZE];   // for authentication...
-        char secret[MAX_USERID_SIZE];
-        enum {NONE, DIGEST} authtype;
-
         inline bool isSource(void) const
             {return (this == parent->source);}
 
@@ -338,6 +418,10 @@ private:
         cdr *log(void);
         void bye(thread *thread, session *s);
         void set(state_t state, char id, const char *text);
+        void pin(void);
+        bool unpin(void);
+        bool remove(void);
+        bool reapable(void);
 
         OrderedIndex segments;
         const char *reason;
@@ -357,12 +441,44 @@ private:
         time_t expires, starting, ending;
         int experror;           // error at expiration...
         bool phone;
+        unsigned pins;          // event threads using the call
+        bool removed;           // destroyed, freed once unpinned
+        char *hunting;          // group members left to hunt, in order
+        char *resolving;        // remote target parked on a cold dns miss
+        char *credentials;      // digest to use for the parked target
+        unsigned ringtime;      // seconds to ring each hunted member
+        mutex_t pinning;
 
         static void *operator new(size_t size);
         static void operator delete(void *obj);
 
     private:
         void expired(void);
+        void resolve(void);
+    };
+
+    // branches of a forked invite share the work that does not depend on
+    // the target, so each further branch only builds and sends its invite.
+    class __LOCAL fanout
+    {
+    public:
+        fanout(session *s);
+
+        int invite(registry::mapped *rr, destination_t dest);
+
+        unsigned branches;      // invites sent
+
+    private:
+        session *source;
+        call *cr;
+        time_t now;
+        char expheader[32];
+        char seqid[64];
+        char network[MAX_NETWORK_SIZE];
+        char *rewritten;        // sdp for network if it can be shared
+        char sdp[MAX_SDP_SIZE];
+
+        const char *offer(const char *target, LinkedObject **nat);
     };
 
     void reload(service *cfg);
@@ -387,13 +503,16 @@ private:
     String agent;
     String system;
     String anon;
-    bool incoming, outgoing, dumping;
+    bool incoming, outgoing, dumping, capturing;
     int send101;
     timeout_t ring_timer, cfna_timer, reset_timer;
     unsigned invite_expires;
 
     void release(void);
 
+    static void unhash(session *s);
+    static void reap(void);
+
 public:
     static stack sip;
 
@@ -447,10 +566,13 @@ public:
     static char *sipPublish(struct sockaddr_internet *addr, char *buf, const char *user = NULL, size_t size = MAX_URI_SIZE);
     static char *sipContact(struct sockaddr_internet *addr, char *buf, const char *user = NULL, const char *display = NULL, size_t size = MAX_URI_SIZE);
     static Socket::address *getAddress(const char *uri, Socket::address *addr = NULL);
-    static void siplog(voip::msg_t msg);
+    static void siplog(voip::msg_t msg, bool outbound = false);
     static void enableDumping(void);
     static void clearDumping(void);
     static void disableDumping(void);
+    static void enableCapture(void);
+    static void clearCapture(void);
+    static void disableCapture(void);
     static void refer(session *session, voip::event_t sevent);
     static void infomsg(session *session, voip::event_t sevent);
     static void setDialog(session *session, voip::did_t did);
@@ -458,8 +580,10 @@ public:
     static void release(MappedCall *map);
     static MappedCall *get(void);
     static bool forward(stack::call *cr);
-    static int inviteRemote(stack::session *session, const char *uri, const char *digest = NULL);
+    static int inviteRemote(stack::session *session, const char *uri, const char *digest = NULL, bool deferred = false);
     static int inviteLocal(stack::session *session, registry::mapped *rr, destination_t dest);
+    static int inviteGroup(stack::session *session, service::keynode *group);
+    static bool hunt(stack::call *cr);
 
     inline static timeout_t ringTimeout(void)
         {return stack::sip.ring_timer;}
@@ -474,15 +598,44 @@ public:
         {return stack::sip.invite_expires;}
 };
 
+// access policies indexed by network bits for longest prefix lookups...
+class __LOCAL policymap
+{
+public:
+    policymap(memalloc *heap);
+
+    bool add(stack::subnet *entry);
+    stack::subnet *find(const struct sockaddr *addr);
+
+    inline unsigned getNodes(void) const
+        {return nodes;}
+
+private:
+    class __LOCAL node
+    {
+    public:
+        node *child[2];
+        stack::subnet *entry;
+    };
+
+    memalloc *heap;
+    node *ipv4;
+    node *ipv6;
+    unsigned nodes;
+};
+
 class __LOCAL server : public service
 {
 private:
     typedef linked_value<profile_t, LinkedObject> profile;
 
     cidr::policy *acl;
+    policymap *policies;
     keynode **extmap;
     keynode *provision;
     LinkedObject *profiles;
+    dialplan *routing;
+    service *heaps[USER_LOADERS];
 
     bool create(const char *id, keynode *node);
     keynode *find(const char *id);
@@ -498,6 +651,7 @@ public:
     static int exit_code;
 
     server(const char *id);
+    ~server();
 
     static bool check(void);
     static profile_t *getProfile(const char *id);
@@ -519,6 +673,8 @@ public:
     static void stop(void);
     static void *allocate(size_t size, LinkedObject **list, volatile unsigned *count = NULL);
     static unsigned allocate(void);
+    static void hugepages(size_t size);
+    static bool hugepages(void);
 
     static bool announce(MappedRegistry *rr, const char *msgtype, const char *event, const char *expires, const char *body);
     static void activate(MappedRegistry *rr);
@@ -567,6 +723,59 @@ public:
     static int system(const char *to, const char *message);
 };
 
+// registration admission control, to pace registration storms...
+class __LOCAL admission
+{
+private:
+    class __LOCAL bucket : public LinkedObject
+    {
+    public:
+        struct sockaddr_internet address;
+        char network[MAX_NETWORK_SIZE];
+        unsigned long tokens;       // in thousandths of a request
+        unsigned long stamp;        // msec when last refilled
+        unsigned long horizon;      // msec next deferred request may return
+        unsigned long rejects;
+    };
+
+    static bool take(bucket *bp, unsigned rate, unsigned burst, unsigned long now, unsigned *retry);
+    static bucket *source(const struct sockaddr *addr, unsigned long now);
+    static bucket *network(const char *id);
+
+public:
+    static bool admit(const struct sockaddr *addr, stack::subnet *access, unsigned *retry);
+    static void limit(unsigned srate, unsigned sburst, unsigned nrate, unsigned nburst, unsigned retry, unsigned count);
+    static void snapshot(FILE *fp);
+};
+
+// outbound tcp and tls trunks kept connected by background pings...
+class __LOCAL trunks
+{
+private:
+    class __LOCAL trunk : public LinkedObject
+    {
+    public:
+        time_t next;                // when the next ping is due
+        time_t sent;                // ping outstanding, 0 if none
+        time_t replied;             // last reply, 0 if never
+        unsigned failures;          // pings missed in a row
+        unsigned long pings, replies, missed, reconnects, reused;
+        bool online;
+        char callid[64];
+        char uri[MAX_URI_SIZE];     // as configured
+        char route[MAX_URI_SIZE];   // as last resolved
+    };
+
+    static trunk *find(const char *uri);
+    static void failed(trunk *tp, time_t now);
+
+public:
+    static void configure(const char *list, unsigned ping);
+    static void automatic(void);
+    static bool answered(voip::event_t ev);
+    static void used(const char *route);
+    static void snapshot(FILE *fp);
+};
 
 class __LOCAL thread : private DetachedThread
 {
@@ -618,12 +827,15 @@ private:
 
     static void wait(unsigned count);
     static const char *eid(eXosip_event_type ev);
+    static voip::event_t dispatch(voip::context_t ctx, const char *tag, timeout_t timeout);
+    static void flush(voip::context_t ctx);
 
     void send_reply(int error);
     void expiration(void);
     void invite(void);
     void identify(void);
     bool getsource(void);
+    const char *getorigin(void);
     bool unauthenticated(void);
     bool authenticate(void);
     bool authenticate(stack::session *session);
@@ -642,6 +854,8 @@ private:
 
 public:
     static void shutdown(void);
+    static void overload(timeout_t budget, unsigned backlog);
+    static void snapshot(FILE *fp);
 };
 
 // media proxy support for NAT transversal is being moved to here...
@@ -664,13 +878,13 @@ public:
         void run(void);
     };
 
-    // a support class to help in sdp parsing
-    class __LOCAL sdp
+    // sdp rewriter that proxies connection addresses
+    class __LOCAL sdp : public sdpfilter
     {
+    protected:
+        bool connect(unsigned family, const char *address, size_t size);
+
     public:
-        const char *bufdata;
-        char *outdata, *result;
-        size_t buflen, outpos;
         struct sockaddr *peering;
         struct sockaddr_storage local, top;
         LinkedObject **nat;
@@ -678,19 +892,11 @@ public:
         unsigned short mediaport;
 
         sdp();
-        sdp(const char *source, char *target, size_t len = MAX_SDP_BUFFER);
+        sdp(const char *source, char *target, size_t len);
 
         inline struct sockaddr *get(void)
             {return (struct sockaddr *)&local;}
 
-        void set(const char *source, char *target, size_t len = MAX_SDP_BUFFER);
-        char *get(char *buffer, size_t len);
-        size_t put(char *buffer);
-
-        // check connect in sdp output
-        void check_connect(char *buffer, size_t len);
-        void check_media(char *buffer, size_t len);
-
         // can do backfill of NAT if connect in media record
         void reconnect(void);
     };
@@ -733,7 +939,7 @@ public:
     static void release(LinkedObject **nat, unsigned expires = 0);
 
     // rewrite an invite for a call target if different, otherwise uses original source sdp...
-    static char *invite(stack::session *session, const char *target, LinkedObject **nat, char *sdp, size_t size = MAX_SDP_BUFFER);
+    static char *invite(stack::session *session, const char *target, LinkedObject **nat, char *sdp, size_t size = MAX_SDP_SIZE);
 
     // rewrite or copy sdp of session on answer for connection
     static char *answer(stack::session *session, const char *sdp);
@@ -742,6 +948,8 @@ public:
     static char *reinvite(stack::session *session, const char *sdp);
 
 private:
+    friend class benchmark;
+
     // low level rewrite & proxy assignment
     static char *rewrite(media::sdp *parser);
 
@@ -751,15 +959,62 @@ private:
     void release(void);
 };
 
-class __LOCAL history : public OrderedObject, public control
+// timing of hot paths against a running configuration, reported as csv...
+class __LOCAL benchmark
 {
+private:
+    typedef void (*method_t)(unsigned long index);
+
+    static void measure(FILE *fp, const char *id, unsigned size, method_t method);
+    static void registries(FILE *fp);
+    static void sessions(FILE *fp);
+    static void parsers(FILE *fp);
+    static void caches(FILE *fp);
+
+    static void find(unsigned long index);
+    static void access(unsigned long index);
+    static void address(unsigned long index);
+    static void session(unsigned long index);
+    static void match(unsigned long index);
+    static void route(unsigned long index);
+    static void userid(unsigned long index);
+    static void hostid(unsigned long index);
+    static void portid(unsigned long index);
+    static void rewrite(unsigned long index);
+    static void filter(unsigned long index);
+    static void lines(unsigned long index);
+    static void assign(unsigned long index);
+    static void cached(unsigned long index);
+    static void digest(unsigned long index);
+
 public:
-    char text[128];
+    static void run(FILE *fp);
+};
 
-    history(shell::loglevel_t lid, const char *msg);
+// log lines kept in a ring that threads write without locking...
+class __LOCAL history : public control
+{
+private:
+    class __LOCAL record
+    {
+    public:
+        volatile uint64_t sequence;     // 2n+1 writing line n, 2n+2 once written
+        char text[128];
+    };
 
-    void set(shell::loglevel_t lid, const char *msg);
+    class __LOCAL ring
+    {
+    public:
+        ring *prior;
+        unsigned limit;
+        record slots[1];
+    };
 
+    static ring *volatile current;
+    static ring *rings;
+    static volatile uint64_t counter;
+
+public:
     static void add(shell::loglevel_t lid, const char *msg);
     static void set(unsigned size);
     static void out(void);
@@ -24,13 +24,29 @@ static volatile unsigned allocated_calls = 0;
 static volatile unsigned allocated_maps = 0;
 static volatile unsigned active_calls = 0;
 static unsigned mapped_calls = 0;
+static unsigned mapped_segments = 8;
 static LinkedObject *freesegs = NULL;
 static LinkedObject *freecalls = NULL;
 static LinkedObject *freemaps = NULL;
-static LinkedObject **hash = NULL;
 static unsigned keysize = 177;
 static condlock_t locking;
 static mutex_t mapping;
+static mutex_t allocating;
+static volatile bool reaping = false;
+
+// sessions are hashed by cid into shards, each with its own lock, so that
+// events for unrelated calls never wait on each other to find a session.
+class __LOCAL shard
+{
+public:
+    mutex_t lock;
+    LinkedObject *sessions;
+
+    inline shard()
+        {sessions = NULL;}
+};
+
+static shard *hash = NULL;
 
 stack::background *stack::background::thread = NULL;
 
@@ -145,7 +161,6 @@ stack::segment::segment(voip::context_t context, call *cr, int cid, int did, int
     time(&now);
     enlist(&(cr->segments));
     sid.context = context;
-    sid.enlist(&hash[cid % keysize]);
     sid.sequence = (uint32_t)now;
     sid.sequence &= 0xffffffffl;
     sid.expires = 0l;
@@ -155,11 +170,19 @@ stack::segment::segment(voip::context_t context, call *cr, int cid, int did, int
     sid.tid = tid;
     sid.parent = cr;
     sid.state = session::OPEN;
-    sid.sdp[0] = 0;
+    sid.sdp = NULL;
     sid.reg = NULL;
     sid.closed = false;
 
     secure::uuid(sid.uuid);
+
+    // only findable once complete, and the first is the call source...
+    if(!cr->source)
+        cr->source = &sid;
+    shard *sh = &hash[cid % keysize];
+    sh->lock.acquire();
+    sid.enlist(&sh->sessions);
+    sh->lock.release();
 }
 
 void *stack::segment::operator new(size_t size)
@@ -253,6 +276,8 @@ void stack::background::run(void)
             // release lock in case expire calls update timer methods...
             Conditional::unlock();
             timeout = interval;
+            if(reaping)
+                stack::reap();
             locking.access();
             linked_pointer<stack::call> cp = stack::sip.begin();
             while(cp) {
@@ -278,13 +303,15 @@ void stack::background::run(void)
                 shell::debug(9, "registry cleanup; %d expired", released);
             else
                 shell::debug(9, "registry cleanup; no entries expired");
+            registry::checkpoint();
         }
         messages::automatic();
+        trunks::automatic();
     }
 }
 
 stack::stack() :
-service::callback(1), mapped_array<MappedCall>(), OrderedIndex()
+service::callback(1), segmented_array<MappedCall>(), OrderedIndex()
 {
     stacksize = 0;
     threading = 2;
@@ -293,6 +320,7 @@ service::callback(1), mapped_array<MappedCall>(), OrderedIndex()
     iface = NULL;
     send101 = 1;
     dumping = false;
+    capturing = false;
     incoming = false;
     outgoing = false;
     agent = "sipwitch-" VERSION "/eXosip";
@@ -328,17 +356,110 @@ void stack::enableDumping(void)
     stack::sip.dumping = true;
 }
 
-void stack::siplog(voip::msg_t msg)
+void stack::disableCapture(void)
+{
+    stack::sip.capturing = false;
+}
+
+void stack::clearCapture(void)
+{
+    ::remove(control::env("captures"));
+}
+
+// a capture is appended to until it is explicitly cleared, so turning
+// it back on does not lose what was already recorded.
+void stack::enableCapture(void)
+{
+    stack::sip.capturing = true;
+}
+
+// the remote party of a captured message; requests we receive and
+// responses we send are addressed by the top via, requests we send by
+// their request uri.  Responses we receive have no record of the peer.
+static void peer(voip::msg_t msg, bool outbound, char *host, size_t size, unsigned *port)
+{
+    voip::via_t via = NULL;
+    voip::param_t param = NULL;
+
+    String::set(host, size, "-");
+    *port = 0;
+
+    if(MSG_IS_RESPONSE(msg) && !outbound)
+        return;
+
+    if(MSG_IS_REQUEST(msg) && outbound) {
+        if(!msg->req_uri || !msg->req_uri->host)
+            return;
+        String::set(host, size, msg->req_uri->host);
+        *port = 5060;
+        if(msg->req_uri->port)
+            *port = atoi(msg->req_uri->port);
+        return;
+    }
+
+    osip_message_get_via(msg, 0, &via);
+    if(!via || !via->host)
+        return;
+
+    String::set(host, size, via->host);
+    *port = 5060;
+    if(via->port)
+        *port = atoi(via->port);
+
+    osip_via_param_get_byname(via, (char *)"rport", &param);
+    if(param != NULL && param->gvalue != NULL)
+        *port = atoi(param->gvalue);
+
+    param = NULL;
+    osip_via_param_get_byname(via, (char *)"received", &param);
+    if(param != NULL && param->gvalue != NULL)
+        String::set(host, size, param->gvalue);
+}
+
+// each captured message is preceded by a record header of the form
+// "@<dir> <msec> <host> <port> <length>", where dir is '<' for messages
+// we received and '>' for messages we sent, so sipreplay can find the
+// next record without having to parse sip itself.
+static void capture(voip::msg_t msg, const char *text, size_t tlen, bool outbound)
+{
+    fsys_t log;
+    char host[MAX_URI_SIZE];
+    char header[MAX_URI_SIZE + 64];
+    unsigned port;
+    int len;
+
+    peer(msg, outbound, host, sizeof(host), &port);
+    len = snprintf(header, sizeof(header), "@%c %lu %s %u %lu\n",
+        outbound ? '>' : '<', timing::mstime(), host, port, (unsigned long)tlen);
+
+    log.open(control::env("captures"), fsys::GROUP_PRIVATE, fsys::APPEND);
+    if(is(log)) {
+        Mutex::protect(&stack::sip.capturing);
+        log.write(header, len);
+        log.write(text, tlen);
+        log.write("\n", 1);
+        Mutex::release(&stack::sip.capturing);
+        log.close();
+    }
+}
+
+void stack::siplog(voip::msg_t msg, bool outbound)
 {
     fsys_t log;
     char *text = NULL;
     size_t tlen;
 
-    if(!msg || !stack::sip.dumping)
+    if(!msg || (!stack::sip.dumping && !stack::sip.capturing))
         return;
 
     osip_message_to_str(msg, &text, &tlen);
-    if(text) {
+    if(!text)
+        return;
+
+    if(stack::sip.capturing)
+        capture(msg, text, tlen, outbound);
+
+    if(stack::sip.dumping) {
         log.open(control::env("siplogs"), fsys::GROUP_PRIVATE, fsys::APPEND);
         if(is(log)) {
             Mutex::protect(&stack::sip.dumping);
@@ -347,8 +468,8 @@ void stack::siplog(voip::msg_t msg)
             Mutex::release(&stack::sip.dumping);
             log.close();
         }
-        osip_free(text);
     }
+    osip_free(text);
 }
 
 void stack::close(session *s)
@@ -412,17 +533,15 @@ void stack::clear(session *s)
 
     if(s->cid > 0) {
         Mutex::release(cr);
-        locking.exclusive();
         shell::debug(4, "clearing call %08x:%u session %08x:%u\n",
             cr->source->sequence, cr->source->cid, s->sequence, s->cid);
+        unhash(s);
         if(s->state != session::CLOSED) {
             s->state = session::CLOSED;
             voip::release_call(s->context, s->cid, s->did);
         }
-        s->delist(&hash[s->cid % keysize]);
         s->cid = 0;
         s->did = -1;
-        locking.share();
     }
     else
         Mutex::release(cr);
@@ -552,56 +671,100 @@ void stack::disjoin(call *cr)
     }
 }
 
+void stack::unhash(session *s)
+{
+    assert(s != NULL && s->cid > 0);
+
+    shard *sh = &hash[s->cid % keysize];
+    sh->lock.acquire();
+    s->delist(&sh->sessions);
+    sh->lock.release();
+}
+
+// once its sessions are unhashed no new event can find the call, and it is
+// freed by the background thread when the last event using it detaches.
 void stack::destroy(call *cr)
 {
     assert(cr != NULL);
-    MappedCall *map;
 
-    linked_pointer<segment> sp;
+    linked_pointer<segment> sp = cr->segments.begin();
 
-    cdr *clog = cr->log();
+    cr->disarm();
+    while(sp) {
+        if(sp->sid.cid > 0)
+            unhash(&(sp->sid));
+        sp.next();
+    }
 
-    // we assume access lock was already held when we call this...
+    if(cr->remove()) {
+        reaping = true;
+        background::notify();
+    }
+}
 
-    locking.exclusive();
-    sp = cr->segments.begin();
-    while(sp) {
-        --active_segments;
-        segment *next = sp.getNext();
+void stack::reap(void)
+{
+    linked_pointer<call> cp;
+    linked_pointer<segment> sp;
+    call *next;
+    MappedCall *map;
+    cdr *clog;
 
-        if(!sp->sid.closed) {
-            if(&(sp->sid) == cr->source)
-                registry::decUse(sp->sid.reg, stats::INCOMING);
-            else
-                registry::decUse(sp->sid.reg, stats::OUTGOING);
-            sp->sid.closed = true;
+    locking.modify();
+    reaping = false;
+    cp = sip.begin();
+    while(cp) {
+        next = (call *)cp->getNext();
+        if(!cp->reapable()) {
+            cp = next;
+            continue;
         }
 
-        if(sp->sid.cid > 0) {
-            if(sp->sid.state != session::CLOSED) {
-                voip::release_call(sp->sid.context, sp->sid.cid, sp->sid.did);
+        clog = cp->log();
+        sp = cp->segments.begin();
+        while(sp) {
+            --active_segments;
+            segment *snext = sp.getNext();
+
+            if(!sp->sid.closed) {
+                if(&(sp->sid) == cp->source)
+                    registry::decUse(sp->sid.reg, stats::INCOMING);
+                else
+                    registry::decUse(sp->sid.reg, stats::OUTGOING);
+                sp->sid.closed = true;
             }
-            sp->sid.delist(&hash[sp->sid.cid % keysize]);
+
+            if(sp->sid.cid > 0 && sp->sid.state != session::CLOSED)
+                voip::release_call(sp->sid.context, sp->sid.cid, sp->sid.did);
+            if(sp->sid.nat)
+                media::release(&sp->sid.nat);
+            arena::release(sp->sid.sdp);
+            allocating.acquire();
+            delete *sp;
+            allocating.release();
+            sp = snext;
         }
-        if(sp->sid.nat)
-            media::release(&sp->sid.nat);
-        delete *sp;
-        sp = next;
-    }
-    map = cr->map;
-    cr->delist();
-    delete cr;
-    locking.share();
-    release(map);
-    if(clog)
-        cdr::post(clog);
+        map = cp->map;
+        arena::release(cp->hunting);
+        arena::release(cp->resolving);
+        arena::release(cp->credentials);
+        cp->delist();
+        delete *cp;
+        release(map);
+        if(clog)
+            cdr::post(clog);
+        cp = next;
+    }
+    locking.commit();
 }
 
 void stack::release(MappedCall *map)
 {
     if(map) {
+        map->changes.lock();
         String::set(map->state, sizeof(map->state), "-");
         map->created = map->active = 0;
+        map->changes.unlock();
         mapping.lock();
         map->enlist(&freemaps);
         mapping.release();
@@ -617,12 +780,13 @@ MappedCall *stack::get(void)
         map = (MappedCall *)freemaps;
         freemaps = map->getNext();
     }
-    else if(allocated_maps < mapped_calls)
+    else if(allocated_maps < sip.count() || sip.grow())
         map = sip(allocated_maps++);
     mapping.release();
     if(!map)
         return NULL;
 
+    map->changes.lock();
     String::set(map->state, sizeof(map->state), "iinit");
     map->active = 0;
     map->authorized[0] = 0;
@@ -630,6 +794,7 @@ MappedCall *stack::get(void)
     map->target[0] = 0;
 
     time(&map->created);
+    map->changes.unlock();
     return map;
 }
 
@@ -655,10 +820,12 @@ stack::session *stack::create(voip::context_t context, call *cr, voip::call_t ci
     assert(cr != NULL);
     assert(cid > 0);
 
-    locking.exclusive();
+    // the call is locked by the caller, as for the walkers of its segments,
+    // and the segment freelist may also be used by the background thread...
+    allocating.acquire();
     segment *sp = new segment(context, cr, cid);
     ++cr->invited;
-    locking.share();
+    allocating.release();
     return &sp->sid;
 }
 
@@ -676,38 +843,41 @@ stack::session *stack::create(voip::context_t context, voip::call_t cid, voip::d
 
     locking.modify();
     cr = new call;
-    sp = new segment(context, cr, cid, did, tid);    // after count set to 0!
-    cr->source = &(sp->sid);
     cr->map = map;
-
-    locking.share();
-    return cr->source;
+    cr->pin();
+    allocating.acquire();
+    sp = new segment(context, cr, cid, did, tid);    // after count set to 0!
+    allocating.release();
+    locking.commit();
+    return &(sp->sid);
 }
 
 stack::session *stack::access(voip::call_t cid)
 {
     assert(cid > 0);
 
+    shard *sh = &hash[cid % keysize];
     linked_pointer<session> sp;
 
-    locking.access();
-    sp = hash[cid % keysize];
+    sh->lock.acquire();
+    sp = sh->sessions;
     while(sp) {
         if(sp->cid == cid)
             break;
         sp.next();
     }
-    if(!sp) {
-        locking.release();
-        return NULL;
-    }
+    if(sp)
+        sp->parent->pin();
+    sh->lock.release();
     return *sp;
 }
 
 void stack::detach(session *s)
 {
-    if(s)
-        locking.release();
+    if(s && s->parent->unpin()) {
+        reaping = true;
+        background::notify();
+    }
 }
 
 void stack::start(service *cfg)
@@ -726,10 +896,10 @@ void stack::start(service *cfg)
     thread *thr;
     shell::log(DEBUG1, "starting sip stack v%d; %d maps", ver, mapped_calls);
 
-    mapped_array<MappedCall>::create(control::env("callmap"), mapped_calls);
+    huge(server::hugepages());
+    segmented_array<MappedCall>::create(control::env("callmap"), "sipwcal", CALL_VERSION, mapped_calls, mapped_segments);
     if(!sip)
         shell::log(shell::FAIL, "calls could not be mapped");
-    initialize();
 
 #ifdef  HAVE_TLS
     if(sip_tlsmode) {
@@ -823,8 +993,7 @@ void stack::stop(service *cfg)
     background::cancel();
     thread::shutdown();
     Thread::yield();
-    MappedMemory::release();
-    MappedMemory::remove(control::env("callmap"));
+    segmented_array<MappedCall>::release();
 }
 
 bool stack::check(void)
@@ -854,16 +1023,23 @@ void stack::snapshot(FILE *fp)
     linked_pointer<call> cp;
     fprintf(fp, "SIP:\n");
     locking.access();
-    fprintf(fp, "  mapped calls: %d\n", mapped_calls);
+    fprintf(fp, "  mapped calls: %d\n", sip.count());
+    fprintf(fp, "  mapped segments: %d of %d, %d huge paged\n", sip.size(), sip.limit(), sip.huge());
     fprintf(fp, "  active calls: %d\n", active_calls);
     fprintf(fp, "  active sessions: %d\n", active_segments);
     fprintf(fp, "  allocated calls: %d\n", allocated_calls);
     fprintf(fp, "  allocated sessions: %d\n", allocated_segments);
+    fprintf(fp, "  session shards: %d\n", keysize);
     cp = begin();
     while(cp) {
         cp.next();
     }
     locking.release();
+    arena::snapshot(fp);
+    thread::snapshot(fp);
+    admission::snapshot(fp);
+    trunks::snapshot(fp);
+    srv::snapshot(fp);
 }
 
 void stack::reload(service *cfg)
@@ -881,6 +1057,24 @@ void stack::reload(service *cfg)
     unsigned ring_value = 0;
     unsigned reset_value = 0;
 
+    unsigned dns_cache = 256;
+    unsigned dns_ttl = 300;
+    unsigned dns_negative = 30;
+    unsigned dns_stale = 30;
+
+    const char *trunk_list = NULL;
+    unsigned trunk_ping = 30;
+
+    unsigned reg_rate = 0;
+    unsigned reg_burst = 10;
+    unsigned net_rate = 0;
+    unsigned net_burst = 0;
+    unsigned reg_retry = 120;
+    unsigned reg_sources = 4096;
+
+    timeout_t latency = 250;
+    unsigned backlog = 1024;
+
     char buf[256];
     if(!gethostname(buf, sizeof(buf))) {
         String::add(buf, sizeof(buf), ", localhost, localhost.localdomainb");
@@ -905,6 +1099,8 @@ void stack::reload(service *cfg)
                 outgoing = tobool(value);
             else if(eq(key, "trace") || eq(key, "dumping"))
                 dumping = tobool(value);
+            else if(eq(key, "capture") || eq(key, "capturing"))
+                capturing = tobool(value);
             else if(eq(key, "keysize") && !is_configured())
                 keysize = atoi(value);
             else if(eq(key, "interface") && !is_configured()) {
@@ -962,6 +1158,8 @@ void stack::reload(service *cfg)
                 sip_port = atoi(value);
             else if(eq(key, "mapped") && !is_configured())
                 mapped_calls = atoi(value);
+            else if(eq(key, "segments") && !is_configured())
+                mapped_segments = atoi(value);
             else if(eq(key, "password") && !is_configured())
                 sip_tlspwd = strdup(value);
             else if(eq(key, "keyfile") && !is_configured())
@@ -980,6 +1178,34 @@ void stack::reload(service *cfg)
                 if(eq(value, "tls"))
                     sip_tlsmode = 1;
             }
+            else if(eq(key, "dnscache"))
+                dns_cache = atoi(value);
+            else if(eq(key, "dnsttl"))
+                dns_ttl = atoi(value);
+            else if(eq(key, "dnsnegative"))
+                dns_negative = atoi(value);
+            else if(eq(key, "dnsstale"))
+                dns_stale = atoi(value);
+            else if(eq(key, "regrate"))
+                reg_rate = atoi(value);
+            else if(eq(key, "regburst"))
+                reg_burst = atoi(value);
+            else if(eq(key, "netrate"))
+                net_rate = atoi(value);
+            else if(eq(key, "netburst"))
+                net_burst = atoi(value);
+            else if(eq(key, "regretry"))
+                reg_retry = atoi(value);
+            else if(eq(key, "regsources"))
+                reg_sources = atoi(value);
+            else if(eq(key, "trunks"))
+                trunk_list = value;
+            else if(eq(key, "trunkping"))
+                trunk_ping = atoi(value);
+            else if(eq(key, "latency"))
+                latency = atol(value);
+            else if(eq(key, "backlog"))
+                backlog = atoi(value);
         }
         sp.next();
     }
@@ -1003,6 +1229,11 @@ void stack::reload(service *cfg)
     localnames = localhosts;
     proxy = new_proxy;
 
+    srv::cache(dns_cache, dns_ttl, dns_negative, dns_stale);
+    admission::limit(reg_rate, reg_burst, net_rate, net_burst, reg_retry, reg_sources);
+    trunks::configure(trunk_list, trunk_ping);
+    thread::overload(latency, backlog);
+
     if(sip_family != AF_INET)
         media::enableIPV6();
 
@@ -1023,10 +1254,8 @@ void stack::reload(service *cfg)
 
     if(!mapped_calls)
         mapped_calls = registry::getEntries();
-    if(!hash) {
-        hash = new LinkedObject*[keysize];
-        memset(hash, 0, sizeof(LinkedObject *) * keysize);
-    }
+    if(!hash)
+        hash = new shard[keysize];
 }
 
 const char *stack::getScheme(void)
@@ -1245,7 +1474,7 @@ void stack::divert(stack::call *call, voip::msg_t invite)
     }
 }
 
-int stack::inviteRemote(stack::session *s, const char *uri_target, const char *digest)
+int stack::inviteRemote(stack::session *s, const char *uri_target, const char *digest, bool deferred)
 {
     assert(s != NULL && s->parent != NULL);
     assert(uri_target != NULL);
@@ -1265,13 +1494,23 @@ int stack::inviteRemote(stack::session *s, const char *uri_target, const char *d
     time_t now;
     srv resolv;
     struct sockaddr_storage peering;
-    voip::context_t context = resolv.route(uri_target, route, sizeof(route));
+    voip::context_t context;
     const char *schema = NULL;
     char rewrite[MAX_URI_SIZE];
 
+    // a caller that can park the call leaves a cold route to the resolver
+    // thread, and tries again once it is cached; all others wait for it.
+    if(deferred)
+        resolv.nowait();
+    context = resolv.route(uri_target, route, sizeof(route));
+    if(!context && resolv.deferred())
+        return -1;
+
     if(!context)
         return icount;
 
+    trunks::used(route);
+
 /*
     struct sockaddr_storage peering, abuf;
     voip::context_t context = stack::sip.out_context;
@@ -1370,7 +1609,7 @@ int stack::inviteRemote(stack::session *s, const char *uri_target, const char *d
         voip::header(invite, SESSION_EXPIRES, expheader);
     }
 
-    char sdp[MAX_SDP_BUFFER];
+    char sdp[MAX_SDP_SIZE];
     LinkedObject *nat = NULL;
 
     if(media::invite(s, network, &nat, sdp) == NULL) {
@@ -1380,7 +1619,7 @@ int stack::inviteRemote(stack::session *s, const char *uri_target, const char *d
     }
 
     voip::attach(invite, SDP_BODY, sdp);
-    stack::siplog(invite);
+    stack::siplog(invite, true);
     cid = voip::send_invite_request(context, invite);
     if(cid > 0) {
         snprintf(seqid, sizeof(seqid), "%08x-%d", s->sequence, s->cid);
@@ -1489,29 +1728,59 @@ test:
     return false;
 }
 
-int stack::inviteLocal(stack::session *s, registry::mapped *rr, destination_t dest)
+stack::fanout::fanout(stack::session *s)
 {
     assert(s != NULL && s->parent != NULL);
+
+    source = s;
+    cr = s->parent;
+    branches = 0;
+    rewritten = NULL;
+    network[0] = 0;
+    expheader[0] = 0;
+
+    time(&now);
+    snprintf(seqid, sizeof(seqid), "%08x-%d", s->sequence, s->cid);
+    if(cr->expires)
+        snprintf(expheader, sizeof(expheader), "%ld", (long)(cr->expires - now));
+}
+
+// the rewrite for a network is kept for the next branch on that network,
+// unless it took media proxies, which each branch must have its own of.
+const char *stack::fanout::offer(const char *target, LinkedObject **nat)
+{
+    *nat = NULL;
+    if(rewritten && String::equal(network, target))
+        return rewritten;
+
+    rewritten = NULL;
+    if(media::invite(source, target, nat, sdp) == NULL)
+        return NULL;
+
+    if(*nat == NULL) {
+        String::set(network, sizeof(network), target);
+        rewritten = sdp;
+    }
+    return sdp;
+}
+
+int stack::fanout::invite(registry::mapped *rr, destination_t dest)
+{
     assert(rr != NULL);
 
     linked_pointer<registry::target> tp = rr->source.internal.targets;
+    linked_pointer<stack::segment> sp = cr->segments.begin();
     stack::session *invited;
-    stack::call *call = s->parent;
-    linked_pointer<stack::segment> sp = call->segments.begin();
     LinkedObject *nat;
-    char sdp[MAX_SDP_BUFFER];
-
-    time_t now;
+    const char *body;
     voip::msg_t invite;
-    char expheader[32];
-    char seqid[64];
+    char sysident[MAX_USERID_SIZE];
+    char published[MAX_URI_SIZE];
     char route[MAX_URI_SIZE];
     char touri[MAX_URI_SIZE];
     int cid;
     unsigned icount = 0;
 
-    time(&now);
-
     if(rr->expires && rr->expires < now + 1)
         return icount;
 
@@ -1523,6 +1792,11 @@ int stack::inviteLocal(stack::session *s, registry::mapped *rr, destination_t de
         sp.next();
     }
 
+    if(rr->ext)
+        snprintf(sysident, sizeof(sysident), "%u", rr->ext);
+    else
+        String::set(sysident, sizeof(sysident), rr->userid);
+
     while(is(tp)) {
         invited = NULL;
         if(tp->expires && tp->expires < now + 1)
@@ -1537,32 +1811,37 @@ int stack::inviteLocal(stack::session *s, registry::mapped *rr, destination_t de
         }
 
         invite = NULL;
+        stack::sipPublish(&tp->address, published, NULL, sizeof(published));
+
+        // the call is counted before it is sent, so a limit is never passed
+        if(!registry::reserve(rr, stats::OUTGOING)) {
+            shell::debug(3, "cannot invite %s; %s saturated\n", published, sysident);
+            goto next;
+        }
 
         if(dest == ROUTED) {
-            stack::sipPublish(&tp->address, route, call->dialed, sizeof(route));
-            snprintf(touri, sizeof(touri), "\"%s\" <%s;user=phone>", call->dialed, route);
+            stack::sipPublish(&tp->address, route, cr->dialed, sizeof(route));
+            snprintf(touri, sizeof(touri), "\"%s\" <%s;user=phone>", cr->dialed, route);
         }
-        else if(call->phone)
+        else if(cr->phone)
             snprintf(touri, sizeof(touri), "<%s;user=phone>", tp->contact);
         else
             snprintf(touri, sizeof(touri), "<%s>", tp->contact);
 
-        stack::sipPublish(&tp->address, route + 1, NULL, sizeof(route) - 5);
-        route[0] = '<';
-        String::add(route, sizeof(route), ";lr>");
+        snprintf(route, sizeof(route), "<%s;lr>", published);
 
-        if(!voip::make_invite_request(tp->context, touri, s->from, call->subject, &invite, route)) { 
-            stack::sipPublish(&tp->address, route, NULL, sizeof(route));
-            shell::log(shell::ERR, "cannot invite %s; build failed", route);
+        if(!voip::make_invite_request(tp->context, touri, source->from, cr->subject, &invite, route)) {
+            shell::log(shell::ERR, "cannot invite %s; build failed", published);
+            registry::decUse(rr, stats::OUTGOING);
             goto next;
         }
 
         // if not routing, then separate to from request-uri for forwarding
         if(dest != ROUTED) {
-            stack::sipPublish(&tp->address, route, call->dialed, sizeof(route));
-            if(call->phone)
+            stack::sipPublish(&tp->address, route, cr->dialed, sizeof(route));
+            if(cr->phone)
                 String::add(route, sizeof(route), ";user=phone");
-            snprintf(touri, sizeof(touri), "\"%s\" <%s>", call->dialed, route);
+            snprintf(touri, sizeof(touri), "\"%s\" <%s>", cr->dialed, route);
             if(invite->to) {
                 osip_to_free(invite->to);
                 invite->to = NULL;
@@ -1570,95 +1849,88 @@ int stack::inviteLocal(stack::session *s, registry::mapped *rr, destination_t de
             osip_message_set_to(invite, touri);
         }
 
-        divert(call, invite);
+        divert(cr, invite);
 
         voip::server_allows(invite);
         voip::server_supports(invite, "100rel,replaces,timer");
 
-        if(call->expires) {
-            snprintf(expheader, sizeof(expheader), "%ld", (long)(call->expires - now));
+        if(expheader[0])
             voip::header(invite, SESSION_EXPIRES, expheader);
-        }
 
-        nat = NULL;
-        if(media::invite(s, tp->network, &nat, sdp) == NULL) {
-            stack::sipPublish(&tp->address, route, NULL, sizeof(route));
-            shell::log(shell::ERR, "no media proxy available for %s", route);
+        body = offer(tp->network, &nat);
+        if(body == NULL) {
+            shell::log(shell::ERR, "no media proxy available for %s", published);
             voip::free_message_request(tp->context, invite);
+            registry::decUse(rr, stats::OUTGOING);
             goto next;
         }
 
-        voip::attach(invite, SDP_BODY, sdp);
-        stack::siplog(invite);
+        voip::attach(invite, SDP_BODY, body);
+        stack::siplog(invite, true);
         cid = voip::send_invite_request(tp->context, invite);
         if(cid > 0) {
-            snprintf(seqid, sizeof(seqid), "%08x-%d", s->sequence, s->cid);
             stack::sipAddress((struct sockaddr_internet *)&tp->peering, route, seqid, sizeof(route));
             voip::call_reference(tp->context, cid, route);
             ++icount;
         }
         else {
             media::release(&nat);
-            stack::sipPublish(&tp->address, route, NULL, sizeof(route));
-            shell::log(shell::ERR, "invite failed for %s", route);
+            shell::log(shell::ERR, "invite failed for %s", published);
+            registry::decUse(rr, stats::OUTGOING);
             goto next;
         }
 
-        invited = stack::create(tp->context, call, cid);
+        invited = stack::create(tp->context, cr, cid);
 
         String::set(invited->network, sizeof(invited->network), tp->network);
         invited->peering = tp->peering;
         invited->nat = nat;
 
-        if(rr->ext)
-            snprintf(invited->sysident, sizeof(invited->sysident), "%u", rr->ext);
-        else
-            String::set(invited->sysident, sizeof(invited->sysident), rr->userid);
+        String::set(invited->sysident, sizeof(invited->sysident), sysident);
         if(rr->display[0])
             String::set(invited->display, sizeof(invited->display), rr->display);
         else
-            String::set(invited->display, sizeof(invited->display), invited->sysident);
-        stack::sipPublish((struct sockaddr_internet *)&tp->peering, invited->identity, invited->sysident, sizeof(invited->identity));
+            String::set(invited->display, sizeof(invited->display), sysident);
+        stack::sipPublish((struct sockaddr_internet *)&tp->peering, invited->identity, sysident, sizeof(invited->identity));
         if(rr->ext && !rr->display[0])
             snprintf(invited->from, sizeof(invited->from),
-                "\"%s\" <%s;user=phone>", invited->sysident, invited->identity);
+                "\"%s\" <%s;user=phone>", sysident, invited->identity);
         else if(rr->display[0])
             snprintf(invited->from, sizeof(invited->from),
                 "\"%s\" <%s>", rr->display, invited->identity);
         else
             snprintf(invited->from, sizeof(invited->from),
                 "<%s>", invited->identity);
-        registry::incUse(rr, stats::OUTGOING);
         invited->reg = rr;
 
-        stack::sipPublish(&tp->address, route, NULL, sizeof(route));
         switch(dest) {
         case ROUTED:
-            shell::debug(3, "routing to %s\n", route);
+            shell::debug(3, "routing to %s\n", published);
             break;
         default:
-            shell::debug(3, "inviting %s\n", route);
+            shell::debug(3, "inviting %s\n", published);
         }
 
 next:
         tp.next();
     }
 
-    if(call->count > 0 || call->forwarding == NULL)
+    branches += icount;
+    if(cr->count > 0 || cr->forwarding == NULL)
         return icount;
 
     switch(rr->status) {
     case MappedRegistry::BUSY:
-        call->forwarding = "busy";
+        cr->forwarding = "busy";
         return icount;
     case MappedRegistry::OFFLINE:
-        call->forwarding = "gone";
+        cr->forwarding = "gone";
         return icount;
     case MappedRegistry::DND:
-        call->forwarding = "dnd";
+        cr->forwarding = "dnd";
         return icount;
     case MappedRegistry::AWAY:
-        call->forwarding = "away";
+        cr->forwarding = "away";
         return icount;
     default:
         break;
@@ -1666,4 +1938,11 @@ next:
     return icount;
 }
 
+int stack::inviteLocal(stack::session *s, registry::mapped *rr, destination_t dest)
+{
+    fanout branches(s);
+
+    return branches.invite(rr, dest);
+}
+
 } // end namespace
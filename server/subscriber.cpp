@@ -56,7 +56,7 @@ static MappedRegistry provider; // fake provider record to be used...
 static unsigned short port = 9000;
 
 subscriber::subscriber() :
-modules::sipwitch()
+modules::sipwitch(modules::HOOK_REGISTRATION | modules::HOOK_AUTHENTICATE)
 {
     zero_unsafe<MappedRegistry>(provider);
     provider.rid = -1;
@@ -39,6 +39,7 @@ static shell::stringopt iface('A', "--address", _TEXT("sip interface address"),
 static shell::numericopt port('P', "--port", _TEXT("sip port to bind"), "port", 5060);
 static shell::flagopt backflag('b', "--background", _TEXT("run in background"));
 static shell::flagopt altback('d', NULL, NULL);
+static shell::flagopt bench(0, "--benchmark", _TEXT("report timing of hot paths and exit"));
 static shell::flagopt dump('D', "--dump-config", _TEXT("show configuration"));
 static shell::numericopt concurrency('c', "--concurrency", _TEXT("process concurrency"), "level");
 static shell::flagopt desktop(0, "--desktop", _TEXT("enable desktop access"));
@@ -47,6 +48,7 @@ static shell::flagopt foreflag('f', "--foreground", _TEXT("run in foreground"));
 static shell::stringopt group('g', "--group", _TEXT("use specified group permissions"), "groupid", NULL);
 #endif
 static shell::numericopt histbuf('h', "--history", _TEXT("set history buffer"), "count", 0);
+static shell::numericopt hugepages(0, "--hugepages", _TEXT("huge page pool size"), "mbytes", 0);
 static shell::stringopt loglevel('L', "--logging", _TEXT("set log level"), "level", "err");
 static shell::stringopt loading('l', "--plugins", _TEXT("specify modules to load"), "names", "none");
 static shell::flagopt nolocalusers('n', "--no-localusers", _TEXT("disable local user accounts"));
@@ -190,6 +192,9 @@ static void up(const char *pidfile)
         }
     }
 
+    if(*hugepages > 0)
+        server::hugepages((size_t)*hugepages * 1024l * 1024l);
+
     cache::init();
     server::reload();
     server::startup();
@@ -197,14 +202,18 @@ static void up(const char *pidfile)
     if(is(trace))
         stack::enableDumping();
 
-    psignals::start();
-    events::start();
-    notify::start();
-    server::run();
-
-    events::terminate("server shutdown");
-    notify::stop();
-    psignals::stop();
+    if(is(bench))
+        benchmark::run(stdout);
+    else {
+        psignals::start();
+        events::start();
+        notify::start();
+        server::run();
+
+        events::terminate("server shutdown");
+        notify::stop();
+        psignals::stop();
+    }
     service::shutdown();
     control::release();
 
@@ -278,6 +287,7 @@ static void init(int argc, char **argv, bool detached, shell::mainproc_t svc = N
     args.setsym("cache", _STR(str(prefix) + "/cache"));
     args.setsym("logfiles", _STR(str(prefix) + "/logs"));
     args.setsym("siplogs", _STR(str(prefix) + "/logs/siptrace.log"));
+    args.setsym("captures", _STR(str(prefix) + "/logs/sipcapture.log"));
     args.setsym("logfile", _STR(str(prefix) + "/logs/sipwitch.log"));
     args.setsym("calls", _STR(str(prefix) + "/logs/sipwitch.calls"));
     args.setsym("stats", _STR(str(prefix) + "/logs/sipwitch.stats"));
@@ -303,6 +313,7 @@ static void init(int argc, char **argv, bool detached, shell::mainproc_t svc = N
     args.setsym("config", DEFAULT_CFGPATH "/sipwitch.conf");
     args.setsym("logfiles", DEFAULT_VARPATH "/log");
     args.setsym("siplogs", DEFAULT_VARPATH "/log/siptrace.log");
+    args.setsym("captures", DEFAULT_VARPATH "/log/sipcapture.log");
     args.setsym("logfile", DEFAULT_VARPATH "/log/sipwitch.log");
     args.setsym("calls", DEFAULT_VARPATH "/log/sipwitch.calls");
     args.setsym("stats", DEFAULT_VARPATH "/log/sipwitch.stats");
@@ -348,6 +359,7 @@ static void init(int argc, char **argv, bool detached, shell::mainproc_t svc = N
         args.setsym("pidfile", _STR(str(rundir) + "/pidfile"));
         args.setsym("logfiles", rundir);
         args.setsym("siplogs", _STR(str(rundir) + "/siplogs"));
+        args.setsym("captures", _STR(str(rundir) + "/captures"));
         args.setsym("logfile", _STR(str(rundir) + "/logfile"));
         args.setsym("calls", _STR(str(rundir) + "/calls"));
         args.setsym("stats", _STR(str(rundir) + "/stats"));
@@ -426,6 +438,10 @@ static void init(int argc, char **argv, bool detached, shell::mainproc_t svc = N
     if(cp && *cp)
         loading.set(strdup(cp));
 
+    cp = args.getenv("HUGEPAGES");
+    if(cp && *cp)
+        hugepages.set(atol(cp));
+
     if(is(dump)) {
         control::config(&args);
         dumpconfig();
@@ -441,6 +457,10 @@ static void init(int argc, char **argv, bool detached, shell::mainproc_t svc = N
         shell::errexit(1, "sipw: history: %ld: %s\n",
             *histbuf, _TEXT("negative buffer limit invalid"));
 
+    if(*hugepages < 0)
+        shell::errexit(1, "sipw: hugepages: %ld: %s\n",
+            *hugepages, _TEXT("negative pool size invalid"));
+
     // bind sip interface and port from command line options...
     // use xx:..:xx for ipv6 address, or a.b.c.d for ipv4
 
@@ -470,6 +490,10 @@ static void init(int argc, char **argv, bool detached, shell::mainproc_t svc = N
     if(is(foreflag))
         daemon = false;
 
+    // benchmark results are written to our console...
+    if(is(bench))
+        daemon = false;
+
    // lets play with verbose level and logging options
 
     if(is(verbose))
@@ -586,6 +610,7 @@ static void init(int argc, char **argv, bool detached, shell::mainproc_t svc = N
         shell::log("sipwitch", level, server::logmode, &errlog);
 
     server::plugins(plugins, *loading);
+    modules::dispatch();
     psignals::setup();
 
     const char *home = getenv("HOME");
@@ -18,11 +18,242 @@
 
 namespace sipwitch {
 
+#define EVENT_CLASSES   4
+
+// events are dispatched by priority class, in-dialog traffic first...
+enum {DIALOG_EVENTS = 0, INVITE_EVENTS, REGISTER_EVENTS, OTHER_EVENTS};
+
+class __LOCAL pending : public OrderedObject
+{
+public:
+    voip::event_t event;
+    unsigned long stamp;
+};
+
+class __LOCAL dispatcher;
+
+// takes events from the stack as they arrive, so their queue delay is
+// measured from arrival rather than from when an event thread was free.
+class __LOCAL receiver : public JoinableThread
+{
+public:
+    dispatcher *target;
+
+    inline receiver(dispatcher *dp) : JoinableThread(stack::sip.stacksize)
+        {target = dp;};
+
+private:
+    void run(void);
+};
+
+class __LOCAL dispatcher : public LinkedObject
+{
+public:
+    voip::context_t context;
+    const char *tag;
+    receiver *input;
+    bool stopping;
+    OrderedIndex queued[EVENT_CLASSES];
+    unsigned depth;
+    unsigned shedding;          // classes from here on are being shed
+    unsigned long changed;      // msec when shedding last changed
+    unsigned long delay;        // msec the oldest event was queued
+    unsigned long shed[EVENT_CLASSES];
+
+    inline dispatcher() : LinkedObject()
+        {input = NULL; stopping = false; depth = shedding = 0; changed = delay = 0; memset(shed, 0, sizeof(shed));};
+};
+
 static volatile bool warning_registry = false;
 static bool shutdown_flag = false;
 static unsigned shutdown_count = 0;
 static unsigned startup_count = 0;
 static unsigned active_count = 0;
+static LinkedObject *dispatchers = NULL;
+static LinkedObject *freepending = NULL;
+static Conditional dispatch_lock;
+static timeout_t latency_budget = 250;
+static unsigned queue_limit = 1024;
+
+static unsigned classify(voip::event_t ev)
+{
+    switch(ev->type) {
+    case EXOSIP_CALL_INVITE:
+        return INVITE_EVENTS;
+    case EXOSIP_IN_SUBSCRIPTION_NEW:
+        return OTHER_EVENTS;
+    case EXOSIP_MESSAGE_NEW:
+        if(!ev->request)
+            break;
+        if(MSG_IS_REGISTER(ev->request) || MSG_IS_MESSAGE(ev->request))
+            return REGISTER_EVENTS;
+        if(MSG_IS_OPTIONS(ev->request) || MSG_IS_PUBLISH(ev->request) || MSG_IS_SUBSCRIBE(ev->request))
+            return OTHER_EVENTS;
+        break;
+    default:
+        break;
+    }
+    return DIALOG_EVENTS;
+}
+
+// shed requests get a fast 503 without any further processing...
+static void reject(voip::context_t ctx, voip::event_t ev)
+{
+    voip::msg_t reply = NULL;
+    char retry[16];
+    uint16_t rand;
+
+    Random::fill((unsigned char *)&rand, sizeof(rand));
+    snprintf(retry, sizeof(retry), "%u", 2 + rand % 8);
+
+    switch(ev->type) {
+    case EXOSIP_MESSAGE_NEW:
+        if(!ev->request)
+            break;
+        if(voip::make_response_message(ctx, ev->tid, SIP_SERVICE_UNAVAILABLE, &reply)) {
+            voip::header(reply, "Retry-After", retry);
+            voip::send_response_message(ctx, ev->tid, SIP_SERVICE_UNAVAILABLE, reply);
+        }
+        else
+            voip::send_response_message(ctx, ev->tid, SIP_SERVICE_UNAVAILABLE, NULL);
+        break;
+    case EXOSIP_IN_SUBSCRIPTION_NEW:
+        if(voip::make_subscription_response(ctx, ev->tid, SIP_SERVICE_UNAVAILABLE, &reply)) {
+            voip::header(reply, "Retry-After", retry);
+            voip::send_subscription_response(ctx, ev->tid, SIP_SERVICE_UNAVAILABLE, reply);
+        }
+        else
+            voip::send_subscription_response(ctx, ev->tid, SIP_SERVICE_UNAVAILABLE, NULL);
+        break;
+    default:
+        break;
+    }
+    voip::release_event(ev);
+}
+
+// answers and recycles what was shed, outside of the dispatch lock
+static void discard(voip::context_t ctx, LinkedObject *drop)
+{
+    linked_pointer<pending> rp = drop;
+    pending *pp;
+
+    if(!drop)
+        return;
+
+    while(is(rp)) {
+        reject(ctx, rp->event);
+        rp.next();
+    }
+
+    dispatch_lock.lock();
+    while(drop) {
+        pp = (pending *)drop;
+        drop = pp->getNext();
+        ((LinkedObject *)pp)->enlist(&freepending);
+    }
+    dispatch_lock.unlock();
+}
+
+// events for a call whose invite is still queued are kept behind it, so
+// a cancel or close never runs before the call it ends is set up...
+static unsigned order(dispatcher *dp, voip::event_t ev, unsigned cls)
+{
+    linked_pointer<pending> pp;
+
+    if(cls != DIALOG_EVENTS || ev->cid < 1)
+        return cls;
+
+    pp = dp->queued[INVITE_EVENTS].begin();
+    while(is(pp)) {
+        if(pp->event->cid == ev->cid)
+            return INVITE_EVENTS;
+        pp.next();
+    }
+    return cls;
+}
+
+static void shed(dispatcher *dp, unsigned cls, voip::event_t ev, LinkedObject **drop)
+{
+    pending *pp = new(server::allocate(sizeof(pending), &freepending)) pending();
+    pp->event = ev;
+    ((LinkedObject *)pp)->enlist(drop);
+    ++dp->shed[cls];
+}
+
+static void adjust(dispatcher *dp, unsigned long now, LinkedObject **drop)
+{
+    pending *pp;
+    unsigned cls;
+
+    if(!latency_budget) {
+        dp->shedding = EVENT_CLASSES;
+        return;
+    }
+
+    // we step at most once a second, and never shed calls...
+    if(now - dp->changed < 1000)
+        return;
+
+    if(dp->delay > latency_budget && dp->shedding > REGISTER_EVENTS) {
+        dp->changed = now;
+        --dp->shedding;
+        shell::log(shell::WARN, "overload on %s; %lu msec queue delay, shedding class %u", dp->tag, dp->delay, dp->shedding);
+        for(cls = dp->shedding; cls < EVENT_CLASSES; ++cls) {
+            while(NULL != (pp = (pending *)dp->queued[cls].get())) {
+                ((LinkedObject *)pp)->enlist(drop);
+                ++dp->shed[cls];
+                --dp->depth;
+            }
+        }
+    }
+    else if(dp->delay < latency_budget / 2 && dp->shedding < EVENT_CLASSES) {
+        dp->changed = now;
+        if(++dp->shedding == EVENT_CLASSES)
+            shell::log(shell::NOTIFY, "overload on %s cleared", dp->tag);
+    }
+}
+
+void receiver::run(void)
+{
+    dispatcher *dp = target;
+    LinkedObject *drop;
+    pending *pp;
+    voip::event_t ev;
+    unsigned cls;
+
+    for(;;) {
+        ev = voip::get_event(dp->context, stack::sip.timing);
+        drop = NULL;
+
+        dispatch_lock.lock();
+        if(dp->stopping) {
+            dispatch_lock.unlock();
+            if(ev)
+                voip::release_event(ev);
+            return;
+        }
+
+        if(!ev) {
+            dispatch_lock.unlock();
+            continue;
+        }
+
+        cls = order(dp, ev, classify(ev));
+        if(cls >= dp->shedding || (dp->depth >= queue_limit && cls > INVITE_EVENTS))
+            shed(dp, cls, ev, &drop);
+        else {
+            pp = new(server::allocate(sizeof(pending), &freepending)) pending();
+            pp->event = ev;
+            pp->stamp = timing::mstime();
+            pp->enlistTail(&dp->queued[cls]);
+            ++dp->depth;
+            dispatch_lock.broadcast();
+        }
+        dispatch_lock.unlock();
+        discard(dp->context, drop);
+    }
+}
+
 
 static char *remove_quotes(char *c)
 {
@@ -352,6 +583,8 @@ void thread::invite(void)
     voip::body_t body = NULL;
     stack::call *call = session->parent;
     unsigned toext = 0;
+    int invited;
+    const char *digest = NULL;
     voip::hdr_t msgheader = NULL;
     char fromext[32];
     cdr *cdrnode = NULL;
@@ -407,8 +640,12 @@ void thread::invite(void)
         header_expires = 120;
 
     osip_message_get_body(sevent->request, 0, &body);
-    if(body && body->body)
-        String::set(session->sdp, sizeof(session->sdp), body->body);
+    if(body && body->body && *body->body && !arena::set(&session->sdp, body->body)) {
+        shell::log(shell::WARN, "rejecting invite from %s; sdp too large", getIdent());
+        send_reply(SIP_MESSAGE_TOO_LARGE);
+        call->failed(this, session);
+        return;
+    }
 
     if(dialed.keys) {
         target = service::getValue(dialed.keys, "extension");
@@ -548,9 +785,19 @@ void thread::invite(void)
         String::set(cdrnode->dialed, sizeof(cdrnode->dialed), call->dialed);
         String::set(cdrnode->display, sizeof(cdrnode->display), session->display);
         if(destination == REDIRECTED)
-            stack::inviteRemote(session, requesting, server::getValue(authorized.keys, "digest"));
-        else
-            stack::inviteRemote(session, requesting);
+            digest = server::getValue(authorized.keys, "digest");
+        Mutex::protect(call);
+        invited = stack::inviteRemote(session, requesting, digest, true);
+
+        // the route is being resolved, so the call is parked until it is
+        // cached and then invited from the call timer...
+        if(invited < 0) {
+            shell::debug(3, "parking call %08x:%u until %s resolves",
+                session->sequence, session->cid, requesting);
+            arena::set(&call->resolving, requesting);
+            arena::set(&call->credentials, digest);
+        }
+        Mutex::release(call);
 
         session->closed = false;
         goto exit;
@@ -594,31 +841,39 @@ void thread::invite(void)
         break;
     }
 
+    call->map->changes.lock();
     call->map->sequence = session->sequence;
     call->map->cid = session->cid;
     String::set(call->map->source, sizeof(call->map->source), session->sysident);
     String::set(call->map->display, sizeof(call->map->display), session->display);
+    call->map->changes.unlock();
     if(reginfo) {
         // get rid of config ref if we are calling registry target
         server::release(dialed);
 
         String::set(call->forward, MAX_USERID_SIZE, reginfo->userid);
         call->forwarding = "na";
+        Mutex::protect(call);
         stack::inviteLocal(session, reginfo, destination);
+        Mutex::release(call);
     }
-
-    if(dialed.keys) {
-        // PROCESS DIALED HERE IF EXISTS...
+    else if(dialed.keys && !stricmp(dialed.keys->getId(), "group")) {
+        Mutex::protect(call);
+        stack::inviteGroup(session, dialed.keys);
+        Mutex::release(call);
     }
 
 exit:
     if(cdrnode)
         cdr::post(cdrnode);
 
-    if(!call->invited && !stack::forward(call)) {
+    Mutex::protect(call);
+    if(!call->invited && !call->resolving && !stack::forward(call)) {
+        Mutex::release(call);
         call->busy(this);
         return;
     }
+    Mutex::release(call);
 
     call->trying(this);
     shell::debug(2, "call proceeding %08x:%u\n", session->sequence, session->cid);
@@ -718,6 +973,7 @@ bool thread::authorize(void)
     bool anon = false;
     UserCache *usercache = NULL;
     bool allowed = false;
+    bool saturated = false;
 
     if(!sevent->request || !sevent->request->to || !sevent->request->from || !sevent->request->req_uri)
         goto invalid;
@@ -1002,7 +1258,12 @@ routing:
     if(!level)
         goto invalid;
 
-    pp = registry::getRouting(level, target);
+    pp = registry::getRouting(level, target, &saturated);
+    if(!pp && saturated) {
+        // every route that could take the call is at its limit...
+        error = SIP_SERVICE_UNAVAILABLE;
+        goto invalid;
+    }
     if(!pp)
         goto static_routing;
 
@@ -1189,7 +1450,7 @@ void thread::send_reply(int error)
         if(voip::make_answer_response(context, sevent->tid, error, &reply)) {
             if(context == stack::sip.udp_context)
                 voip::server_requires(reply, "100rel");
-            stack::siplog(reply);
+            stack::siplog(reply, true);
             voip::send_answer_response(context, sevent->tid, error, reply);
         }
         else
@@ -1200,7 +1461,7 @@ void thread::send_reply(int error)
         if(voip::make_response_message(context, sevent->tid, error, &reply)) {
             if(context == stack::sip.udp_context)
                 voip::server_requires(reply, "100rel");
-            stack::siplog(reply);
+            stack::siplog(reply, true);
             voip::send_response_message(context, sevent->tid, error, reply);
         }
         else
@@ -1389,7 +1650,7 @@ void thread::challenge(void)
         if(voip::make_response_message(context, sevent->tid, SIP_UNAUTHORIZED, &reply)) {
             voip::header(reply, WWW_AUTHENTICATE, buffer);
             voip::server_allows(reply);
-            stack::siplog(reply);
+            stack::siplog(reply, true);
             voip::send_response_message(context, sevent->tid, SIP_UNAUTHORIZED, reply);
         }
         break;
@@ -1397,7 +1658,7 @@ void thread::challenge(void)
         if(voip::make_answer_response(context, sevent->tid, SIP_UNAUTHORIZED, & reply)) {
             voip::header(reply, WWW_AUTHENTICATE, buffer);
             voip::server_allows(reply);
-            stack::siplog(reply);
+            stack::siplog(reply, true);
             voip::send_answer_response(context, sevent->tid, SIP_UNAUTHORIZED, reply);
         }
         break;
@@ -1406,6 +1667,32 @@ void thread::challenge(void)
     }
 }
 
+// eXosip marks the top via with received= whenever the request came from
+// some other address than the sender claims, so unlike the originating via
+// it names the host the packet arrived from.  The port is only known when
+// rport was asked for, so the host alone is used.
+const char *thread::getorigin(void)
+{
+    voip::via_t via = NULL;
+    voip::param_t param = NULL;
+
+    if(!sevent->request)
+        return NULL;
+
+    via = (voip::via_t)osip_list_get(OSIP2_LIST_PTR sevent->request->vias, 0);
+    if(!via)
+        return NULL;
+
+    osip_via_param_get_byname(via, (char *)"received", &param);
+    if(param != NULL && param->gvalue != NULL)
+        return param->gvalue;
+
+    if(!via->host || !Socket::is_numeric(via->host))
+        return NULL;
+
+    return via->host;
+}
+
 bool thread::getsource(void)
 {
     voip::param_t param;
@@ -1541,7 +1828,7 @@ reply:
             osip_message_set_expires(reply, temp);
         }
         voip::server_allows(reply);
-        stack::siplog(reply);
+        stack::siplog(reply, true);
         voip::send_response_message(context, sevent->tid, error, reply);
     }
     else
@@ -1559,6 +1846,26 @@ void thread::registration(void)
     int error = SIP_ADDRESS_INCOMPLETE;
     voip::msg_t reply = NULL;
     struct sockaddr_internet iface;
+    Socket::address origin;
+    const char *source = getorigin();
+    unsigned retry;
+
+    // pace registration storms before we authenticate or allocate...
+    if(source)
+        origin.set(source, 0);
+    if(source && getsource() && !admission::admit(origin.getAddr(), access, &retry)) {
+        shell::debug(3, "deferring registration from %s for %u seconds", source, retry);
+        if(voip::make_response_message(context, sevent->tid, SIP_SERVICE_UNAVAILABLE, &reply)) {
+            snprintf(buftemp, sizeof(buftemp), "%u", retry);
+            voip::header(reply, "Retry-After", buftemp);
+            voip::server_allows(reply);
+            stack::siplog(reply, true);
+            voip::send_response_message(context, sevent->tid, SIP_SERVICE_UNAVAILABLE, reply);
+        }
+        else
+            voip::send_response_message(context, sevent->tid, SIP_BAD_REQUEST, NULL);
+        return;
+    }
 
     while(osip_list_eol(OSIP2_LIST_PTR sevent->request->contacts, pos) == 0) {
         contact = (voip::contact_t)osip_list_get(OSIP2_LIST_PTR sevent->request->contacts, pos++);
@@ -1649,7 +1956,7 @@ reply:
                 osip_message_set_contact(reply, buftemp);
             }
             voip::server_allows(reply);
-            stack::siplog(reply);
+            stack::siplog(reply, true);
             voip::send_response_message(context, sevent->tid, error, reply);
         }
         else
@@ -1753,7 +2060,7 @@ reply:
             osip_message_set_contact(reply, buftemp);
         }
         voip::server_allows(reply);
-        stack::siplog(reply);
+        stack::siplog(reply, true);
         voip::send_response_message(context, sevent->tid, answer, reply);
     }
     else
@@ -1801,7 +2108,7 @@ void thread::options(void)
     if(voip::make_options_response(context, sevent->tid, SIP_OK, &reply)) {
         voip::server_accepts(reply);
         voip::server_allows(reply);
-        stack::siplog(reply);
+        stack::siplog(reply, true);
         voip::send_options_response(context, sevent->tid, SIP_OK, reply);
     }
     else
@@ -1822,6 +2129,131 @@ void thread::wait(unsigned count) {
         Thread::sleep(50);
 }
 
+// the oldest queued event of each class sets the queue delay, and the
+// first of the highest priority class is taken...
+static voip::event_t pick(dispatcher *dp, unsigned long now)
+{
+    voip::event_t ev = NULL;
+    pending *pp;
+
+    dp->delay = 0;
+    for(unsigned cls = 0; cls < EVENT_CLASSES; ++cls) {
+        pp = (pending *)dp->queued[cls].begin();
+        if(pp && now - pp->stamp > dp->delay)
+            dp->delay = now - pp->stamp;
+        if(!pp || ev)
+            continue;
+        dp->queued[cls].get();
+        --dp->depth;
+        ev = pp->event;
+        ((LinkedObject *)pp)->enlist(&freepending);
+    }
+    return ev;
+}
+
+voip::event_t thread::dispatch(voip::context_t ctx, const char *tag, timeout_t timeout)
+{
+    linked_pointer<dispatcher> dp;
+    LinkedObject *drop = NULL;
+    voip::event_t ev = NULL;
+    unsigned long now;
+
+    dispatch_lock.lock();
+    dp = dispatchers;
+    while(is(dp) && dp->context != ctx)
+        dp.next();
+
+    if(!is(dp)) {
+        dp = new dispatcher;
+        dp->context = ctx;
+        dp->tag = tag;
+        dp->shedding = EVENT_CLASSES;
+        dp->enlist(&dispatchers);
+        dp->input = new receiver(*dp);
+        dp->input->start();
+    }
+
+    // with nothing queued we wait for the receiver to queue something
+    now = timing::mstime();
+    ev = pick(*dp, now);
+    if(!ev) {
+        dispatch_lock.wait(timeout);
+        now = timing::mstime();
+        ev = pick(*dp, now);
+    }
+
+    // the delay of the oldest queued event decides if we shed...
+    adjust(*dp, now, &drop);
+    dispatch_lock.unlock();
+
+    discard(ctx, drop);
+    return ev;
+}
+
+void thread::flush(voip::context_t ctx)
+{
+    linked_pointer<dispatcher> dp;
+    pending *pp;
+
+    dispatch_lock.lock();
+    dp = dispatchers;
+    while(is(dp) && dp->context != ctx)
+        dp.next();
+
+    if(!is(dp)) {
+        dispatch_lock.unlock();
+        return;
+    }
+
+    // the receiver notices within one timing period...
+    dp->stopping = true;
+    dispatch_lock.unlock();
+    if(dp->input) {
+        dp->input->join();
+        delete dp->input;
+        dp->input = NULL;
+    }
+
+    dispatch_lock.lock();
+    for(unsigned cls = 0; cls < EVENT_CLASSES; ++cls) {
+        while(NULL != (pp = (pending *)dp->queued[cls].get())) {
+            voip::release_event(pp->event);
+            ((LinkedObject *)pp)->enlist(&freepending);
+            --dp->depth;
+        }
+    }
+    dispatch_lock.unlock();
+}
+
+void thread::overload(timeout_t budget, unsigned backlog)
+{
+    dispatch_lock.lock();
+    latency_budget = budget;
+    queue_limit = backlog;
+    dispatch_lock.unlock();
+}
+
+void thread::snapshot(FILE *fp)
+{
+    assert(fp != NULL);
+
+    linked_pointer<dispatcher> dp;
+
+    dispatch_lock.lock();
+    fprintf(fp, "Dispatch:\n");
+    fprintf(fp, "  latency budget: %ld\n", (long)latency_budget);
+    fprintf(fp, "  queue limit:    %u\n", queue_limit);
+    dp = dispatchers;
+    while(is(dp)) {
+        fprintf(fp, "  %s; depth=%u, delay=%lu, shedding=%u, shed=%lu/%lu/%lu/%lu\n",
+            dp->tag, dp->depth, dp->delay, dp->shedding,
+            dp->shed[DIALOG_EVENTS], dp->shed[INVITE_EVENTS],
+            dp->shed[REGISTER_EVENTS], dp->shed[OTHER_EVENTS]);
+        dp.next();
+    }
+    dispatch_lock.unlock();
+}
+
 void thread::expiration(void)
 {
     voip::hdr_t msgheader = NULL;
@@ -1865,7 +2297,7 @@ void thread::run(void)
         identbuf[0] = 0;
 
         if(!shutdown_flag)
-            sevent = voip::get_event(context, stack::sip.timing);
+            sevent = dispatch(context, instance, stack::sip.timing);
 
         activated = false;
         accepted = NULL;
@@ -1876,6 +2308,7 @@ void thread::run(void)
 
         if(shutdown_flag) {
             shell::log(DEBUG1, "stopping event thread %s", instance);
+            flush(context);
             voip::release(context);
             ++shutdown_count;
             return; // exits thread...
@@ -2135,6 +2568,8 @@ void thread::run(void)
             authorizing = MESSAGE;
             if(!sevent->response)
                 break;
+            if(trunks::answered(sevent))
+                break;
             if(sevent->cid < 1)
                 break;
             session = stack::access(sevent->cid);
@@ -2143,6 +2578,15 @@ void thread::run(void)
             else
                 send_reply(SIP_NOT_FOUND);
             break;
+        case EXOSIP_MESSAGE_REQUESTFAILURE:
+        case EXOSIP_MESSAGE_SERVERFAILURE:
+        case EXOSIP_MESSAGE_GLOBALFAILURE:
+            if(sevent->response)
+                stack::siplog(sevent->response);
+            authorizing = MESSAGE;
+            if(!trunks::answered(sevent))
+                shell::debug(3, "message failed; status=%d", sevent->response ? sevent->response->status_code : 0);
+            break;
         case EXOSIP_CALL_MESSAGE_NEW:
             stack::siplog(sevent->request);
             authorizing = CALL;
@@ -0,0 +1,311 @@
+// Copyright (C) 2006-2014 David Sugar, Tycho Softworks.
+// Copyright (C) 2015 Cherokees of Idaho.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "server.h"
+
+namespace sipwitch {
+
+// eXosip keeps one connection open to each tcp and tls destination and
+// sends every later request to that destination over it.  Trunks are
+// pinged with OPTIONS from the background thread, so their connection is
+// set up before the first call needs it, and is kept from idling out.
+// A trunk that stops answering is pinged again sooner, which reconnects.
+
+#define TRUNK_LIMIT     16
+#define TRUNK_TIMEOUT   32      // seconds an unanswered ping is given
+#define TRUNK_RETRY     2       // seconds before first retry
+
+static LinkedObject *active = NULL;
+static LinkedObject *freetrunks = NULL;
+static Mutex private_lock;
+static volatile unsigned allocated_trunks = 0;
+static unsigned interval = 30;
+static unsigned long reused = 0;
+static unsigned long cold = 0;
+
+trunks::trunk *trunks::find(const char *uri)
+{
+    linked_pointer<trunk> tp = active;
+
+    while(is(tp)) {
+        if(eq(tp->uri, uri))
+            return *tp;
+        tp.next();
+    }
+    return NULL;
+}
+
+void trunks::failed(trunk *tp, time_t now)
+{
+    unsigned retry = TRUNK_RETRY;
+
+    tp->sent = 0;
+    tp->callid[0] = 0;
+    tp->online = false;
+    ++tp->missed;
+
+    if(tp->failures < 5)
+        retry <<= tp->failures;
+    else
+        retry <<= 5;
+    ++tp->failures;
+
+    if(retry > interval)
+        retry = interval;
+    tp->next = now + retry;
+}
+
+void trunks::configure(const char *list, unsigned ping)
+{
+    char buffer[TRUNK_LIMIT * MAX_URI_SIZE];
+    linked_pointer<trunk> tp;
+    LinkedObject *prior;
+    LinkedObject *next;
+    unsigned count = 0;
+    char *tokens = NULL;
+    char *uri;
+    trunk *node;
+
+    if(ping < 5)
+        ping = 5;
+
+    buffer[0] = 0;
+    if(list)
+        String::set(buffer, sizeof(buffer), list);
+
+    private_lock.acquire();
+    interval = ping;
+    prior = active;
+    active = NULL;
+
+    // trunks kept over a reload keep their connection and counters
+    while(count < TRUNK_LIMIT && NULL != (uri = String::token(buffer, &tokens, ", ;\t\r\n"))) {
+        if(!*uri)
+            continue;
+        tp = prior;
+        while(is(tp) && !eq(tp->uri, uri))
+            tp.next();
+        if(is(tp)) {
+            tp->delist(&prior);
+            tp->enlist(&active);
+        }
+        else {
+            node = (trunk *)server::allocate(sizeof(trunk), &freetrunks, &allocated_trunks);
+            String::set(node->uri, sizeof(node->uri), uri);
+            node->enlist(&active);
+        }
+        ++count;
+    }
+
+    tp = prior;
+    while(is(tp)) {
+        next = tp->getNext();
+        tp->enlist(&freetrunks);
+        tp = next;
+    }
+    private_lock.release();
+}
+
+void trunks::automatic(void)
+{
+    char uri[MAX_URI_SIZE];
+    char to[MAX_URI_SIZE];
+    char route[MAX_URI_SIZE];
+    char from[MAX_URI_SIZE];
+    const char *host = stack::sip.published;
+    linked_pointer<trunk> tp;
+    voip::context_t ctx;
+    voip::msg_t msg;
+    trunk *node;
+    time_t now;
+    bool sent;
+    srv resolv;
+
+    if(!active)
+        return;
+
+    if(!host)
+        host = "127.0.0.1";
+
+    if(strchr(host, ':'))
+        snprintf(from, sizeof(from), "<sip:%s@[%s]:%u>", stack::sip.system, host, stack::sip_port);
+    else
+        snprintf(from, sizeof(from), "<sip:%s@%s:%u>", stack::sip.system, host, stack::sip_port);
+
+    time(&now);
+    for(;;) {
+        private_lock.acquire();
+        tp = active;
+        while(is(tp)) {
+            if(tp->sent && now - tp->sent >= TRUNK_TIMEOUT)
+                failed(*tp, now);
+            if(!tp->sent && tp->next <= now)
+                break;
+            tp.next();
+        }
+        if(!is(tp)) {
+            private_lock.release();
+            return;
+        }
+
+        // not picked again this pass, even if the ping cannot be sent
+        tp->next = now + interval;
+        String::set(uri, sizeof(uri), tp->uri);
+        private_lock.release();
+
+        // resolve without holding the trunk list, and record the ping
+        // before it is sent, as the reply may come back at once...
+        sent = false;
+        msg = NULL;
+        ctx = resolv.route(uri, route, sizeof(route));
+        if(eq(uri, "tcp:", 4) || eq(uri, "udp:", 4))
+            snprintf(to, sizeof(to), "sip:%s", uri + 4);
+        else
+            String::set(to, sizeof(to), uri);
+
+        if(ctx && voip::make_request_message(ctx, "OPTIONS", to, from, &msg, route)) {
+            private_lock.acquire();
+            node = find(uri);
+            if(node && msg->call_id && osip_call_id_get_number(msg->call_id)) {
+                String::set(node->route, sizeof(node->route), route);
+                String::set(node->callid, sizeof(node->callid), osip_call_id_get_number(msg->call_id));
+                node->sent = now;
+                ++node->pings;
+                sent = true;
+            }
+            private_lock.release();
+            voip::send_request_message(ctx, msg);
+        }
+
+        if(sent)
+            continue;
+
+        private_lock.acquire();
+        node = find(uri);
+        if(node) {
+            shell::debug(3, "cannot ping trunk %s", uri);
+            failed(node, now);
+        }
+        private_lock.release();
+    }
+}
+
+bool trunks::answered(voip::event_t ev)
+{
+    assert(ev != NULL);
+
+    linked_pointer<trunk> tp;
+    const char *id;
+    time_t now;
+
+    if(!active || !ev->request || !ev->request->call_id || !MSG_IS_OPTIONS(ev->request))
+        return false;
+
+    id = osip_call_id_get_number(ev->request->call_id);
+    if(!id)
+        return false;
+
+    time(&now);
+    private_lock.acquire();
+    tp = active;
+    while(is(tp)) {
+        if(tp->sent && eq(tp->callid, id))
+            break;
+        tp.next();
+    }
+
+    if(!is(tp)) {
+        private_lock.release();
+        return false;
+    }
+
+    // any reply at all shows the connection is up...
+    if(ev->response) {
+        if(!tp->online) {
+            if(tp->replied)
+                ++tp->reconnects;
+            shell::log(shell::INFO, "trunk %s online", tp->uri);
+        }
+        tp->online = true;
+        tp->failures = 0;
+        tp->replied = now;
+        tp->next = tp->sent + interval;
+        tp->sent = 0;
+        tp->callid[0] = 0;
+        ++tp->replies;
+    }
+    else {
+        if(tp->online)
+            shell::log(shell::WARN, "trunk %s offline", tp->uri);
+        failed(*tp, now);
+    }
+    private_lock.release();
+    return true;
+}
+
+void trunks::used(const char *route)
+{
+    linked_pointer<trunk> tp;
+
+    if(!active || !route)
+        return;
+
+    private_lock.acquire();
+    tp = active;
+    while(is(tp)) {
+        if(eq(tp->route, route)) {
+            if(tp->online) {
+                ++tp->reused;
+                ++reused;
+            }
+            else
+                ++cold;
+            break;
+        }
+        tp.next();
+    }
+    private_lock.release();
+}
+
+void trunks::snapshot(FILE *fp)
+{
+    assert(fp != NULL);
+
+    linked_pointer<trunk> tp;
+    time_t now;
+
+    time(&now);
+    private_lock.acquire();
+    fprintf(fp, "Trunks:\n");
+    fprintf(fp, "  ping interval:    %u\n", interval);
+    fprintf(fp, "  allocated trunks: %u\n", allocated_trunks);
+    fprintf(fp, "  reused: %lu\n", reused);
+    fprintf(fp, "  cold:   %lu\n", cold);
+    tp = active;
+    while(is(tp)) {
+        fprintf(fp, "  trunk %s; %s, route=%s\n", tp->uri,
+            tp->online ? "online" : "offline", tp->route[0] ? tp->route : "none");
+        fprintf(fp, "    pings=%lu, replies=%lu, missed=%lu, reconnects=%lu, reused=%lu",
+            tp->pings, tp->replies, tp->missed, tp->reconnects, tp->reused);
+        if(tp->replied)
+            fprintf(fp, ", replied %ld", (long)(now - tp->replied));
+        fputc('\n', fp);
+        tp.next();
+    }
+    private_lock.release();
+}
+
+} // end namespace
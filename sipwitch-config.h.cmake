@@ -24,6 +24,7 @@
 #cmakedefine HAVE_ATEXIT 1
 #cmakedefine HAVE_GETUID 1
 #cmakedefine HAVE_IOCTL_H 1
+#cmakedefine HAVE_MADVISE 1
 #cmakedefine HAVE_MKFIFO 1
 #cmakedefine HAVE_NET_IF_H 1
 #cmakedefine HAVE_PWD_H 1
@@ -38,6 +39,7 @@
 #cmakedefine HAVE_SYS_INOTIFY_H 1
 #cmakedefine HAVE_SYS_SOCKIO_H 1
 #cmakedefine HAVE_SYS_STAT_H 1
+#cmakedefine HAVE_SYS_MMAN_H 1
 #cmakedefine HAVE_RESOLV_H 1
 #cmakedefine HAVE_SYSTEMD 1
 #cmakedefine HAVE_OPENSSL 1
@@ -0,0 +1,153 @@
+// Copyright (C) 2006-2014 David Sugar, Tycho Softworks.
+// Copyright (C) 2015 Cherokees of Idaho.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include "../server/server.h"
+
+#include <stdio.h>
+
+using namespace SIPWITCH_NAMESPACE;
+
+#define EQUAL_PASSES    2000
+#define EQUAL_PATTERNS  24
+
+// dialplan is built into sipw; the tests only ever give it a paged heap,
+// so the server freelists are never used here.
+namespace sipwitch {
+
+void *server::allocate(size_t size, LinkedObject **list, volatile unsigned *count)
+{
+    abort();
+    return NULL;
+}
+
+} // end namespace
+
+static const char *pattern_symbols = "0129*#XNZ?O";
+static const char *dialed_digits = "0129*#1";
+
+static void random_string(char *buf, const char *symbols, unsigned max)
+{
+    unsigned len = 1 + (unsigned)(rand() % max);
+    unsigned count = (unsigned)strlen(symbols);
+
+    for(unsigned pos = 0; pos < len; ++pos)
+        buf[pos] = symbols[rand() % count];
+    buf[len] = 0;
+}
+
+static bool routed(dialplan &plan, const char *id, const char *pattern)
+{
+    dialplan::match *mp = NULL;
+
+    assert(plan.find(id, &mp));
+    return mp != NULL && !strcmp(mp->text, pattern);
+}
+
+// the trie must route exactly what service::match did for every pattern,
+// whether the first choice or the full list of candidates is asked for.
+static void equivalence(void)
+{
+    char patterns[EQUAL_PATTERNS][8];
+    char id[16];
+    dialplan::match *list[EQUAL_PATTERNS], *best;
+    unsigned pass, pos, count, index, checked = 0, first;
+    bool found;
+
+    for(pass = 0; pass < EQUAL_PASSES; ++pass) {
+        memalloc heap;
+        dialplan plan(&heap);
+
+        for(pos = 0; pos < EQUAL_PATTERNS; ++pos) {
+            random_string(patterns[pos], pattern_symbols, 7);
+            plan.add(patterns[pos], patterns[pos], 0, pos);
+        }
+
+        random_string(id, dialed_digits, 12);
+
+        // too many wildcard branches; the server walks the patterns itself
+        if(!plan.find(id, list, EQUAL_PATTERNS, &count))
+            continue;
+
+        ++checked;
+        first = EQUAL_PATTERNS;
+        for(pos = 0; pos < EQUAL_PATTERNS; ++pos) {
+            found = false;
+            for(index = 0; index < count; ++index) {
+                if(list[index]->object == patterns[pos])
+                    found = true;
+            }
+            if(found != service::match(id, patterns[pos], false)) {
+                fprintf(stderr, "*** dialplan: %s and %s disagree\n", id, patterns[pos]);
+                abort();
+            }
+            if(found && first == EQUAL_PATTERNS)
+                first = pos;
+        }
+
+        assert(plan.find(id, &best));
+        if(first == EQUAL_PATTERNS)
+            assert(best == NULL);
+        else
+            assert(best != NULL && best->object == patterns[first]);
+    }
+
+    assert(checked > EQUAL_PASSES / 2);
+}
+
+extern "C" int main()
+{
+    memalloc heap;
+    dialplan plan(&heap);
+
+    // a pattern shorter than the number dialed matches as a prefix
+    plan.add("9", (void *)"9", 0, 0);
+    plan.add("1NXX", (void *)"1NXX", 0, 1);
+    plan.add("011", (void *)"011", 0, 2);
+    assert(routed(plan, "9123", "9"));
+    assert(routed(plan, "18005551212", "1NXX"));
+    assert(routed(plan, "+1 800 555 1212", "1NXX"));
+    assert(routed(plan, "0114412345678", "011"));
+    assert(!routed(plan, "1800", "011"));
+
+    // a pattern longer than the number dialed does not
+    assert(!routed(plan, "180", "1NXX"));
+    assert(!routed(plan, "01", "011"));
+
+    // an optional 1 is skipped as long as digits are left over
+    plan.add("7O", (void *)"7O", 0, 3);
+    assert(routed(plan, "75", "7O"));
+    assert(routed(plan, "71", "7O"));
+    assert(!routed(plan, "7", "7O"));
+
+    // leading + matches the end of the number
+    plan.add("+5551212", (void *)"+5551212", 0, 4);
+    assert(routed(plan, "2125551212", "+5551212"));
+    assert(!routed(plan, "2125551213", "+5551212"));
+
+    // earlier ranks are preferred when more than one pattern matches
+    plan.add("91", (void *)"91", 0, 5);
+    assert(routed(plan, "9123", "9"));
+    plan.remove("9", (void *)"9");
+    assert(routed(plan, "9123", "91"));
+
+    equivalence();
+    return 0;
+}
@@ -0,0 +1,250 @@
+// Copyright (C) 2006-2014 David Sugar, Tycho Softworks.
+// Copyright (C) 2015 Cherokees of Idaho.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <sipwitch-config.h>
+#include <sipwitch/sipwitch.h>
+
+#include <stdio.h>
+
+#ifdef  HAVE_RESOLV_H
+extern "C" {
+#include <resolv.h>
+}
+#endif
+
+using namespace SIPWITCH_NAMESPACE;
+
+#ifdef  HAVE_RESOLV_H
+
+// a stub dns server which answers srv queries for "cached.test" and
+// fails everything else, counting how many queries actually reach it.
+static class stubServer : public JoinableThread
+{
+public:
+    int so;
+    bool running;
+    volatile unsigned queries;
+    struct sockaddr_in addr;
+
+    stubServer() : JoinableThread()
+        {so = -1; running = false; queries = 0;};
+
+    bool open(void);
+    void stop(void);
+
+private:
+    void run(void);
+    size_t answer(unsigned char *buf, size_t len);
+} dns;
+
+bool stubServer::open(void)
+{
+    socklen_t alen = sizeof(addr);
+
+    so = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if(so < 0)
+        return false;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(::bind(so, (struct sockaddr *)&addr, sizeof(addr)) || getsockname(so, (struct sockaddr *)&addr, &alen)) {
+        ::close(so);
+        so = -1;
+        return false;
+    }
+
+    running = true;
+    start();
+    return true;
+}
+
+void stubServer::stop(void)
+{
+    running = false;
+    join();
+    ::close(so);
+}
+
+size_t stubServer::answer(unsigned char *buf, size_t len)
+{
+    static const unsigned char target[] = {3, '1', '2', '7', 1, '0', 1, '0', 1, '1', 0};
+    char name[256];
+    size_t pos = 12, np = 0;
+    unsigned qtype;
+
+    if(len < 12)
+        return 0;
+
+    while(pos < len && buf[pos] && np < sizeof(name) - 64) {
+        if(np)
+            name[np++] = '.';
+        memcpy(name + np, buf + pos + 1, buf[pos]);
+        np += buf[pos];
+        pos += buf[pos] + 1;
+    }
+    name[np] = 0;
+    if(pos + 5 > len)
+        return 0;
+
+    qtype = (buf[pos + 1] << 8) | buf[pos + 2];
+    pos += 5;
+
+    buf[2] = 0x84 | (buf[2] & 0x01);
+    buf[3] = 0x80;
+    buf[6] = buf[7] = buf[8] = buf[9] = buf[10] = buf[11] = 0;
+
+    if(qtype != 33 || strncmp(name, "_sip._udp.cached.test", 21)) {
+        buf[3] |= 3;
+        return pos;
+    }
+
+    buf[7] = 1;
+    unsigned char *cp = buf + pos;
+    *(cp++) = 0xc0; *(cp++) = 12;
+    *(cp++) = 0; *(cp++) = 33;
+    *(cp++) = 0; *(cp++) = 1;
+    *(cp++) = 0; *(cp++) = 0; *(cp++) = 0; *(cp++) = 60;
+    *(cp++) = 0; *(cp++) = 6 + sizeof(target);
+    *(cp++) = 0; *(cp++) = 10;
+    *(cp++) = 0; *(cp++) = 5;
+    *(cp++) = 0x13; *(cp++) = 0xc4;
+    memcpy(cp, target, sizeof(target));
+    cp += sizeof(target);
+    return cp - buf;
+}
+
+void stubServer::run(void)
+{
+    unsigned char buf[512];
+    struct sockaddr_storage peer;
+    socklen_t plen;
+    fd_set rfd;
+    struct timeval tv;
+    ssize_t len;
+    size_t reply;
+
+    while(running) {
+        FD_ZERO(&rfd);
+        FD_SET(so, &rfd);
+        tv.tv_sec = 0;
+        tv.tv_usec = 50000;
+        if(::select(so + 1, &rfd, NULL, NULL, &tv) < 1)
+            continue;
+        plen = sizeof(peer);
+        len = ::recvfrom(so, (char *)buf, sizeof(buf), 0, (struct sockaddr *)&peer, &plen);
+        if(len < 1)
+            continue;
+        ++queries;
+        reply = answer(buf, len);
+        if(reply)
+            ::sendto(so, (char *)buf, reply, 0, (struct sockaddr *)&peer, plen);
+    }
+}
+
+extern "C" int main()
+{
+    unsigned count, tries;
+
+    // 77 is reported as a skipped test rather than a pass
+    if(!dns.open()) {
+        fprintf(stderr, "*** resolver: skipped, cannot bind stub dns server\n");
+        return 77;
+    }
+
+    res_init();
+    _res.nsaddr_list[0] = dns.addr;
+    _res.nscount = 1;
+    _res.retry = 1;
+    _res.retrans = 1;
+    _res.options &= ~(RES_DNSRCH | RES_DEFNAMES);
+
+    srv::cache(16, 60, 60, 0);
+
+    // positive lookup answered from the srv record, then from cache
+    srv first("sip:cached.test");
+    assert(*first != NULL);
+    count = dns.queries;
+    assert(count > 0);
+    srv second("sip:cached.test");
+    assert(*second != NULL);
+    assert(dns.queries == count);
+    assert(Socket::equal(*first, *second));
+
+    // a failed lookup is cached as a negative result
+    srv third("sip:missing.test");
+    assert(*third == NULL);
+    count = dns.queries;
+    srv fourth("sip:missing.test");
+    assert(*fourth == NULL);
+    assert(dns.queries == count);
+
+    // numeric hosts are never sent to dns
+    srv fifth("sip:127.0.0.1:5060");
+    assert(*fifth != NULL);
+    assert(dns.queries == count);
+
+    // without a cache every lookup goes to dns again
+    srv::cache(0, 60, 60, 0);
+    srv sixth("sip:cached.test");
+    assert(*sixth != NULL);
+    assert(dns.queries > count);
+
+    // a miss that may not wait is resolved by the resolver thread
+    srv::cache(16, 60, 60, 0);
+    srv::startup();
+    srv seventh;
+    seventh.nowait();
+    seventh.set("sip:cached.test");
+    assert(*seventh == NULL);
+    assert(seventh.deferred());
+    for(tries = 0; tries < 100 && seventh.deferred(); ++tries) {
+        Thread::sleep(20);
+        seventh.set("sip:cached.test");
+    }
+    assert(!seventh.deferred());
+    assert(*seventh != NULL);
+    srv::shutdown();
+
+    // a full cache lets its oldest entry go rather than the new result
+    srv::cache(0, 60, 60, 0);
+    srv::cache(1, 60, 60, 0);
+    srv eighth("sip:cached.test");
+    assert(*eighth != NULL);
+    srv ninth("sip:missing.test");
+    assert(*ninth == NULL);
+    count = dns.queries;
+    srv tenth("sip:missing.test");
+    assert(*tenth == NULL);
+    assert(dns.queries == count);
+
+    dns.stop();
+    return 0;
+}
+
+#else
+
+extern "C" int main()
+{
+    return 0;
+}
+
+#endif
@@ -0,0 +1,220 @@
+// Copyright (C) 2006-2014 David Sugar, Tycho Softworks.
+// Copyright (C) 2015 Cherokees of Idaho.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+
+#ifndef DEBUG
+#define DEBUG
+#endif
+
+#include <sipwitch/sipwitch.h>
+
+#include <stdio.h>
+
+using namespace SIPWITCH_NAMESPACE;
+
+#define FUZZ_PASSES 20000
+#define FUZZ_BODY   320
+#define FUZZ_GUARD  16
+
+static const char *offer =
+    "v=0\r\n"
+    "o=- 1 1 IN IP4 10.0.0.1\r\n"
+    "s=-\r\n"
+    "c=IN IP4 10.0.0.1/127\r\n"
+    "t=0 0\r\n"
+    "m=audio 4000 RTP/AVP 0 8 101\r\n"
+    "c=in ip6 2001:db8::1\r\n"
+    "m=video 5000/2 RTP/AVP 31\r\n"
+    "a=rtpmap:101 telephone-event/8000\r\n";
+
+static const char *rewritten =
+    "v=0\r\n"
+    "o=- 1 1 IN IP4 10.0.0.1\r\n"
+    "s=-\r\n"
+    "c=IN IP4 192.0.2.1/127\r\n"
+    "t=0 0\r\n"
+    "m=audio 5000 RTP/AVP 0 8 101\r\n"
+    "c=in ip6 2001:db8::99\r\n"
+    "m=video 6000/2 RTP/AVP 31\r\n"
+    "a=rtpmap:101 telephone-event/8000\r\n";
+
+static const char *fragments[] = {
+    "c=IN IP4 ", "c=in ip6 ", "c=IN IP4", "c=IN IPX ", "m=audio ", "m=", "m=video 9/",
+    "10.0.0.1", "/127", "/", " ", "\t", "\r", "\n", "\r\n", "65535", "65536", "0",
+    "RTP/AVP 0", "a=rtpmap:0 PCMU/8000", "v=0", "99999999999"};
+
+// replaces every address and moves every port, so each hook is exercised
+class testFilter : public sdpfilter
+{
+public:
+    unsigned connects, medias;
+
+    testFilter(const char *source, char *target, size_t size) :
+    sdpfilter(source, target, size)
+        {connects = medias = 0;};
+
+protected:
+    bool connect(unsigned family, const char *address, size_t size);
+    bool media(unsigned port, unsigned count, const char *text, size_t size);
+};
+
+bool testFilter::connect(unsigned family, const char *address, size_t size)
+{
+    const char *replace = (family == 6) ? "2001:db8::99" : "192.0.2.1";
+
+    assert(family == 4 || family == 6);
+    assert(size > 0 && !memchr(address, '/', size) && !memchr(address, ' ', size));
+    ++connects;
+    return emit(replace, strlen(replace));
+}
+
+bool testFilter::media(unsigned port, unsigned count, const char *text, size_t size)
+{
+    char buf[32];
+
+    assert(port <= 65535 && size > 0);
+    ++medias;
+    if(count != 1 || memchr(text, '/', size))
+        snprintf(buf, sizeof(buf), "%u/%u", port + 1000, count);
+    else
+        snprintf(buf, sizeof(buf), "%u", port + 1000);
+    return emit(buf, strlen(buf));
+}
+
+static unsigned long seed = 1;
+
+static unsigned draw(unsigned range)
+{
+    seed = seed * 1103515245l + 12345l;
+    return (unsigned)((seed >> 16) % range);
+}
+
+// what the default filter should produce; every line ends in cr/lf.
+static size_t normalize(const char *source, char *target)
+{
+    size_t len = 0, end, line;
+
+    while(*source) {
+        end = 0;
+        while(source[end] && source[end] != '\n')
+            ++end;
+        line = end;
+        while(line && source[line - 1] == '\r')
+            --line;
+        memcpy(target + len, source, line);
+        len += line;
+        target[len++] = '\r';
+        target[len++] = '\n';
+        source += end;
+        if(*source)
+            ++source;
+    }
+    target[len] = 0;
+    return len;
+}
+
+static void fuzz(void)
+{
+    char body[FUZZ_BODY + 64];
+    char expect[(FUZZ_BODY + 64) * 2];
+    char buffer[(FUZZ_BODY + 64) * 2 + FUZZ_GUARD];
+    unsigned pass, size, pos;
+    size_t len, limit;
+    char *result;
+
+    for(pass = 0; pass < FUZZ_PASSES; ++pass) {
+        len = 0;
+        size = draw(FUZZ_BODY);
+        while(len < size) {
+            if(draw(4)) {
+                const char *frag = fragments[draw(sizeof(fragments) / sizeof(const char *))];
+                memcpy(body + len, frag, strlen(frag));
+                len += strlen(frag);
+            }
+            else
+                body[len++] = (char)(draw(255) + 1);
+        }
+        body[len] = 0;
+
+        len = normalize(body, expect);
+        limit = draw((unsigned)(len + 8)) + 1;
+        memset(buffer, 0x5a, sizeof(buffer));
+
+        sdpfilter copy(body, buffer, limit);
+        result = copy.rewrite();
+        for(pos = 0; pos < FUZZ_GUARD; ++pos)
+            assert(buffer[limit + pos] == 0x5a);
+        if(len < limit) {
+            assert(result == buffer);
+            assert(copy.size() == len);
+            assert(!strcmp(result, expect));
+        }
+        else
+            assert(result == NULL);
+
+        memset(buffer, 0x5a, sizeof(buffer));
+        testFilter test(body, buffer, limit);
+        result = test.rewrite();
+        for(pos = 0; pos < FUZZ_GUARD; ++pos)
+            assert(buffer[limit + pos] == 0x5a);
+        if(result) {
+            assert(strlen(result) == test.size());
+            assert(test.size() < limit);
+        }
+    }
+}
+
+extern "C" int main()
+{
+    char buffer[1024];
+    size_t pos, len;
+
+    // unchanged by default
+    sdpfilter copy(offer, buffer, sizeof(buffer));
+    assert(copy.rewrite() == buffer);
+    assert(!strcmp(buffer, offer));
+    assert(copy.size() == strlen(offer));
+
+    // lines always end in cr/lf
+    copy.set("v=0\ns=-\r\r\nt=0 0", buffer, sizeof(buffer));
+    assert(copy.rewrite() != NULL);
+    assert(!strcmp(buffer, "v=0\r\ns=-\r\nt=0 0\r\n"));
+
+    copy.set(NULL, buffer, sizeof(buffer));
+    assert(copy.rewrite() == buffer && buffer[0] == 0);
+
+    // connection addresses and media ports are rewritten in place
+    testFilter test(offer, buffer, sizeof(buffer));
+    assert(test.rewrite() != NULL);
+    assert(!strcmp(buffer, rewritten));
+    assert(test.connects == 2);
+    assert(test.medias == 2);
+
+    // too small a target fails without overrunning it
+    len = strlen(rewritten);
+    for(pos = 1; pos <= len; ++pos) {
+        memset(buffer, 0x5a, sizeof(buffer));
+        testFilter small(offer, buffer, pos);
+        assert(small.rewrite() == NULL);
+        assert(buffer[pos] == 0x5a);
+    }
+    testFilter exact(offer, buffer, len + 1);
+    assert(exact.rewrite() != NULL);
+    assert(!strcmp(buffer, rewritten));
+
+    fuzz();
+    return 0;
+}
@@ -1022,7 +1022,7 @@ static void server_control(void)
 
 static void call_instance(void)
 {
-    mapped_view<MappedCall> cr(CALL_MAP);
+    MappedCall::view cr(CALL_MAP);
     unsigned index = 0;
     char id[32];
     MappedCall map;
@@ -1044,7 +1044,7 @@ static void call_instance(void)
 
     time(&now);
     while(index < count) {
-        cr.copy(index++, map);
+        MappedSequence::copy<MappedCall>(map, cr(index++));
         if(!map.created)
             continue;
 
@@ -1068,7 +1068,7 @@ static void call_instance(void)
 
 static void call_range(void)
 {
-    mapped_view<MappedCall> cr(REGISTRY_MAP);
+    MappedCall::view cr(CALL_MAP);
     unsigned size;
     unsigned index = 0;
     char id[32];
@@ -1086,7 +1086,7 @@ static void call_range(void)
     response(buffer, size, "^[");
 
     while(index < count) {
-        cr.copy(index++, map);
+        MappedSequence::copy<MappedCall>(map, cr(index++));
 
         if(!map.created)
             continue;
@@ -1101,7 +1101,7 @@ static void call_range(void)
 
 static void stat_periodic(void)
 {
-    mapped_view<stats> sta(STAT_MAP);
+    stats::view sta(STAT_MAP);
     unsigned index = 0;
     stats map;
     char buffer[1024];
@@ -1118,7 +1118,7 @@ static void stat_periodic(void)
         fault(2, "Server Offline");
 
     while(index < count) {
-        sta.copy(index++, map);
+        MappedSequence::copy<stats>(map, sta(index++));
         if(!eq(map.id, cid))
             continue;
 
@@ -1134,7 +1134,7 @@ static void stat_periodic(void)
 
 static void stat_instance(void)
 {
-    mapped_view<stats> sta(STAT_MAP);
+    stats::view sta(STAT_MAP);
     unsigned index = 0;
     stats map;
     char buffer[1024];
@@ -1151,7 +1151,7 @@ static void stat_instance(void)
         fault(2, "Server Offline");
 
     while(index < count) {
-        sta.copy(index++, map);
+        MappedSequence::copy<stats>(map, sta(index++));
         if(!eq(map.id, cid))
             continue;
 
@@ -1167,7 +1167,7 @@ static void stat_instance(void)
 
 static void stat_range(void)
 {
-    mapped_view<stats> sta(STAT_MAP);
+    stats::view sta(STAT_MAP);
     unsigned size;
     unsigned index = 0;
     stats map;
@@ -1184,7 +1184,7 @@ static void stat_range(void)
     response(buffer, size, "^[");
 
     while(index < count) {
-        sta.copy(index++, map);
+        MappedSequence::copy<stats>(map, sta(index++));
         if(!map.id[0])
             continue;
 
@@ -1197,7 +1197,7 @@ static void stat_range(void)
 
 static void user_instance(void)
 {
-    mapped_view<MappedRegistry> reg(REGISTRY_MAP);
+    MappedRegistry::view reg(REGISTRY_MAP);
     unsigned index = 0;
     char ext[48];
     MappedRegistry map;
@@ -1262,7 +1262,7 @@ static void user_instance(void)
 
 static void user_range(void)
 {
-    mapped_view<MappedRegistry> reg(REGISTRY_MAP);
+    MappedRegistry::view reg(REGISTRY_MAP);
     unsigned size;
     unsigned index = 0;
     MappedRegistry map;
@@ -1331,7 +1331,7 @@ static void server_realm(void)
 
 static void server_status(void)
 {
-    mapped_view<MappedCall> cr(REGISTRY_MAP);
+    MappedCall::view cr(CALL_MAP);
     char *cp;
     unsigned index = 0;
     volatile const MappedCall *map;
@@ -1650,7 +1650,7 @@ static void info(void)
 
 static void dumpcalls(const char *id)
 {
-    mapped_view<MappedCall> calls(CALL_MAP);
+    MappedCall::view calls(CALL_MAP);
     unsigned count = calls.count();
     unsigned index = 0;
     MappedCall buffer;
@@ -1670,7 +1670,7 @@ static void dumpcalls(const char *id)
     time(&now);
 
     while(index < count) {
-        calls.copy(index++, buffer);
+        MappedSequence::copy<MappedCall>(buffer, calls(index++));
         if(!buffer.created)
             continue;
 
@@ -1693,7 +1693,7 @@ static void dumpcalls(const char *id)
 
 static void dumpstats(const char *id)
 {
-    mapped_view<stats> sta(STAT_MAP);
+    stats::view sta(STAT_MAP);
     unsigned count = sta.count();
     unsigned index = 0;
     stats buffer;
@@ -1712,7 +1712,7 @@ static void dumpstats(const char *id)
     time(&now);
 
     while(index < count) {
-        sta.copy(index++, buffer);
+        MappedSequence::copy<stats>(buffer, sta(index++));
         if(!buffer.id[0])
             continue;
         if(id && !eq(id, buffer.id))
@@ -1739,7 +1739,7 @@ static void dumpstats(const char *id)
 
 static void registry(const char *id)
 {
-    mapped_view<MappedRegistry> reg(REGISTRY_MAP);
+    MappedRegistry::view reg(REGISTRY_MAP);
     unsigned count = reg.count();
     unsigned index = 0;
     MappedRegistry buffer;
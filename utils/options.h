@@ -0,0 +1,40 @@
+// Copyright (C) 2008-2014 David Sugar, Tycho Softworks.
+// Copyright (C) 2015 Cherokees of Idaho.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// option parsing shared by the load and replay utilities, which take
+// their values either as -name=value or as -name value.
+
+#ifndef _SIPWITCH_UTILS_OPTIONS_H_
+#define _SIPWITCH_UTILS_OPTIONS_H_
+
+static const char *value(char ***argv, const char *name, const char *program)
+{
+    size_t len = strlen(name);
+    const char *cp = **argv;
+
+    if(!strncmp(cp, name, len) && cp[len] == '=')
+        return cp + len + 1;
+
+    if(strcmp(cp, name))
+        return NULL;
+
+    cp = *(++*argv);
+    if(!cp)
+        ucommon::shell::errexit(3, "*** %s: %s: missing value\n", program, name);
+    return cp;
+}
+
+#endif
@@ -324,7 +324,7 @@ static void status(char **argv)
 
     mapinit();
 
-    mapped_view<MappedCall> calls(*callmap);
+    MappedCall::view calls(*callmap);
     unsigned count = calls.count();
     unsigned index = 0;
     const volatile MappedCall *map;
@@ -351,10 +351,10 @@ static void calls(char **argv)
 
     mapinit();
 
-    mapped_view<MappedCall> calls(*callmap);
+    MappedCall::view calls(*callmap);
     unsigned count = calls.count();
     unsigned index = 0;
-    const volatile MappedCall *map;
+    MappedCall map;
     time_t now;
 
     if(!count)
@@ -362,15 +362,15 @@ static void calls(char **argv)
 
     time(&now);
     while(index < count) {
-        map = (const volatile MappedCall *)(calls(index++));
+        MappedSequence::copy<MappedCall>(map, calls(index++));
 
-        if(!map->created || !map->source[0])
+        if(!map.created || !map.source[0])
             continue;
 
-        if(map->active)
-            printf("%08x:%d %s %s \"%s\" -> %s; %ld sec(s)\n", map->sequence, map->cid, map->state + 1, map->source, map->display, map->target, (long)(now - map->active));
+        if(map.active)
+            printf("%08x:%d %s %s \"%s\" -> %s; %ld sec(s)\n", map.sequence, map.cid, map.state + 1, map.source, map.display, map.target, (long)(now - map.active));
         else
-            printf("%08x:%d %s %s \"%s\" -> none; %ld secs\n", map->sequence, map->cid, map->state + 1, map->source, map->display, (long)(now - map->created));
+            printf("%08x:%d %s %s \"%s\" -> none; %ld secs\n", map.sequence, map.cid, map.state + 1, map.source, map.display, (long)(now - map.created));
     }
     exit(0);
 }
@@ -384,31 +384,31 @@ static void periodic(char **argv)
 
     mapinit();
 
-    mapped_view<stats> sta(*statmap);
+    stats::view sta(*statmap);
     unsigned count = sta.count();
     unsigned index = 0;
-    const volatile stats *map;
+    stats map;
 
     if(!count)
         shell::errexit(10, "*** sipcontrol: pstats: offline\n");
 
     while(index < count) {
-        map = (const volatile stats *)(sta(index++));
+        MappedSequence::copy<stats>(map, sta(index++));
 
-        if(!map->id[0])
+        if(!map.id[0])
             continue;
 
-        if(map->limit)
-            snprintf(text, sizeof(text), "%-12s %05hu", map->id, map->limit);
+        if(map.limit)
+            snprintf(text, sizeof(text), "%-12s %05hu", map.id, map.limit);
         else
-            snprintf(text, sizeof(text), "%-12s -    ", map->id);
+            snprintf(text, sizeof(text), "%-12s -    ", map.id);
 
         for(unsigned entry = 0; entry < 2; ++entry) {
             size_t len = strlen(text);
             snprintf(text + len, sizeof(text) - len, " %07lu %05hu %05hu",
-                map->data[entry].pperiod,
-                map->data[entry].pmin,
-                map->data[entry].pmax);
+                map.data[entry].pperiod,
+                map.data[entry].pmin,
+                map.data[entry].pmax);
         }
         printf("%s\n", text);
     }
@@ -561,7 +561,7 @@ static void dumpstats(char **argv)
 
     mapinit();
 
-    mapped_view<stats> sta(*statmap);
+    stats::view sta(*statmap);
     unsigned count = sta.count();
     unsigned index = 0;
     stats map;
@@ -572,7 +572,7 @@ static void dumpstats(char **argv)
 
     time(&now);
     while(index < count) {
-        sta.copy(index++, map);
+        MappedSequence::copy<stats>(map, sta(index++));
         if(!map.id[0])
             continue;
 
@@ -609,7 +609,7 @@ static void registry(char **argv)
 {
     mapinit();
 
-    mapped_view<MappedRegistry> reg(*regmap);
+    MappedRegistry::view reg(*regmap);
     unsigned count = reg.count();
     unsigned found = 0, index = 0;
     MappedRegistry buffer;
@@ -767,6 +767,7 @@ static void usage(void)
         "  address <ipaddr>         Set public ip address\n"
         "  calls                    List active calls on server\n"
         "  check                    Server deadlock check\n"
+        "  capture <on|off|clear>   Set sip traffic capture for replay\n"
         "  concurrency <level>      Server concurrency level\n"
         "  contact                  Server contact config address\n"
         "  digest id [realm [type]] Compute a digest\n"
@@ -1026,7 +1027,7 @@ PROGRAM_MAIN(argc, argv)
     }
     else if(eq(*argv, "down") || eq(*argv, "restart") || eq(*argv, "abort"))
         single(argv, 0);
-    else if(eq(*argv, "verbose") || eq(*argv, "concurrency") || eq(*argv, "trace"))
+    else if(eq(*argv, "verbose") || eq(*argv, "concurrency") || eq(*argv, "trace") || eq(*argv, "capture"))
         level(argv, 10);
     else if(eq(*argv, "message"))
         message(argv);
@@ -0,0 +1,809 @@
+// Copyright (C) 2008-2014 David Sugar, Tycho Softworks.
+// Copyright (C) 2015 Cherokees of Idaho.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#undef  HAVE_CONFIG_H
+
+#include <sipwitch-config.h>
+#include <eXosip2/eXosip.h>
+#include <ucommon/ucommon.h>
+#include <sipwitch/timing.h>
+
+#define MAX_PENDING     4096
+#define MAX_STATUS      700
+#define INDEX_SIZE      1021
+
+static int verbose = 0;
+static int port = 0;
+static int family = AF_INET;
+static int protocol = IPPROTO_UDP;
+static const char *server = NULL;
+static const char *proxy = NULL;
+static const char *binding = NULL;
+static const char *secret = NULL;
+static const char *realm = NULL;
+static const char *scenario = "register";
+static unsigned timeout = 5000;
+static unsigned users = 10;
+static unsigned first = 100;
+static unsigned rate = 10;
+static unsigned duration = 10;
+static unsigned hold = 0;
+static unsigned expires = 300;
+
+#if defined(EXOSIP_OPT_BASE_OPTION) && !defined(EXOSIP_OPT_DONT_SEND_101)
+#define EXOSIP_API4
+#endif
+
+#ifdef  EXOSIP_API4
+#define EXOSIP_CONTEXT  context
+#define OPTION_CONTEXT  context,
+#define EXOSIP_LOCK     eXosip_lock(context);
+#define EXOSIP_UNLOCK   eXosip_unlock(context);
+static struct eXosip_t *context = NULL;
+#else
+#define EXOSIP_LOCK     eXosip_lock();
+#define EXOSIP_UNLOCK   eXosip_unlock();
+#define EXOSIP_CONTEXT
+#define OPTION_CONTEXT
+#endif
+
+using namespace ucommon;
+using sipwitch::timing;
+
+#include "options.h"
+
+#if defined(_MSWINDOWS_) && defined(__GNUC__)
+// binds addrinfo for mingw32 linkage since otherwise mingw32 cannot
+// cannot link proper getaddrinfo/freeaddrinfo calls that eXosip uses.
+static Socket::address localhost("127.0.0.1");
+#endif
+
+enum {IDLE = 0, REGISTERING, CALLING, MESSAGING};
+
+// requests are found by call-id, as a retry with credentials is a new
+// transaction, and are queued in the order they time out or hang up in.
+typedef struct slot {
+    struct slot *next, *prev;
+    struct slot *link;
+    int type;
+    int id;
+    int did;
+    unsigned user;
+    unsigned path;
+    unsigned retries;
+    bool answered;
+    unsigned long started;
+    unsigned long hangup;
+    char callid[64];
+} request_t;
+
+typedef struct {
+    request_t *head, *tail;
+} queue_t;
+
+typedef bool (*operation_t)(unsigned user, unsigned long now);
+
+static request_t pending[MAX_PENDING];
+static request_t *freelist = NULL;
+static request_t *callids[INDEX_SIZE];
+static request_t **registering = NULL;
+static queue_t waiting = {NULL, NULL};
+static queue_t holding = {NULL, NULL};
+static unsigned active = 0;
+static unsigned long status[MAX_STATUS];
+static unsigned long sent = 0;
+static unsigned long completed = 0;
+static unsigned long failed = 0;
+static unsigned long expired = 0;
+static unsigned long skipped = 0;
+static unsigned *samples = NULL;
+static unsigned long count = 0;
+static unsigned long limit = 0;
+static int *rids = NULL;
+static char registrar[256];
+static char route[256];
+static char local[64];
+
+static void identity(char *buf, size_t size, unsigned user)
+{
+    snprintf(buf, size, "sip:%u@%s", first + user, server);
+}
+
+// each simulated user is bound and reached at a contact of its own
+static void contact(char *buf, size_t size, unsigned user)
+{
+    snprintf(buf, size, "<sip:%u@%s:%d>", first + user, local, port);
+}
+
+static const char *callid(osip_message_t *msg)
+{
+    if(!msg->call_id || !msg->call_id->number)
+        return "";
+    return msg->call_id->number;
+}
+
+static void sdp(char *buf, size_t size)
+{
+    snprintf(buf, size,
+        "v=0\r\n"
+        "o=sipload 1 1 IN IP4 %s\r\n"
+        "s=-\r\n"
+        "c=IN IP4 %s\r\n"
+        "t=0 0\r\n"
+        "m=audio %d RTP/AVP 0\r\n"
+        "a=rtpmap:0 PCMU/8000\r\n", local, local, port + 2);
+}
+
+static unsigned keyindex(const char *id)
+{
+    unsigned key = 0;
+
+    while(*id)
+        key = (key * 31) + (unsigned char)*(id++);
+    return key % INDEX_SIZE;
+}
+
+static void enqueue(queue_t *qp, request_t *rp)
+{
+    rp->next = NULL;
+    rp->prev = qp->tail;
+    if(qp->tail)
+        qp->tail->next = rp;
+    else
+        qp->head = rp;
+    qp->tail = rp;
+}
+
+static void dequeue(queue_t *qp, request_t *rp)
+{
+    if(rp->prev)
+        rp->prev->next = rp->next;
+    else
+        qp->head = rp->next;
+    if(rp->next)
+        rp->next->prev = rp->prev;
+    else
+        qp->tail = rp->prev;
+    rp->next = rp->prev = NULL;
+}
+
+static request_t *request(void)
+{
+    request_t *rp = freelist;
+
+    if(!rp) {
+        ++skipped;
+        return NULL;
+    }
+    freelist = rp->next;
+    return rp;
+}
+
+static void recycle(request_t *rp)
+{
+    rp->next = freelist;
+    freelist = rp;
+}
+
+static void submit(request_t *rp, int type, int id, unsigned user, const char *cid, unsigned long now)
+{
+    rp->type = type;
+    rp->id = id;
+    rp->did = 0;
+    rp->user = user;
+    rp->retries = 0;
+    rp->answered = false;
+    rp->started = now;
+    String::set(rp->callid, sizeof(rp->callid), cid);
+    rp->path = keyindex(rp->callid);
+    rp->link = callids[rp->path];
+    callids[rp->path] = rp;
+    enqueue(&waiting, rp);
+    if(type == REGISTERING)
+        registering[user] = rp;
+    ++active;
+    ++sent;
+}
+
+static void release(request_t *rp)
+{
+    request_t **pp = &callids[rp->path];
+
+    while(*pp && *pp != rp)
+        pp = &(*pp)->link;
+    if(*pp)
+        *pp = rp->link;
+
+    if(rp->answered)
+        dequeue(&holding, rp);
+    else
+        dequeue(&waiting, rp);
+
+    if(rp->type == REGISTERING && registering[rp->user] == rp)
+        registering[rp->user] = NULL;
+
+    rp->type = IDLE;
+    recycle(rp);
+    --active;
+}
+
+static request_t *find(int type, eXosip_event_t *ev)
+{
+    request_t *rp;
+    const char *id;
+
+    if(!ev->request)
+        return NULL;
+
+    id = callid(ev->request);
+    for(rp = callids[keyindex(id)]; rp; rp = rp->link) {
+        if(rp->type == type && eq(rp->callid, id))
+            return rp;
+    }
+    return NULL;
+}
+
+static void complete(request_t *rp, int code, unsigned long now)
+{
+    if(code > 0 && code < MAX_STATUS)
+        ++status[code];
+
+    if(code < 200 || code > 299) {
+        ++failed;
+        return;
+    }
+
+    ++completed;
+    if(count < limit)
+        samples[count++] = (unsigned)(now - rp->started);
+}
+
+static void hangup(request_t *rp)
+{
+    EXOSIP_LOCK
+    eXosip_call_terminate(OPTION_CONTEXT rp->id, rp->did);
+    EXOSIP_UNLOCK
+    release(rp);
+}
+
+static bool registration(unsigned user, unsigned long now)
+{
+    osip_message_t *msg = NULL;
+    request_t *rp;
+    char from[256], uri[256], id[64];
+
+    // a user cannot refresh until its last register has completed
+    if(registering[user]) {
+        ++skipped;
+        return false;
+    }
+
+    rp = request();
+    if(!rp)
+        return false;
+
+    identity(from, sizeof(from), user);
+    contact(uri, sizeof(uri), user);
+    EXOSIP_LOCK
+    if(rids[user] > 0)
+        eXosip_register_build_register(OPTION_CONTEXT rids[user], expires, &msg);
+    else
+        rids[user] = eXosip_register_build_initial_register(OPTION_CONTEXT from, registrar, uri, expires, &msg);
+    if(!msg) {
+        EXOSIP_UNLOCK
+        if(rids[user] < 0)
+            rids[user] = 0;
+        recycle(rp);
+        ++failed;
+        return false;
+    }
+    String::set(id, sizeof(id), callid(msg));
+    eXosip_register_send_register(OPTION_CONTEXT rids[user], msg);
+    EXOSIP_UNLOCK
+    submit(rp, REGISTERING, rids[user], user, id, now);
+    return true;
+}
+
+static bool call(unsigned user, unsigned long now)
+{
+    osip_message_t *msg = NULL;
+    request_t *rp;
+    char from[256], to[256], uri[256], body[256], id[64];
+    int cid;
+
+    rp = request();
+    if(!rp)
+        return false;
+
+    identity(from, sizeof(from), user);
+    identity(to, sizeof(to), (user + users / 2) % users);
+    contact(uri, sizeof(uri), user);
+    EXOSIP_LOCK
+    eXosip_call_build_initial_invite(OPTION_CONTEXT &msg, to, from, route[0] ? route : NULL, "load test");
+    if(!msg) {
+        EXOSIP_UNLOCK
+        recycle(rp);
+        ++failed;
+        return false;
+    }
+    osip_list_special_free(&msg->contacts, (void (*)(void *))&osip_contact_free);
+    osip_message_set_contact(msg, uri);
+    sdp(body, sizeof(body));
+    osip_message_set_body(msg, body, strlen(body));
+    osip_message_set_content_type(msg, "application/sdp");
+    String::set(id, sizeof(id), callid(msg));
+    cid = eXosip_call_send_initial_invite(OPTION_CONTEXT msg);
+    EXOSIP_UNLOCK
+    if(cid <= 0) {
+        recycle(rp);
+        ++failed;
+        return false;
+    }
+    submit(rp, CALLING, cid, user, id, now);
+    return true;
+}
+
+static bool message(unsigned user, unsigned long now)
+{
+    osip_message_t *msg = NULL;
+    request_t *rp;
+    char from[256], to[256], body[64], id[64];
+
+    rp = request();
+    if(!rp)
+        return false;
+
+    identity(from, sizeof(from), user);
+    identity(to, sizeof(to), (user + users / 2) % users);
+    snprintf(body, sizeof(body), "load test %lu", sent);
+    EXOSIP_LOCK
+    eXosip_message_build_request(OPTION_CONTEXT &msg, "MESSAGE", to, from, route[0] ? route : NULL);
+    if(!msg || !msg->call_id || !msg->call_id->number) {
+        EXOSIP_UNLOCK
+        recycle(rp);
+        ++failed;
+        return false;
+    }
+    osip_message_set_body(msg, body, strlen(body));
+    osip_message_set_content_type(msg, "text/plain");
+    String::set(id, sizeof(id), callid(msg));
+    eXosip_message_send_request(OPTION_CONTEXT msg);
+    EXOSIP_UNLOCK
+    submit(rp, MESSAGING, 0, user, id, now);
+    return true;
+}
+
+static void answer(eXosip_event_t *ev)
+{
+    osip_message_t *msg = NULL;
+    char body[256];
+
+    EXOSIP_LOCK
+    eXosip_call_build_answer(OPTION_CONTEXT ev->tid, 200, &msg);
+    if(msg) {
+        sdp(body, sizeof(body));
+        osip_message_set_body(msg, body, strlen(body));
+        osip_message_set_content_type(msg, "application/sdp");
+        eXosip_call_send_answer(OPTION_CONTEXT ev->tid, 200, msg);
+    }
+    else
+        eXosip_call_send_answer(OPTION_CONTEXT ev->tid, 500, NULL);
+    EXOSIP_UNLOCK
+}
+
+static void dispatch(eXosip_event_t *ev, unsigned long now)
+{
+    osip_message_t *msg = NULL;
+    request_t *rp = NULL;
+    int code = 0;
+    int error;
+
+    if(ev->response)
+        code = ev->response->status_code;
+
+    switch(ev->type) {
+    case EXOSIP_REGISTRATION_SUCCESS:
+    case EXOSIP_REGISTRATION_FAILURE:
+        rp = find(REGISTERING, ev);
+        break;
+    case EXOSIP_CALL_ANSWERED:
+    case EXOSIP_CALL_NOANSWER:
+    case EXOSIP_CALL_REQUESTFAILURE:
+    case EXOSIP_CALL_SERVERFAILURE:
+    case EXOSIP_CALL_GLOBALFAILURE:
+        rp = find(CALLING, ev);
+        break;
+    case EXOSIP_MESSAGE_ANSWERED:
+    case EXOSIP_MESSAGE_REQUESTFAILURE:
+    case EXOSIP_MESSAGE_SERVERFAILURE:
+    case EXOSIP_MESSAGE_GLOBALFAILURE:
+        if(ev->request && MSG_IS_MESSAGE(ev->request))
+            rp = find(MESSAGING, ev);
+        break;
+    case EXOSIP_CALL_INVITE:
+        // we are also the callee when the server forwards to our contact
+        answer(ev);
+        return;
+    case EXOSIP_MESSAGE_NEW:
+        EXOSIP_LOCK
+        eXosip_message_build_answer(OPTION_CONTEXT ev->tid, 200, &msg);
+        if(msg)
+            eXosip_message_send_answer(OPTION_CONTEXT ev->tid, 200, msg);
+        EXOSIP_UNLOCK
+        return;
+    default:
+        return;
+    }
+
+    if(!rp || rp->answered)
+        return;
+
+    // the first challenge is answered with our credentials...
+    if((code == 401 || code == 407) && !rp->retries++) {
+        EXOSIP_LOCK
+        error = eXosip_default_action(OPTION_CONTEXT ev);
+        EXOSIP_UNLOCK
+        if(!error)
+            return;
+    }
+
+    if(ev->type == EXOSIP_CALL_NOANSWER && !code)
+        code = 408;
+
+    if(verbose && (code < 200 || code > 299))
+        fprintf(stderr, "sipload: request failed; status=%d\n", code);
+
+    complete(rp, code, now);
+    if(ev->type != EXOSIP_CALL_ANSWERED) {
+        release(rp);
+        return;
+    }
+
+    EXOSIP_LOCK
+    eXosip_call_build_ack(OPTION_CONTEXT ev->did, &msg);
+    if(msg)
+        eXosip_call_send_ack(OPTION_CONTEXT ev->did, msg);
+    EXOSIP_UNLOCK
+
+    rp->did = ev->did;
+    if(hold) {
+        dequeue(&waiting, rp);
+        rp->answered = true;
+        rp->hangup = now + hold;
+        enqueue(&holding, rp);
+        return;
+    }
+    hangup(rp);
+}
+
+// every call is held for the same time and every request is given the
+// same timeout, so both queues are in order and we stop at the first
+// one that is not yet due.
+static void expire(unsigned long now, bool ending)
+{
+    request_t *rp;
+
+    while(NULL != (rp = holding.head)) {
+        if(!ending && (long)(now - rp->hangup) < 0)
+            break;
+        hangup(rp);
+    }
+
+    while(NULL != (rp = waiting.head)) {
+        if(now - rp->started < timeout)
+            break;
+        ++expired;
+        if(rp->type == CALLING)
+            hangup(rp);
+        else
+            release(rp);
+    }
+}
+
+// requests are issued at a fixed rate rather than as fast as answered, so
+// server latency shows up in the results rather than in our offered load.
+static unsigned long run(operation_t op, unsigned long length, unsigned total)
+{
+    unsigned long start = timing::mstime(), now = start;
+    unsigned long issued = 0, due;
+    eXosip_event_t *ev;
+
+    for(;;) {
+        now = timing::mstime();
+        if((!length || now - start < length) && (!total || issued < total)) {
+            due = ((now - start) * rate) / 1000l + 1;
+            if(total && due > total)
+                due = total;
+            while(issued < due)
+                op((unsigned)(issued++ % users), now);
+            expire(now, false);
+        }
+        else if(!active)
+            break;
+        else
+            expire(now, true);
+
+        ev = eXosip_event_wait(OPTION_CONTEXT 0, 5);
+        if(ev) {
+            dispatch(ev, timing::mstime());
+            eXosip_event_free(ev);
+        }
+    }
+    return now - start;
+}
+
+static void report(unsigned long elapsed)
+{
+    unsigned code;
+
+    if(!elapsed)
+        elapsed = 1;
+
+    printf("%s: %u users at %u/sec for %lu.%03lu seconds\n", scenario,
+        users, rate, elapsed / 1000, elapsed % 1000);
+    printf("  sent:      %lu\n", sent);
+    printf("  completed: %lu (%.1f/sec)\n", completed, (completed * 1000.0) / elapsed);
+    printf("  failed:    %lu\n", failed);
+    printf("  timeouts:  %lu\n", expired);
+    printf("  skipped:   %lu\n", skipped);
+    if(count) {
+        timing::sort(samples, count);
+        printf("  latency:   min=%u p50=%u p90=%u p99=%u max=%u ms\n",
+            samples[0], timing::percentile(samples, count, 50), timing::percentile(samples, count, 90), timing::percentile(samples, count, 99), samples[count - 1]);
+    }
+    for(code = 100; code < MAX_STATUS; ++code) {
+        if(status[code])
+            printf("  status %u: %lu\n", code, status[code]);
+    }
+}
+
+static void reset(void)
+{
+    memset(status, 0, sizeof(status));
+    sent = completed = failed = expired = skipped = count = 0;
+}
+
+static unsigned number(const char *cp, const char *name)
+{
+    unsigned result = atoi(cp);
+
+    if(!result)
+        shell::errexit(3, "*** sipload: %s: invalid number\n", name);
+    return result;
+}
+
+PROGRAM_MAIN(argc, argv)
+{
+    const char *cp;
+    operation_t op = registration;
+    unsigned long elapsed;
+    unsigned user;
+    char id[16];
+
+    cp = getenv("SIP_PROXY");
+    if(cp)
+        proxy = cp;
+
+    cp = getenv("SIP_SERVER");
+    if(cp)
+        server = cp;
+
+    while(NULL != *(++argv)) {
+        if(!strcmp(*argv, "--")) {
+            ++argv;
+            break;
+        }
+
+        if(!strncmp(*argv, "--", 2))
+            ++*argv;
+
+        if(!strcmp(*argv, "-q") || !strcmp(*argv, "-quiet")) {
+            verbose = 0;
+            continue;
+        }
+
+        if(!strcmp(*argv, "-version")) {
+            printf("sipload 0.1\n"
+                "Copyright (C) 2015 Cherokees of Idaho\n"
+                "License GPLv3+: GNU GPL version 3 or later <http://gnu.org/licenses/gpl.html>\n"
+                "This is free software: you are free to change and redistribute it.\n"
+                "There is NO WARRANTY, to the extent permitted by law.\n");
+            exit(0);
+        }
+
+        if(!strcmp(*argv, "-v") || !strcmp(*argv, "-verbose")) {
+            verbose = 1;
+            continue;
+        }
+
+        if(NULL != (cp = value(&argv, "-users", "sipload"))) {
+            users = number(cp, "users");
+            continue;
+        }
+
+        if(NULL != (cp = value(&argv, "-first", "sipload"))) {
+            first = number(cp, "first");
+            continue;
+        }
+
+        if(NULL != (cp = value(&argv, "-rate", "sipload"))) {
+            rate = number(cp, "rate");
+            continue;
+        }
+
+        if(NULL != (cp = value(&argv, "-duration", "sipload"))) {
+            duration = number(cp, "duration");
+            continue;
+        }
+
+        if(NULL != (cp = value(&argv, "-hold", "sipload"))) {
+            hold = atoi(cp);
+            continue;
+        }
+
+        if(NULL != (cp = value(&argv, "-expires", "sipload"))) {
+            expires = number(cp, "expires");
+            continue;
+        }
+
+        if(NULL != (cp = value(&argv, "-timeout", "sipload"))) {
+            timeout = number(cp, "timeout") * 1000;
+            continue;
+        }
+
+        if(NULL != (cp = value(&argv, "-port", "sipload"))) {
+            port = number(cp, "port");
+            continue;
+        }
+
+        if(NULL != (cp = value(&argv, "-proxy", "sipload"))) {
+            proxy = cp;
+            continue;
+        }
+
+        if(NULL != (cp = value(&argv, "-server", "sipload"))) {
+            server = cp;
+            continue;
+        }
+
+        if(NULL != (cp = value(&argv, "-secret", "sipload"))) {
+            secret = cp;
+            continue;
+        }
+
+        if(NULL != (cp = value(&argv, "-realm", "sipload"))) {
+            realm = cp;
+            continue;
+        }
+
+        if(!strcmp(*argv, "-?") || !strcmp(*argv, "-h") || !strcmp(*argv, "-help")) {
+            fprintf(stderr, "usage: sipload [options] [register|call|message]\n"
+                "[options]\n"
+                "  -server   sip:server[:port]\n"
+                "  -proxy    sip:proxyhost[:port]\n"
+                "  -port     port-number\n"
+                "  -users    count\n"
+                "  -first    userid\n"
+                "  -secret   password\n"
+                "  -realm    realm\n"
+                "  -rate     requests-per-second\n"
+                "  -duration seconds\n"
+                "  -hold     call-milliseconds\n"
+                "  -expires  seconds\n"
+                "  -timeout  seconds\n"
+                "  -verbose\n"
+                "Report bugs to sipwitch-devel@gnu.org\n");
+            exit(3);
+        }
+
+        if(**argv == '-')
+            shell::errexit(3, "*** sipload: %s: unknown option\n", *argv);
+
+        break;
+    }
+
+    if(*argv)
+        scenario = *(argv++);
+
+    if(*argv)
+        shell::errexit(3, "use: sipload [options] [register|call|message]\n");
+
+    if(eq(scenario, "call"))
+        op = call;
+    else if(eq(scenario, "message"))
+        op = message;
+    else if(!eq(scenario, "register"))
+        shell::errexit(3, "*** sipload: %s: unknown scenario\n", scenario);
+
+#if defined(WIN32) || defined(_WIn32)
+    if(!port)
+        port = 5060;
+#else
+    if(!port)
+        port = 5060 + getuid();
+#endif
+
+    if(server && !strncmp(server, "sip:", 4))
+        server += 4;
+
+    if(server == NULL)
+        server = "127.0.0.1";
+
+    if(proxy && !strncmp(proxy, "sip:", 4))
+        proxy += 4;
+
+    if(proxy) {
+        snprintf(registrar, sizeof(registrar), "sip:%s", proxy);
+        snprintf(route, sizeof(route), "<sip:%s;lr>", proxy);
+    }
+    else
+        snprintf(registrar, sizeof(registrar), "sip:%s", server);
+
+    limit = (unsigned long)rate * duration + users + 1;
+    samples = new unsigned[limit];
+    rids = new int[users];
+    memset(rids, 0, sizeof(int) * users);
+    registering = new request_t *[users];
+    memset(registering, 0, sizeof(request_t *) * users);
+    for(user = 0; user < MAX_PENDING; ++user)
+        recycle(&pending[user]);
+
+#ifdef  EXOSIP_API4
+    context = eXosip_malloc();
+#endif
+
+    if(eXosip_init(EXOSIP_CONTEXT))
+        shell::errexit(3, "*** sipload: failed exosip init\n");
+
+    if(eXosip_listen_addr(OPTION_CONTEXT protocol, binding, port, family, 0)) {
+        if(!binding)
+            binding = "*";
+        shell::errexit(3, "*** sipload: failed to listen %s:%d\n", binding, port);
+    }
+
+    eXosip_set_user_agent(OPTION_CONTEXT "SIPW/sipload");
+    if(eXosip_guess_localip(OPTION_CONTEXT family, local, sizeof(local)))
+        String::set(local, sizeof(local), "127.0.0.1");
+
+    if(secret) {
+        EXOSIP_LOCK
+        for(user = 0; user < users; ++user) {
+            snprintf(id, sizeof(id), "%u", first + user);
+            eXosip_add_authentication_info(OPTION_CONTEXT id, id, secret, NULL, realm);
+        }
+        EXOSIP_UNLOCK
+    }
+
+    // calls and messages need every simulated user reachable first
+    if(op != registration) {
+        run(registration, 0, users);
+        if(completed < users)
+            fprintf(stderr, "sipload: only %lu of %u users registered\n", completed, users);
+        reset();
+    }
+
+    elapsed = run(op, duration * 1000l, 0);
+    report(elapsed);
+
+    EXOSIP_LOCK
+    for(user = 0; user < users; ++user) {
+        if(rids[user] > 0)
+            eXosip_register_remove(OPTION_CONTEXT rids[user]);
+    }
+    EXOSIP_UNLOCK
+    eXosip_quit(EXOSIP_CONTEXT);
+    PROGRAM_EXIT(failed || expired ? 1 : 0);
+}
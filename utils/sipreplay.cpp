@@ -0,0 +1,599 @@
+// Copyright (C) 2008-2014 David Sugar, Tycho Softworks.
+// Copyright (C) 2015 Cherokees of Idaho.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#undef  HAVE_CONFIG_H
+
+#include <sipwitch-config.h>
+#include <ucommon/ucommon.h>
+#include <sipwitch/timing.h>
+
+#define MAX_MESSAGE     65536
+#define MAX_KEY         192
+#define INDEX_SIZE      1021
+
+using namespace ucommon;
+using sipwitch::timing;
+
+#include "options.h"
+
+static int verbose = 0;
+static int port = 0;
+static const char *server = NULL;
+static double speed = 1.0;
+static unsigned timeout = 5000;
+
+typedef struct {
+    char dir;
+    unsigned long msec;
+    unsigned port;
+    char host[64];
+    const char *text;
+    size_t len;
+} record_t;
+
+typedef struct exchange {
+    struct exchange *next;
+    char key[MAX_KEY];
+    unsigned expected;
+    unsigned status;
+    unsigned long requested;
+    unsigned long captured;
+    unsigned long sent;
+    unsigned long latency;
+} exchange_t;
+
+static record_t *records = NULL;
+static unsigned total = 0;
+static exchange_t *exchanges = NULL;
+static unsigned active = 0;
+static exchange_t *keys[INDEX_SIZE];
+static unsigned long injected = 0;
+static unsigned long received = 0;
+static unsigned long unexpected = 0;
+static unsigned long requests = 0;
+static unsigned answered = 0;
+static char tag[16];
+
+static bool named(const char *line, const char *colon, const char *name, const char *alt)
+{
+    size_t nlen = colon - line;
+
+    while(nlen && isspace(line[nlen - 1]))
+        --nlen;
+
+    if(nlen == strlen(name) && !strncasecmp(line, name, nlen))
+        return true;
+
+    if(alt && nlen == strlen(alt) && !strncasecmp(line, alt, nlen))
+        return true;
+
+    return false;
+}
+
+// find a header in the head of a message by either its full or its
+// compact name, and return its value trimmed of whitespace.
+static bool header(const char *msg, size_t len, const char *name, const char *alt, char *buf, size_t size)
+{
+    const char *end = msg + len;
+    const char *line = strchr(msg, '\n');
+    const char *next, *cp;
+    size_t nlen;
+
+    while(line && ++line < end && *line != '\r' && *line != '\n') {
+        next = strchr(line, '\n');
+        if(!next)
+            next = end;
+        cp = strchr(line, ':');
+        if(cp && cp < next && named(line, cp, name, alt)) {
+            ++cp;
+            while(cp < next && isspace(*cp))
+                ++cp;
+            nlen = next - cp;
+            while(nlen && isspace(cp[nlen - 1]))
+                --nlen;
+            if(nlen >= size)
+                nlen = size - 1;
+            memcpy(buf, cp, nlen);
+            buf[nlen] = 0;
+            return true;
+        }
+        line = next;
+        if(line >= end)
+            break;
+    }
+    return false;
+}
+
+// transactions are matched by call-id and cseq, since the via branch of
+// an injected request is our own rather than the one that was captured.
+static bool key(const char *msg, size_t len, char *buf, size_t size)
+{
+    char callid[128], cseq[64], method[32];
+    unsigned long seq;
+
+    if(!header(msg, len, "Call-ID", "i", callid, sizeof(callid)))
+        return false;
+
+    if(!header(msg, len, "CSeq", NULL, cseq, sizeof(cseq)))
+        return false;
+
+    if(sscanf(cseq, "%lu %31s", &seq, method) != 2)
+        return false;
+
+    snprintf(buf, size, "%s %lu %s", callid, seq, method);
+    return true;
+}
+
+static unsigned status(const char *msg)
+{
+    if(strncmp(msg, "SIP/2.0 ", 8))
+        return 0;
+    return atoi(msg + 8);
+}
+
+static exchange_t *find(const char *id)
+{
+    unsigned path = NamedObject::keyindex(id, INDEX_SIZE);
+    exchange_t *xp = keys[path];
+
+    while(xp) {
+        if(eq(xp->key, id))
+            return xp;
+        xp = xp->next;
+    }
+    return NULL;
+}
+
+static exchange_t *create(const char *id)
+{
+    unsigned path = NamedObject::keyindex(id, INDEX_SIZE);
+    exchange_t *xp = &exchanges[active++];
+
+    memset(xp, 0, sizeof(exchange_t));
+    String::set(xp->key, sizeof(xp->key), id);
+    xp->next = keys[path];
+    keys[path] = xp;
+    return xp;
+}
+
+static void load(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    char *data, *cp, *nl;
+    long size;
+    unsigned count = 0, pass;
+    unsigned long len;
+    record_t entry, *rp;
+
+    if(!fp)
+        shell::errexit(1, "*** sipreplay: %s: cannot open\n", path);
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data = (char *)malloc(size + 1);
+    if(!data || fread(data, 1, size, fp) != (size_t)size)
+        shell::errexit(1, "*** sipreplay: %s: cannot read\n", path);
+    data[size] = 0;
+    fclose(fp);
+
+    // count records first, then parse them into the table
+    for(pass = 0; pass < 2; ++pass) {
+        if(pass) {
+            records = new record_t[count];
+            total = count;
+            count = 0;
+        }
+        cp = data;
+        while(cp < data + size) {
+            nl = strchr(cp, '\n');
+            if(*cp != '@' || !nl)
+                shell::errexit(2, "*** sipreplay: %s: corrupt at offset %ld\n", path, (long)(cp - data));
+            rp = &entry;
+            if(pass)
+                rp = &records[count];
+            if(sscanf(cp, "@%c %lu %63s %u %lu", &rp->dir, &rp->msec, rp->host, &rp->port, &len) != 5 || nl + 1 + len >= data + size)
+                shell::errexit(2, "*** sipreplay: %s: corrupt at offset %ld\n", path, (long)(cp - data));
+            rp->text = nl + 1;
+            rp->len = len;
+            cp = nl + 1 + len + 1;
+            ++count;
+        }
+    }
+}
+
+// find what each captured request was answered with, and how quickly,
+// so replayed responses can be judged against them.
+static void prepare(void)
+{
+    char id[MAX_KEY];
+    exchange_t *xp;
+    record_t *rp;
+    unsigned pos, code;
+
+    exchanges = new exchange_t[total];
+    for(pos = 0; pos < total; ++pos) {
+        rp = &records[pos];
+        if(!key(rp->text, rp->len, id, sizeof(id)))
+            continue;
+
+        code = status(rp->text);
+        if(rp->dir == '<' && !code) {
+            if(!strncmp(rp->text, "ACK ", 4) || find(id))
+                continue;
+            xp = create(id);
+            xp->requested = rp->msec;
+        }
+        else if(rp->dir == '>' && code >= 200) {
+            xp = find(id);
+            if(xp && !xp->expected) {
+                xp->expected = code;
+                xp->captured = rp->msec - xp->requested;
+            }
+        }
+    }
+}
+
+// replace the sent-by of the top via with our own socket, keeping the
+// captured branch with a suffix unique to this run so an ack still
+// matches its invite but a replay never collides with the original.
+static size_t rewrite(const record_t *rp, char *buf, size_t size, unsigned local)
+{
+    const char *text = rp->text, *end = rp->text + rp->len;
+    const char *line = strchr(text, '\n');
+    const char *next, *cp, *bp;
+    char branch[96];
+    size_t len, blen;
+    int used;
+
+    while(line && ++line < end && *line != '\r' && *line != '\n') {
+        next = strchr(line, '\n');
+        if(!next || next > end)
+            break;
+        cp = strchr(line, ':');
+        if(cp && cp < next && named(line, cp, "Via", "v")) {
+            branch[0] = 0;
+            bp = strstr(line, "branch=");
+            if(bp && bp < next) {
+                bp += 7;
+                blen = strcspn(bp, ";,\r\n \t");
+                if(blen >= sizeof(branch) - sizeof(tag))
+                    blen = sizeof(branch) - sizeof(tag) - 1;
+                memcpy(branch, bp, blen);
+                branch[blen] = 0;
+            }
+            else
+                String::set(branch, sizeof(branch), "z9hG4bK");
+
+            // keep any further via values folded into the same line
+            bp = strchr(cp, ',');
+            if(!bp || bp > next)
+                bp = next;
+            while(bp > line && (bp[-1] == '\r' || bp[-1] == '\n'))
+                --bp;
+
+            len = line - text;
+            if(len >= size)
+                return 0;
+            memcpy(buf, text, len);
+            used = snprintf(buf + len, size - len, "Via: SIP/2.0/UDP 127.0.0.1:%u;rport;branch=%s%s", local, branch, tag);
+            if(used < 0 || len + used >= size)
+                return 0;
+            len += used;
+            if(len + (end - bp) >= size)
+                return 0;
+            memcpy(buf + len, bp, end - bp);
+            return len + (end - bp);
+        }
+        line = next;
+    }
+
+    if(rp->len >= size)
+        return 0;
+    memcpy(buf, text, rp->len);
+    return rp->len;
+}
+
+static void receive(int so, unsigned long now)
+{
+    char buf[MAX_MESSAGE], id[MAX_KEY];
+    ssize_t len;
+    unsigned code;
+    exchange_t *xp;
+
+    len = ::recvfrom(so, buf, sizeof(buf) - 1, 0, NULL, NULL);
+    if(len < 1)
+        return;
+
+    buf[len] = 0;
+    ++received;
+    code = status(buf);
+    if(!code) {
+        // requests the server originates towards us are not answered
+        ++requests;
+        return;
+    }
+
+    if(code < 200)
+        return;
+
+    if(!key(buf, len, id, sizeof(id)) || NULL == (xp = find(id)) || !xp->sent) {
+        ++unexpected;
+        return;
+    }
+
+    if(xp->status)
+        return;
+
+    xp->status = code;
+    xp->latency = now - xp->sent;
+    ++answered;
+}
+
+static void collect(int so, unsigned long until)
+{
+    fd_set rfd;
+    struct timeval tv;
+    unsigned long now = timing::mstime();
+
+    do {
+        FD_ZERO(&rfd);
+        FD_SET(so, &rfd);
+        tv.tv_sec = 0;
+        tv.tv_usec = 0;
+        if((long)(until - now) > 0) {
+            tv.tv_sec = (until - now) / 1000l;
+            tv.tv_usec = ((until - now) % 1000l) * 1000l;
+        }
+        if(::select(so + 1, &rfd, NULL, NULL, &tv) > 0)
+            receive(so, timing::mstime());
+        now = timing::mstime();
+    } while((long)(until - now) > 0);
+}
+
+// captured requests are sent at their original spacing, scaled by the
+// replay speed, while responses are collected between them.
+static unsigned long replay(int so, struct sockaddr *target, socklen_t tlen, unsigned local)
+{
+    char buf[MAX_MESSAGE], id[MAX_KEY];
+    unsigned long start = timing::mstime(), base = 0, due, now;
+    unsigned pos;
+    size_t len;
+    record_t *rp;
+    exchange_t *xp;
+
+    for(pos = 0; pos < total; ++pos) {
+        rp = &records[pos];
+        if(rp->dir != '<' || status(rp->text))
+            continue;
+
+        if(!base)
+            base = rp->msec;
+
+        if(speed > 0.0) {
+            due = start + (unsigned long)((rp->msec - base) / speed);
+            collect(so, due);
+        }
+        else
+            collect(so, 0);
+
+        len = rewrite(rp, buf, sizeof(buf), local);
+        if(!len)
+            continue;
+
+        now = timing::mstime();
+        if(::sendto(so, buf, len, 0, target, tlen) < 0)
+            continue;
+
+        ++injected;
+        if(key(rp->text, rp->len, id, sizeof(id)) && NULL != (xp = find(id)) && !xp->sent)
+            xp->sent = now;
+    }
+
+    // give outstanding requests a chance to be answered
+    now = timing::mstime();
+    while(answered < active && timing::mstime() - now < timeout)
+        collect(so, timing::mstime() + 50);
+
+    return timing::mstime() - start;
+}
+
+static int report(unsigned long elapsed)
+{
+    unsigned long *before = new unsigned long[active + 1];
+    unsigned long *after = new unsigned long[active + 1];
+    unsigned bcount = 0, acount = 0, pos;
+    unsigned long matched = 0, mismatched = 0, missing = 0, unchecked = 0;
+    exchange_t *xp;
+
+    for(pos = 0; pos < active; ++pos) {
+        xp = &exchanges[pos];
+        if(!xp->sent)
+            continue;
+        if(xp->expected)
+            before[bcount++] = xp->captured;
+        if(xp->status)
+            after[acount++] = xp->latency;
+
+        if(!xp->expected)
+            ++unchecked;
+        else if(!xp->status) {
+            ++missing;
+            if(verbose)
+                printf("missing %s: expected %u\n", xp->key, xp->expected);
+        }
+        else if(xp->status != xp->expected) {
+            ++mismatched;
+            if(verbose)
+                printf("mismatch %s: expected %u, got %u\n", xp->key, xp->expected, xp->status);
+        }
+        else
+            ++matched;
+    }
+
+    printf("replay: %u records in %lu.%03lu seconds at %.1fx\n", total,
+        elapsed / 1000, elapsed % 1000, speed);
+    printf("  injected:   %lu\n", injected);
+    printf("  received:   %lu\n", received);
+    printf("  matched:    %lu\n", matched);
+    printf("  mismatched: %lu\n", mismatched);
+    printf("  missing:    %lu\n", missing);
+    printf("  unchecked:  %lu\n", unchecked);
+    printf("  unexpected: %lu\n", unexpected);
+    printf("  requests:   %lu\n", requests);
+    if(bcount) {
+        timing::sort(before, bcount);
+        printf("  captured:   p50=%lu p99=%lu max=%lu ms\n",
+            timing::percentile(before, bcount, 50), timing::percentile(before, bcount, 99), before[bcount - 1]);
+    }
+    if(acount) {
+        timing::sort(after, acount);
+        printf("  replayed:   p50=%lu p99=%lu max=%lu ms\n",
+            timing::percentile(after, acount, 50), timing::percentile(after, acount, 99), after[acount - 1]);
+    }
+
+    delete[] before;
+    delete[] after;
+
+    if(mismatched || missing)
+        return 1;
+    return 0;
+}
+
+PROGRAM_MAIN(argc, argv)
+{
+    const char *cp;
+    char host[256];
+    char *sp;
+    unsigned sport = 5060;
+    unsigned long elapsed;
+    struct sockaddr_in local;
+    socklen_t llen = sizeof(local);
+    struct sockaddr *target;
+    int so;
+
+    cp = getenv("SIP_SERVER");
+    if(cp)
+        server = cp;
+
+    while(NULL != *(++argv)) {
+        if(!strcmp(*argv, "--")) {
+            ++argv;
+            break;
+        }
+
+        if(!strncmp(*argv, "--", 2))
+            ++*argv;
+
+        if(!strcmp(*argv, "-q") || !strcmp(*argv, "-quiet")) {
+            verbose = 0;
+            continue;
+        }
+
+        if(!strcmp(*argv, "-version")) {
+            printf("sipreplay 0.1\n"
+                "Copyright (C) 2015 Cherokees of Idaho\n"
+                "License GPLv3+: GNU GPL version 3 or later <http://gnu.org/licenses/gpl.html>\n"
+                "This is free software: you are free to change and redistribute it.\n"
+                "There is NO WARRANTY, to the extent permitted by law.\n");
+            exit(0);
+        }
+
+        if(!strcmp(*argv, "-v") || !strcmp(*argv, "-verbose")) {
+            verbose = 1;
+            continue;
+        }
+
+        if(NULL != (cp = value(&argv, "-speed", "sipreplay"))) {
+            speed = atof(cp);
+            if(speed < 0.0)
+                shell::errexit(3, "*** sipreplay: speed: invalid number\n");
+            continue;
+        }
+
+        if(NULL != (cp = value(&argv, "-timeout", "sipreplay"))) {
+            timeout = atoi(cp) * 1000;
+            continue;
+        }
+
+        if(NULL != (cp = value(&argv, "-port", "sipreplay"))) {
+            port = atoi(cp);
+            continue;
+        }
+
+        if(NULL != (cp = value(&argv, "-server", "sipreplay"))) {
+            server = cp;
+            continue;
+        }
+
+        if(!strcmp(*argv, "-?") || !strcmp(*argv, "-h") || !strcmp(*argv, "-help")) {
+            fprintf(stderr, "usage: sipreplay [options] capture-file\n"
+                "[options]\n"
+                "  -server   sip:server[:port]\n"
+                "  -port     port-number\n"
+                "  -speed    factor (0 for no delay)\n"
+                "  -timeout  seconds\n"
+                "  -verbose\n"
+                "Report bugs to sipwitch-devel@gnu.org\n");
+            exit(3);
+        }
+
+        if(**argv == '-')
+            shell::errexit(3, "*** sipreplay: %s: unknown option\n", *argv);
+
+        break;
+    }
+
+    if(!*argv || argv[1])
+        shell::errexit(3, "use: sipreplay [options] capture-file\n");
+
+    if(server && !strncmp(server, "sip:", 4))
+        server += 4;
+
+    if(server == NULL)
+        server = "127.0.0.1";
+
+    String::set(host, sizeof(host), server);
+    sp = strrchr(host, ':');
+    if(sp) {
+        *(sp++) = 0;
+        sport = atoi(sp);
+    }
+
+    Socket::address addr(host, sport);
+    target = addr.getAddr();
+    if(!target || target->sa_family != AF_INET)
+        shell::errexit(3, "*** sipreplay: %s: cannot resolve ipv4 address\n", server);
+
+    load(*argv);
+    prepare();
+
+    so = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if(so < 0)
+        shell::errexit(3, "*** sipreplay: cannot create socket\n");
+
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    local.sin_port = htons(port);
+    if(::bind(so, (struct sockaddr *)&local, sizeof(local)) || getsockname(so, (struct sockaddr *)&local, &llen))
+        shell::errexit(3, "*** sipreplay: failed to listen 127.0.0.1:%d\n", port);
+
+    snprintf(tag, sizeof(tag), ".r%lu", timing::mstime() % 100000l);
+    elapsed = replay(so, target, sizeof(struct sockaddr_in), ntohs(local.sin_port));
+    return report(elapsed);
+}
+